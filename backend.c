@@ -0,0 +1,49 @@
+#include "backend.h"
+
+static bool headless_open(backend *backend_p);
+static bool headless_poll_events(backend *backend_p, gb_context *gb_p);
+static void headless_present(backend *backend_p, gb_context *gb_p);
+static void headless_close(backend *backend_p);
+
+/*
+    no window and no input device, frames are only kept in the framebuffers
+    the run is stopped by the frame count
+*/
+backend *initialize_headless_backend(void){
+
+    backend *backend_p = calloc(sizeof(backend), 1);
+    backend_p->name = "headless";
+    backend_p->framebuffer_format = FRAMEBUFFER_INDEXED;
+    backend_p->any_format = TRUE;
+    backend_p->open = headless_open;
+    backend_p->poll_events = headless_poll_events;
+    backend_p->present = headless_present;
+    backend_p->close = headless_close;
+    return backend_p;
+}
+
+void free_backend(backend *backend_p){
+    if (backend_p == NULL){
+        return;
+    }
+    backend_p->close(backend_p);
+    free(backend_p);
+}
+
+static bool headless_open(backend *backend_p){
+    return TRUE;
+}
+
+static bool headless_poll_events(backend *backend_p, gb_context *gb_p){
+    return TRUE;
+}
+
+// the frames are taken like a recorder would, so the exchange counters read the same as with a window
+static void headless_present(backend *backend_p, gb_context *gb_p){
+    if (gb_p->frames_p != NULL){
+        take_frame(gb_p->frames_p);
+    }
+}
+
+static void headless_close(backend *backend_p){
+}
@@ -0,0 +1,25 @@
+#ifndef __BACKEND_H__
+#define __BACKEND_H__
+
+#include "environment.h"
+#include "gameboy.h"
+
+/*
+    video output and input of the emulator loop
+    the framebuffer is drawn in the format the backend presents, so presenting never converts
+*/
+typedef struct backend backend;
+struct backend{
+    const char *name;
+    byte framebuffer_format;
+    bool any_format; // present takes frames of every format, otherwise only framebuffer_format
+    bool (*open)(backend *backend_p);
+    bool (*poll_events)(backend *backend_p, gb_context *gb_p); // FALSE once the user asked to quit
+    void (*present)(backend *backend_p, gb_context *gb_p);
+    void (*close)(backend *backend_p);
+    void *data_p; // state of the implementation
+};
+
+backend *initialize_headless_backend(void);
+void free_backend(backend *backend_p);
+#endif
@@ -0,0 +1,109 @@
+/*
+    CPU dispatch benchmark
+
+    build the same benchmark once per dispatch to compare them :
+        gcc -O2 benchmark.c cpu.c block_cache.c jit.c trace.c scheduler.c memory.c mbc.c save.c tile_cache.c plane_cache.c sprite_cache.c palette.c cartridge.c -o benchmark                      (opcode table)
+        gcc -O2 -DDIRECT_THREADED benchmark.c cpu.c block_cache.c jit.c trace.c scheduler.c memory.c mbc.c save.c tile_cache.c plane_cache.c sprite_cache.c palette.c cartridge.c -o benchmark    (computed goto)
+        gcc -O2 -DSWITCH_DISPATCH benchmark.c cpu.c block_cache.c jit.c trace.c scheduler.c memory.c mbc.c save.c tile_cache.c plane_cache.c sprite_cache.c palette.c cartridge.c -o benchmark    (original switch)
+
+    add -DBLOCK_CACHE to run the loop from ROM through the block cache
+    add -DJIT to recompile it to x86-64 as well
+    add -DLAZY_FLAGS to compare lazy flag evaluation against the eager ALU helpers
+*/
+#include <time.h>
+#include "environment.h"
+#include "cartridge.h"
+#include "memory.h"
+#include "cpu.h"
+#include "block_cache.h"
+#ifdef JIT
+#include "jit.h"
+#define BLOCK_CACHE
+#endif
+
+#define BENCHMARK_CYCLES 100000000
+#define BENCHMARK_RUNS 5
+#ifdef BLOCK_CACHE
+#define LOOP_ADDRESS 0x0150
+#else
+#define LOOP_ADDRESS 0xC000
+#endif
+
+#if defined(SWITCH_DISPATCH)
+#define DISPATCH_NAME "switch"
+#elif defined(DIRECT_THREADED)
+#define DISPATCH_NAME "direct threaded"
+#else
+#define DISPATCH_NAME "table"
+#endif
+
+#ifdef LAZY_FLAGS
+#define FLAGS_NAME "lazy"
+#else
+#define FLAGS_NAME "eager"
+#endif
+
+static double get_time(void);
+static void load_alu_loop(cpu *cpu_p);
+
+int main(void){
+    cartridge *cartridge_p = initialize_empty_cartridge(GAMEBOY, 2);
+    memory_map *memory_p = initialize_memory(cartridge_p);
+    cpu *cpu_p = initialize_cpu(memory_p);
+    double best = 0;
+
+    load_alu_loop(cpu_p);
+#ifdef BLOCK_CACHE
+    cpu_p->block_cache_p = initialize_block_cache();
+#endif
+#ifdef JIT
+    cpu_p->jit_p = initialize_jit_compiler();
+#endif
+
+    for (int run = 0; run < BENCHMARK_RUNS; run++){
+        double start = get_time();
+        int cycles = run_opcodes(cpu_p, BENCHMARK_CYCLES);
+        double elapsed = get_time() - start;
+
+        // every instruction of the loop takes 4 cycles
+        double instructions_per_second = (cycles / 4) / elapsed;
+        if (instructions_per_second > best){
+            best = instructions_per_second;
+        }
+    }
+
+    printf("dispatch : %s%s%s\n", DISPATCH_NAME, cpu_p->block_cache_p != NULL ? " + block cache" : "", cpu_p->jit_p != NULL ? " + JIT" : "");
+    printf("flags : %s\n", FLAGS_NAME);
+    printf("instructions per second : %.0f (%.2fx real time)\n", best, (best * 4) / CPU_MAX_CYCLES);
+
+    free_cartridge(cartridge_p);
+    free_memory(memory_p);
+#ifdef JIT
+    free_jit_compiler(cpu_p->jit_p);
+#endif
+    free(cpu_p->block_cache_p);
+    free(cpu_p);
+    return 0;
+}
+
+/*
+    ALU heavy loop in WRAM (ROM BANK0 with the block cache)
+        INC A, ADD A B, XOR C, AND D, OR E, CP H, INC B, SUB C, ADC A D, JP (HL)
+*/
+static void load_alu_loop(cpu *cpu_p){
+    byte program[] = { 0x3C, 0x80, 0xA9, 0xA2, 0xB3, 0xBC, 0x04, 0x91, 0x8A, 0xE9 };
+
+    memcpy(&cpu_p->memory_p->memory[LOOP_ADDRESS], program, sizeof(program));
+    cpu_p->PC = LOOP_ADDRESS;
+    cpu_p->HL.hi = LOOP_ADDRESS >> 8;
+    cpu_p->HL.lo = LOOP_ADDRESS & 0xFF;
+    cpu_p->BC.lo = 0x13;
+    cpu_p->DE.hi = 0x5A;
+    cpu_p->DE.lo = 0x0F;
+}
+
+static double get_time(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + (now.tv_nsec / 1000000000.0);
+}
@@ -0,0 +1,141 @@
+#include "block_cache.h"
+#include "jit.h"
+#include "trace.h"
+
+#define CB_PREFIX 0xCB
+#define ROM_REGION(address) ((address) & 0x4000)
+
+static cached_block *lookup_block(block_cache *cache_p, memory_map *memory_p, word address);
+static void decode_block(cached_block *block_p, memory_map *memory_p, word address, word bank);
+static word get_block_bank(memory_map *memory_p, word address);
+
+block_cache *initialize_block_cache(){
+
+    block_cache *cache_p = calloc(sizeof(block_cache), 1);
+    return cache_p;
+}
+
+/*
+    run the block starting at PC, decoding it first if it isn't cached yet
+    PC must be in ROM, returns the cycles used by the instructions that ran
+*/
+int execute_block(cpu *cpu_p, block_cache *cache_p){
+
+    memory_map *memory_p = cpu_p->memory_p;
+
+    // a timed DMA leaves only open bus in ROM, nothing is decoded from it or matched meanwhile
+    if (memory_p->dma_active && memory_p->dma_mode == DMA_TIMED){
+        byte opcode = read_memory(memory_p, cpu_p->PC);
+        cpu_p->PC++;
+        return execute_opcode(cpu_p, opcode);
+    }
+
+    cached_block *block_p = lookup_block(cache_p, memory_p, cpu_p->PC);
+    int cycles_used = 0;
+
+    // instruction overlapping both ROM regions, its operand depends on the bank
+    if (block_p->instruction_count == 0){
+        byte opcode = read_memory(memory_p, cpu_p->PC);
+        cpu_p->PC++;
+        return execute_opcode(cpu_p, opcode);
+    }
+
+    // the boot ROM runs once, it's never worth compiling
+    if (cpu_p->jit_p != NULL && block_p->bank != BOOT_ROM_BANK){
+        if (block_p->compiled == NULL && ++block_p->executions == JIT_HOT_THRESHOLD){
+            block_p->compiled = compile_block(cpu_p->jit_p, cache_p, block_p);
+        }
+        if (block_p->compiled != NULL){
+            return block_p->compiled(cpu_p);
+        }
+    }
+
+    for (int i = 0; i < block_p->instruction_count; i++){
+        decoded_instruction *instruction_p = &block_p->instructions[i];
+        TRACE_LOG(TRACE_LEVEL_DEBUG, TRACE_CPU, TRACE_EXECUTE_OPCODE, instruction_p->opcode, cpu_p->PC);
+        cpu_p->PC += instruction_p->length;
+        cycles_used += instruction_p->entry_p->handler(cpu_p, instruction_p->entry_p, instruction_p->operand);
+
+        // the rest of the block was decoded from the bank (or boot ROM) that was just switched out
+        if (block_p->bank != get_block_bank(memory_p, block_p->address)){
+            break;
+        }
+    }
+    return cycles_used;
+}
+
+// blocks are keyed on (address, bank) so blocks of a switched out bank are never matched
+static cached_block *lookup_block(block_cache *cache_p, memory_map *memory_p, word address){
+
+    word bank = get_block_bank(memory_p, address);
+    word index = (address ^ (bank << 5)) & (BLOCK_CACHE_SIZE - 1);
+    cached_block *block_p = &cache_p->blocks[index];
+
+    if (block_p->valid && block_p->address == address && block_p->bank == bank){
+        cache_p->hits++;
+        return block_p;
+    }
+
+    cache_p->misses++;
+    decode_block(block_p, memory_p, address, bank);
+    return block_p;
+}
+
+static void decode_block(cached_block *block_p, memory_map *memory_p, word address, word bank){
+
+    word start = address;
+
+    block_p->address = address;
+    block_p->bank = bank;
+    block_p->valid = TRUE;
+    block_p->instruction_count = 0;
+    block_p->cycles = 0;
+    block_p->executions = 0;
+    block_p->compiled = NULL;
+
+    while (block_p->instruction_count < BLOCK_MAX_INSTRUCTIONS){
+        byte opcode = read_memory(memory_p, address);
+        const opcode_entry *entry_p = get_opcode_entry(opcode);
+        word last = address + entry_p->length - 1;
+
+        // stop before leaving the ROM region the block was decoded from
+        if (!IS_CACHEABLE_ADDRESS(last) || ROM_REGION(last) != ROM_REGION(start)){
+            break;
+        }
+
+        decoded_instruction *instruction_p = &block_p->instructions[block_p->instruction_count++];
+        instruction_p->opcode = opcode;
+        instruction_p->length = entry_p->length;
+        instruction_p->operand = 0;
+
+        if (opcode == CB_PREFIX){
+            entry_p = get_extended_opcode_entry(read_memory(memory_p, address + 1));
+        }
+        else if (entry_p->length == 2){
+            instruction_p->operand = read_memory(memory_p, address + 1);
+        }
+        else if (entry_p->length == 3){
+            instruction_p->operand = (read_memory(memory_p, address + 2) << 8) | read_memory(memory_p, address + 1);
+        }
+
+        instruction_p->entry_p = entry_p;
+        block_p->cycles += entry_p->cycles;
+        address += instruction_p->length;
+
+        if (entry_p->flags & ENDS_BLOCK){
+            break;
+        }
+    }
+}
+
+static word get_block_bank(memory_map *memory_p, word address){
+    // blocks of the boot ROM are never matched once the cartridge shows through
+    if (address < BOOT_ROM_SIZE && memory_p->boot_rom_p != NULL){
+        return BOOT_ROM_BANK;
+    }
+    // BANK0 unless MBC1 mode 1 maps a higher bank in 0x0000 - 0x3FFF
+    if (address < 0x4000){
+        return memory_p->current_rom0_bank;
+    }
+    return memory_p->current_rom_bank;
+}
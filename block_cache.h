@@ -0,0 +1,50 @@
+#ifndef __BLOCK_CACHE_H__
+#define __BLOCK_CACHE_H__
+
+#include "environment.h"
+#include "memory.h"
+#include "cpu.h"
+
+#define BLOCK_CACHE_SIZE 2048
+#define BLOCK_MAX_INSTRUCTIONS 16
+#define BOOT_ROM_BANK 0xFFFF // bank key of the blocks decoded from the boot ROM
+
+// only code running from ROM is cached, WRAM / HRAM code can be modified by the game
+#define IS_CACHEABLE_ADDRESS(address) ((address) < 0x8000)
+
+/*
+    basic block decoded once from ROM
+    a block ends on the first instruction flagged ENDS_BLOCK, after BLOCK_MAX_INSTRUCTIONS
+    or when the next instruction would cross into another ROM bank region.
+*/
+typedef struct decoded_instruction {
+    const opcode_entry *entry_p;
+    word operand;
+    byte opcode;
+    byte length;
+} decoded_instruction;
+
+// host code generated by the JIT for a block, returns the cycles used
+typedef int (*jit_block_function)(cpu *cpu_p);
+
+typedef struct cached_block {
+    word address;
+    word bank;
+    byte valid;
+    byte instruction_count;
+    word cycles;
+    unsigned int executions;
+    jit_block_function compiled;
+    decoded_instruction instructions[BLOCK_MAX_INSTRUCTIONS];
+} cached_block;
+
+struct block_cache {
+    cached_block blocks[BLOCK_CACHE_SIZE];
+    unsigned long hits;
+    unsigned long misses;
+};
+
+block_cache *initialize_block_cache();
+int execute_block(cpu *cpu_p, block_cache *cache_p);
+
+#endif
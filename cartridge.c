@@ -1,3 +1,7 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "cartridge.h"
 
 #define NINTENDO_LOGO_INDEX 0x104
@@ -7,18 +11,53 @@
 #define CARTRIDGE_TYPE_INDEX 0x147
 #define ROM_SIZE_INDEX 0x148
 #define RAM_SIZE_INDEX 0x149
+#define HEADER_SIZE 0x150
 
 static void load_cartridge_rom(cartridge *cartridge_p, char *file_name);
+static void read_cartridge_header(cartridge *cartridge_p);
 static void print_cartridge_values(cartridge *cartridge_p);
 static byte get_cartridge_type(byte data);
-static byte get_rom_banks(byte data);
+static unsigned long get_rom_size(byte data);
 static byte get_ram_banks(byte data);
+static byte has_battery(byte data);
 
 cartridge *initialize_cartridge(char *file_name){
 
     cartridge *cartridge_p = calloc(sizeof(cartridge), 1);
 
     load_cartridge_rom(cartridge_p, file_name);
+    read_cartridge_header(cartridge_p);
+
+    //print_cartridge_values(cartridge_p); 
+
+    return cartridge_p;
+}
+
+// blank ROM for tests and benchmarks that write their own code into memory
+cartridge *initialize_empty_cartridge(byte cartridge_type, word rom_banks){
+
+    cartridge *cartridge_p = calloc(sizeof(cartridge), 1);
+    cartridge_p->rom_size = rom_banks * ROM_BANK_SIZE;
+    cartridge_p->cartridge_memory = calloc(cartridge_p->rom_size, 1);
+    cartridge_p->rom_banks = rom_banks;
+    cartridge_p->cartridge_type = cartridge_type;
+    return cartridge_p;
+}
+
+void free_cartridge(cartridge *cartridge_p){
+
+    if (cartridge_p == NULL){
+        return;
+    }
+    if (cartridge_p->mapped){
+        munmap(cartridge_p->cartridge_memory, cartridge_p->rom_size);
+    } else {
+        free(cartridge_p->cartridge_memory);
+    }
+    free(cartridge_p);
+}
+
+static void read_cartridge_header(cartridge *cartridge_p){
 
     memcpy(&cartridge_p->nintendo_logo, &cartridge_p->cartridge_memory[NINTENDO_LOGO_INDEX], NINTENDO_LOGO_SIZE);
     memcpy(&cartridge_p->game_title, &cartridge_p->cartridge_memory[GAME_TITLE_INDEX], GAME_TITLE_SIZE);
@@ -26,50 +65,67 @@ cartridge *initialize_cartridge(char *file_name){
 
     cartridge_p->gameboy_indicator = cartridge_p->cartridge_memory[GAMEBOY_INDICATOR_INDEX];
     cartridge_p->gameboy_type = cartridge_p->cartridge_memory[GAMEBOY_TYPE_INDEX];
-    cartridge_p->rom_banks = get_rom_banks(cartridge_p->cartridge_memory[ROM_SIZE_INDEX]);
+    cartridge_p->rom_banks = cartridge_p->rom_size / ROM_BANK_SIZE;
     cartridge_p->ram_banks = get_ram_banks(cartridge_p->cartridge_memory[RAM_SIZE_INDEX]);  
     cartridge_p->cartridge_type = get_cartridge_type(cartridge_p->cartridge_memory[CARTRIDGE_TYPE_INDEX]); 
-
-    //print_cartridge_values(cartridge_p); 
-
-    return cartridge_p;
+    cartridge_p->battery = has_battery(cartridge_p->cartridge_memory[CARTRIDGE_TYPE_INDEX]);
 }
 
+/*
+    map the ROM when the file holds at least the size announced by the header,
+    otherwise (boot ROM, truncated dumps, mmap failure) read it in a zeroed buffer of that size
+    so the switchable bank never points past the image
+*/
 static void load_cartridge_rom(cartridge *cartridge_p, char* file_name){
 
-    FILE *rom_file = fopen(file_name, "rb");
+    byte header[HEADER_SIZE] = {0};
+    struct stat file_stat;
+    int rom_file = open(file_name, O_RDONLY);
 
-    if (rom_file == NULL){
+    if (rom_file < 0 || fstat(rom_file, &file_stat) < 0){
         printf("ERROR : Couldn't open %s \n", file_name);
         exit(1);
     }
 
-    fread(cartridge_p->cartridge_memory, CARTRIDGE_MAX_SIZE, 1, rom_file);
-    fclose(rom_file);
+    pread(rom_file, header, HEADER_SIZE, 0);
+    cartridge_p->rom_size = get_rom_size(header[ROM_SIZE_INDEX]);
+
+    if (file_stat.st_size >= cartridge_p->rom_size){
+        void *rom_p = mmap(NULL, cartridge_p->rom_size, PROT_READ, MAP_PRIVATE, rom_file, 0);
+        if (rom_p != MAP_FAILED){
+            cartridge_p->cartridge_memory = rom_p;
+            cartridge_p->mapped = TRUE;
+            close(rom_file);
+            return;
+        }
+    }
+
+    cartridge_p->cartridge_memory = calloc(cartridge_p->rom_size, 1);
+    pread(rom_file, cartridge_p->cartridge_memory, cartridge_p->rom_size, 0);
+    close(rom_file);
 }
 
-static byte get_rom_banks(byte data){
+// 32 KB << n, unknown values fall back to the smallest ROM
+static unsigned long get_rom_size(byte data){
     
-    byte rom_banks;
-
-    switch(data){
-        case 0 : rom_banks = 2; break;
-        case 1 : rom_banks = 4; break;
-        case 2 : rom_banks = 8; break;
-        default : break;
+    if (data > 8){
+        return CARTRIDGE_MIN_SIZE;
     }
-
-    return rom_banks;
+    return CARTRIDGE_MIN_SIZE << data;
 }
 
 static byte get_ram_banks(byte data){
     
-    byte ram_banks;
+    byte ram_banks = 0;
 
+    // 8 KB banks, the 2 KB RAM of size 1 still takes a whole bank
     switch(data){
         case 0 : ram_banks = 0; break;
         case 1 : ram_banks = 1; break;
         case 2 : ram_banks = 1; break;
+        case 3 : ram_banks = 4; break;
+        case 4 : ram_banks = 16; break;
+        case 5 : ram_banks = 8; break;
         default : break;
     }
 
@@ -78,7 +134,7 @@ static byte get_ram_banks(byte data){
 
 static byte get_cartridge_type(byte data){
     
-    byte result;
+    byte result = GAMEBOY;
     
     switch(data){
         case 0 : result = GAMEBOY; break;
@@ -87,23 +143,21 @@ static byte get_cartridge_type(byte data){
         case 3 : result = MBC1; break;
         case 5 : result = MBC2; break;
         case 6 : result = MBC2; break;
+        case 0x0F ... 0x13 : result = MBC3; break;
+        case 0x19 ... 0x1E : result = MBC5; break;
         default : break;
     }
     return result;
 }
-void set_nintendo_logo_data(cartridge *cartridge_p){
-    byte nintendo_logo_data[48] = {
-        0xce, 0xed, 0x66, 0x66, 0xcc, 0x0d, 0x00, 0x0b, 0x03, 
-        0x73, 0x00, 0x83, 0x00, 0x0c, 0x00, 0x0d, 0x00, 0x08,
-        0x11, 0x1f, 0x88, 0x89, 0x00, 0x0e, 0xdc, 0xcc, 0x6e,
-        0xe6, 0xdd, 0xdd, 0xd9, 0x99, 0xbb, 0xbb, 0x67, 0x63,
-        0x6e, 0x0e, 0xec, 0xcc, 0xdd, 0xdc, 0x99, 0x9f, 0xbb,
-        0xb9, 0x33, 0x3e
-    };
-
-    for (int i = 0; i < 48; i++){
-        cartridge_p->cartridge_memory[0x104 + i] = nintendo_logo_data[i];
-        //printf("Cartridge[0x%4X] IN CARTRIDGE 0x%02X \n", (0x104 + i), cartridge_p->cartridge_memory[0x104 + i]);
+static byte has_battery(byte data){
+
+    switch(data){
+        case 0x03 : case 0x06 : case 0x09 : case 0x0D :
+        case 0x0F : case 0x10 : case 0x13 :
+        case 0x1B : case 0x1E :
+            return TRUE;
+        default :
+            return FALSE;
     }
 }
 
@@ -3,26 +3,38 @@
 
 #include "environment.h"
 
-#define CARTRIDGE_MAX_SIZE 0x200000
+#define CARTRIDGE_MAX_SIZE 0x800000
+#define CARTRIDGE_MIN_SIZE 0x8000
+#define ROM_BANK_SIZE 0x4000
 #define GAME_TITLE_SIZE 0xE
 #define NINTENDO_LOGO_SIZE 0x2A
 
-// only supporting MBC1 and MBC2 since most games uses one of these
+// memory bank controllers, see mbc.c
 #define MBC1 1
 #define MBC2 2
+#define MBC3 3
+#define MBC5 5
 #define GAMEBOY 0
 
+/*
+    the ROM image is sized from the header and mmap'ed read-only so every instance of the same
+    game shares the page cache, files that don't match their header are read into a buffer instead
+*/
 typedef struct cartridge{
-    byte cartridge_memory[CARTRIDGE_MAX_SIZE];
+    byte *cartridge_memory;
+    unsigned long rom_size;
+    byte mapped;
     byte nintendo_logo[NINTENDO_LOGO_SIZE];
     byte gameboy_type;
     byte gameboy_indicator;
-    byte rom_banks;
+    word rom_banks;
     byte ram_banks;
     byte game_title[GAME_TITLE_SIZE + 1];
     byte cartridge_type;
+    byte battery; // external RAM is kept in a .sav file
 } cartridge;
 
 cartridge *initialize_cartridge(char *file_name);
-void set_nintendo_logo_data(cartridge *cartridge_p);
+cartridge *initialize_empty_cartridge(byte cartridge_type, word rom_banks);
+void free_cartridge(cartridge *cartridge_p);
 #endif
\ No newline at end of file
@@ -1,17 +1,116 @@
+#include <stddef.h>
 #include "cpu.h"
+#include "block_cache.h"
+#include "trace.h"
 
 #define ZERO_FLAG 7
 #define SUBTRACT_FLAG 6
 #define HALF_CARRY_FLAG 5
 #define CARRY_FLAG 4
 
-static void load_immediate_8_bit(cpu *cpu_p, byte *register_p);
+// register selectors used by opcodes.def, 8 bit selectors follow the opcode encoding
+#define NONE 0
+#define REG_B 0
+#define REG_C 1
+#define REG_D 2
+#define REG_E 3
+#define REG_H 4
+#define REG_L 5
+#define REG_HL_INDIRECT 6
+#define REG_A 7
+
+#define PAIR_BC 0
+#define PAIR_DE 1
+#define PAIR_HL 2
+#define PAIR_SP 3
+#define PAIR_AF 4
+
+#ifdef LAZY_FLAGS
+#if defined(SWITCH_DISPATCH)
+#error "LAZY_FLAGS needs the opcode table dispatch"
+#endif
+
+// pending flag computations
+#define FLAGS_NONE 0
+#define FLAGS_ADD 1
+#define FLAGS_SUB 2
+#define FLAGS_AND 3
+#define FLAGS_LOGIC 4
+#define FLAGS_INC 5
+#define FLAGS_DEC 6
+
+// handlers that read or partially write F compute the pending flags first
+#define FLAGS_F(cpu_p) (materialize_flags(cpu_p), &(cpu_p)->AF.lo)
+#define FLAGS_AF(cpu_p) (materialize_flags(cpu_p), &(cpu_p)->AF)
+#define ALU_TARGET(cpu_p) (cpu_p)
+#else
+#define FLAGS_F(cpu_p) (&(cpu_p)->AF.lo)
+#define FLAGS_AF(cpu_p) (&(cpu_p)->AF)
+#define ALU_TARGET(cpu_p) (&(cpu_p)->AF)
+#endif
+
+// handler declarations generated from the opcode specification
+#define OPCODE(code, handler, length, target, source, cycles, flags, mnemonic) \
+    static int handler(cpu *cpu_p, const opcode_entry *entry_p, word operand);
+#define CB_OPCODES(base, handler, position, mnemonic) \
+    static int op_##handler(cpu *cpu_p, const opcode_entry *entry_p, word operand); \
+    static int op_##handler##_memory(cpu *cpu_p, const opcode_entry *entry_p, word operand);
+#include "opcodes.def"
+#undef OPCODE
+#undef CB_OPCODES
+
+static const opcode_entry opcode_table[256] = {
+#define OPCODE(code, handler, length, target, source, cycles, flags, mnemonic) \
+    [code] = { handler, length, target, source, cycles, flags, mnemonic },
+#define CB_OPCODES(base, handler, position, mnemonic)
+#include "opcodes.def"
+#undef OPCODE
+#undef CB_OPCODES
+};
+
+static const opcode_entry extended_opcode_table[256] = {
+#define OPCODE(code, handler, length, target, source, cycles, flags, mnemonic)
+#define CB_OPCODES(base, handler, position, mnemonic) \
+    [base + 0] = { op_##handler, 2, REG_B, position, 8, NONE, mnemonic " B" }, \
+    [base + 1] = { op_##handler, 2, REG_C, position, 8, NONE, mnemonic " C" }, \
+    [base + 2] = { op_##handler, 2, REG_D, position, 8, NONE, mnemonic " D" }, \
+    [base + 3] = { op_##handler, 2, REG_E, position, 8, NONE, mnemonic " E" }, \
+    [base + 4] = { op_##handler, 2, REG_H, position, 8, NONE, mnemonic " H" }, \
+    [base + 5] = { op_##handler, 2, REG_L, position, 8, NONE, mnemonic " L" }, \
+    [base + 6] = { op_##handler##_memory, 2, REG_HL_INDIRECT, position, 16, NONE, mnemonic " (HL)" }, \
+    [base + 7] = { op_##handler, 2, REG_A, position, 8, NONE, mnemonic " A" },
+#include "opcodes.def"
+#undef OPCODE
+#undef CB_OPCODES
+};
+
+// offsets of the registers inside the cpu struct indexed by the register selectors
+static const size_t register_8_bit_offsets[8] = {
+    offsetof(cpu, BC.hi), offsetof(cpu, BC.lo), offsetof(cpu, DE.hi), offsetof(cpu, DE.lo),
+    offsetof(cpu, HL.hi), offsetof(cpu, HL.lo), 0, offsetof(cpu, AF.hi)
+};
+
+static const size_t register_16_bit_offsets[5] = {
+    offsetof(cpu, BC), offsetof(cpu, DE), offsetof(cpu, HL), offsetof(cpu, SP), offsetof(cpu, AF)
+};
+
 static void load_8_bit(byte *p, byte data);
 static byte get_immediate_8_bit(cpu *cpu_p);
-static void load_immediate_16_bit(cpu *cpu_p, cpu_register *register_p);
 static word get_immediate_16_bit(cpu *cpu_p);
 static void set_registers_word(cpu_register *register_p, word data);
-static void load_hl(cpu *cpu_p, cpu_register *AF_p, cpu_register *HL_p);
+static void load_hl(cpu *cpu_p, cpu_register *AF_p, cpu_register *HL_p, byte n);
+#ifdef LAZY_FLAGS
+static void lazy_add_8_bit(cpu *cpu_p, byte data);
+static void lazy_add_carry_8_bit(cpu *cpu_p, byte data);
+static void lazy_sub_8_bit(cpu *cpu_p, byte data);
+static void lazy_sub_carry_8_bit(cpu *cpu_p, byte data);
+static void lazy_and_8_bit(cpu *cpu_p, byte data);
+static void lazy_or_8_bit(cpu *cpu_p, byte data);
+static void lazy_xor_8_bit(cpu *cpu_p, byte data);
+static void lazy_cp_8_bit(cpu *cpu_p, byte data);
+static void lazy_inc_8_bit(cpu *cpu_p, byte *register_p);
+static void lazy_dec_8_bit(cpu *cpu_p, byte *register_p);
+#else
 static void add_8_bit(cpu_register *register_p, byte data);
 static void add_carry_8_bit(cpu_register *AF_p, byte data);
 static void sub_8_bit(cpu_register *AF_p, byte data);
@@ -21,18 +120,18 @@ static void or_8_bit(cpu_register *AF_p, byte data);
 static void xor_8_bit(cpu_register *AF_p, byte data);
 static void cp_8_bit(cpu_register *AF_p, byte data);
 static void inc_8_bit(byte *register_p, cpu_register *AF_p);
+static void dec_8_bit(byte *register_p, cpu_register *AF_p);
+#endif
 static void inc_memory_8_bit(cpu *register_p, cpu_register *AF_p);
 static void dec_memory_8_bit(cpu *register_p, cpu_register *AF_p);
-static void dec_8_bit(byte *register_p, cpu_register *AF_p);
 static void add_16_bit_hl(cpu_register *HL_p, cpu_register *AF_p, word data);
-static void add_16_bit_sp(cpu *cpu_p, cpu_register *SP_p, cpu_register *AF_p);
+static void add_16_bit_sp(cpu_register *SP_p, cpu_register *AF_p, signed_byte data);
 static void increment(cpu_register *register_p);
 static void decrement(cpu_register *register_p);
 static void inc_16_bit(cpu_register *register_p);
 static void dec_16_bit(cpu_register *register_p);
 static void swap_nibble(byte *register_p, byte *F_p);
 static void swap_nibble_memory(memory_map *memory_p, byte *F_p, word address);
-static int execute_extended_opcode(cpu *cpu_p);
 static void cpl(cpu_register *AF_p);
 static void ccf(byte *F_p);
 static void scf(byte *F_p);
@@ -62,17 +161,13 @@ static void set(byte position, byte *R_p);
 static void set_memory(byte position, memory_map *memory_p, word address);
 static void res(byte position, byte *R_p);
 static void res_memory(byte position, memory_map *memory_p, word address);
-static void jp(cpu *cpu_p, byte *F_p, byte has_condition, byte condition, byte flag);
+static void jp(cpu *cpu_p, word address, byte *F_p, byte has_condition, byte condition, byte flag);
 static void jp_hl(cpu *cpu_p);
-static void jr(cpu *cpu_p, byte *F_p, byte has_condition, byte condition, byte flag);
-static void call(cpu *cpu_p, byte* F_p, byte has_condition, byte condition, byte flag);
+static void jr(cpu *cpu_p, signed_byte value, byte *F_p, byte has_condition, byte condition, byte flag);
+static void call(cpu *cpu_p, word address, byte* F_p, byte has_condition, byte condition, byte flag);
 static void rst(cpu *cpu_p, byte n);
 static void ret(cpu *cpu_p, byte *F_p, cpu_register *SP_p, byte has_condition, byte condition, byte flag);
 static void reti(cpu *cpu_p, cpu_register *SP_p);
-static word address;
-static byte *register_p;
-static byte data;
-
 cpu *initialize_cpu(memory_map *memory_p){
     
     cpu *cpu_p = calloc(sizeof(cpu), 1);
@@ -84,24 +179,141 @@ int execute_next_opcode(cpu *cpu_p){
 
     int cycles = 0;
     byte opcode = read_memory(cpu_p->memory_p, cpu_p->PC);
-    printf("EXECUTING OPCODE %02X: ", opcode);
+    TRACE_LOG(TRACE_LEVEL_DEBUG, TRACE_CPU, TRACE_EXECUTE_OPCODE, opcode, cpu_p->PC);
     cpu_p->PC += 1;
     cycles = execute_opcode(cpu_p, opcode);
     return cycles;
 
 }
 
+const opcode_entry *get_opcode_entry(byte opcode){
+    return &opcode_table[opcode];
+}
+
+const opcode_entry *get_extended_opcode_entry(byte opcode){
+    return &extended_opcode_table[opcode];
+}
+
+static inline byte *get_register_8_bit(cpu *cpu_p, byte index){
+    return (byte *) cpu_p + register_8_bit_offsets[index];
+}
+
+static inline cpu_register *get_register_16_bit(cpu *cpu_p, byte index){
+    return (cpu_register *) ((byte *) cpu_p + register_16_bit_offsets[index]);
+}
+
+// immediate operand following the opcode, PC is pointing right after the opcode
+static inline word fetch_operand(cpu *cpu_p, byte length){
+    switch(length){
+        case 2: return get_immediate_8_bit(cpu_p);
+        case 3: return get_immediate_16_bit(cpu_p);
+    }
+    return 0;
+}
+
+#ifndef SWITCH_DISPATCH
+
+static inline int dispatch_opcode(cpu *cpu_p, byte opcode){
+    const opcode_entry *entry_p = &opcode_table[opcode];
+    word operand = fetch_operand(cpu_p, entry_p->length);
+    return entry_p->handler(cpu_p, entry_p, operand);
+}
+
+int execute_opcode(cpu *cpu_p, byte opcode){
+    int cycles = dispatch_opcode(cpu_p, opcode);
+#ifdef LAZY_FLAGS
+    materialize_flags(cpu_p);
+#endif
+    return cycles;
+}
+
+#ifdef DIRECT_THREADED
+
+/*
+    direct threaded dispatch (GCC/Clang computed goto)
+    every opcode gets its own label so the handler call is direct and the indirect jump
+    is replicated at the end of each opcode instead of going through a single switch.
+*/
+int run_opcodes(cpu *cpu_p, int cycles){
+    static void *const dispatch_table[256] = {
+#define OPCODE(code, handler, length, target, source, cycles, flags, mnemonic) [code] = &&opcode_##code,
+#define CB_OPCODES(base, handler, position, mnemonic)
+#include "opcodes.def"
+#undef OPCODE
+#undef CB_OPCODES
+    };
+
+    int cycles_used = 0;
+    word operand;
+
+#define DISPATCH() \
+    if (cycles_used >= cycles){ \
+        materialize_flags(cpu_p); \
+        return cycles_used; \
+    } \
+    if (cpu_p->block_cache_p != NULL && IS_CACHEABLE_ADDRESS(cpu_p->PC)){ \
+        cycles_used += execute_block(cpu_p, cpu_p->block_cache_p); \
+        goto dispatch; \
+    } \
+    goto *dispatch_table[read_memory(cpu_p->memory_p, cpu_p->PC++)]
+
+dispatch:
+    DISPATCH();
+
+#define OPCODE(code, handler, length, target, source, cycles, flags, mnemonic) \
+    opcode_##code: \
+        operand = fetch_operand(cpu_p, length); \
+        cycles_used += handler(cpu_p, &opcode_table[code], operand); \
+        DISPATCH();
+#define CB_OPCODES(base, handler, position, mnemonic)
+#include "opcodes.def"
+#undef OPCODE
+#undef CB_OPCODES
+#undef DISPATCH
+}
+
+#else
+
+int run_opcodes(cpu *cpu_p, int cycles){
+    int cycles_used = 0;
+    while (cycles_used < cycles){
+        cycles_used += execute_next_block(cpu_p);
+    }
+    materialize_flags(cpu_p);
+    return cycles_used;
+}
+
+#endif
+
+#else
+
+// original switch dispatch, kept to compare against the table in benchmark.c
+static int execute_extended_opcode(cpu *cpu_p);
+
+static inline int dispatch_opcode(cpu *cpu_p, byte opcode){
+    return execute_opcode(cpu_p, opcode);
+}
+
+// the blocks are run when a block cache is attached, like the table dispatchers do
+int run_opcodes(cpu *cpu_p, int cycles){
+    int cycles_used = 0;
+    while (cycles_used < cycles){
+        cycles_used += execute_next_block(cpu_p);
+    }
+    return cycles_used;
+}
+
 int execute_opcode(cpu *cpu_p, byte opcode){
     
     switch(opcode){
         // LD r, n when n == immediate 8 bit
-        case 0x3E: load_immediate_8_bit(cpu_p, &cpu_p->AF.hi); return 8;
-        case 0x06: load_immediate_8_bit(cpu_p, &cpu_p->BC.hi); return 8;
-        case 0x0E: load_immediate_8_bit(cpu_p, &cpu_p->BC.lo); return 8;
-        case 0x16: load_immediate_8_bit(cpu_p, &cpu_p->DE.hi); return 8;
-        case 0x1E: load_immediate_8_bit(cpu_p, &cpu_p->DE.lo); return 8;
-        case 0x26: load_immediate_8_bit(cpu_p, &cpu_p->HL.hi); return 8;
-        case 0x2E: load_immediate_8_bit(cpu_p, &cpu_p->HL.lo); return 8;
+        case 0x3E: load_8_bit(&cpu_p->AF.hi, get_immediate_8_bit(cpu_p)); return 8;
+        case 0x06: load_8_bit(&cpu_p->BC.hi, get_immediate_8_bit(cpu_p)); return 8;
+        case 0x0E: load_8_bit(&cpu_p->BC.lo, get_immediate_8_bit(cpu_p)); return 8;
+        case 0x16: load_8_bit(&cpu_p->DE.hi, get_immediate_8_bit(cpu_p)); return 8;
+        case 0x1E: load_8_bit(&cpu_p->DE.lo, get_immediate_8_bit(cpu_p)); return 8;
+        case 0x26: load_8_bit(&cpu_p->HL.hi, get_immediate_8_bit(cpu_p)); return 8;
+        case 0x2E: load_8_bit(&cpu_p->HL.lo, get_immediate_8_bit(cpu_p)); return 8;
 
         // LD r1, r2 when r1 == A
         case 0x7F: load_8_bit(&cpu_p->AF.hi, cpu_p->AF.hi); return 4;
@@ -215,21 +427,22 @@ int execute_opcode(cpu *cpu_p, byte opcode){
         case 0xF0: load_8_bit(&cpu_p->AF.hi, read_memory(cpu_p->memory_p, 0xFF00 + get_immediate_8_bit(cpu_p))); return 12;
 
         // LD n,nn when nn == immediate 16 bit
-        case 0x01: load_immediate_16_bit(cpu_p, &cpu_p->BC); return 12;
-        case 0x11: load_immediate_16_bit(cpu_p, &cpu_p->DE); return 12;
-        case 0x21: load_immediate_16_bit(cpu_p, &cpu_p->HL); return 12;
-        case 0x31: load_immediate_16_bit(cpu_p, &cpu_p->SP); return 12;
+        case 0x01: set_registers_word(&cpu_p->BC, get_immediate_16_bit(cpu_p)); return 12;
+        case 0x11: set_registers_word(&cpu_p->DE, get_immediate_16_bit(cpu_p)); return 12;
+        case 0x21: set_registers_word(&cpu_p->HL, get_immediate_16_bit(cpu_p)); return 12;
+        case 0x31: set_registers_word(&cpu_p->SP, get_immediate_16_bit(cpu_p)); return 12;
 
         // LD SP, HL
         case 0xF9: set_registers_word(&cpu_p->SP, get_registers_word(&cpu_p->HL)); return 8;
-        case 0xF8: load_hl(cpu_p, &cpu_p->AF, &cpu_p->HL); return 12;
+        case 0xF8: load_hl(cpu_p, &cpu_p->AF, &cpu_p->HL, get_immediate_8_bit(cpu_p)); return 12;
         // LD (nn), SP
-        case 0x08: 
-            address = get_immediate_16_bit(cpu_p);
+        case 0x08: {
+            word address = get_immediate_16_bit(cpu_p);
             write_memory(cpu_p->memory_p, address, cpu_p->SP.lo);
             address++;
             write_memory(cpu_p->memory_p, address, cpu_p->SP.hi);
-            return 20; 
+            return 20;
+        } 
 
         // 8-BIT ALU
 
@@ -351,7 +564,7 @@ int execute_opcode(cpu *cpu_p, byte opcode){
         case 0x39: add_16_bit_hl(&cpu_p->HL, &cpu_p->AF, get_registers_word(&cpu_p->SP)); return 8;
 
         // ADD SP, n
-        case 0xE8: add_16_bit_sp(cpu_p, &cpu_p->SP, &cpu_p->AF); return 16;
+        case 0xE8: add_16_bit_sp(&cpu_p->SP, &cpu_p->AF, get_immediate_8_bit(cpu_p)); return 16;
 
         // INC, nn
         case 0x03: inc_16_bit(&cpu_p->BC); return 8;
@@ -408,29 +621,29 @@ int execute_opcode(cpu *cpu_p, byte opcode){
         // JUMPs
 
         // JP nn
-        case 0xC3: jp(cpu_p, &cpu_p->AF.lo, FALSE, FALSE, 0); return 12;
+        case 0xC3: jp(cpu_p, get_immediate_16_bit(cpu_p), &cpu_p->AF.lo, FALSE, FALSE, 0); return 12;
         // JP cc, nn
-        case 0xC2: jp(cpu_p, &cpu_p->AF.lo, TRUE, FALSE, ZERO_FLAG); return 12;
-        case 0xCA: jp(cpu_p, &cpu_p->AF.lo, TRUE, TRUE, ZERO_FLAG); return 12; 
-        case 0xD2: jp(cpu_p, &cpu_p->AF.lo, TRUE, FALSE, CARRY_FLAG); return 12;
-        case 0xDA: jp(cpu_p, &cpu_p->AF.lo, TRUE, TRUE, CARRY_FLAG); return 12;
+        case 0xC2: jp(cpu_p, get_immediate_16_bit(cpu_p), &cpu_p->AF.lo, TRUE, FALSE, ZERO_FLAG); return 12;
+        case 0xCA: jp(cpu_p, get_immediate_16_bit(cpu_p), &cpu_p->AF.lo, TRUE, TRUE, ZERO_FLAG); return 12; 
+        case 0xD2: jp(cpu_p, get_immediate_16_bit(cpu_p), &cpu_p->AF.lo, TRUE, FALSE, CARRY_FLAG); return 12;
+        case 0xDA: jp(cpu_p, get_immediate_16_bit(cpu_p), &cpu_p->AF.lo, TRUE, TRUE, CARRY_FLAG); return 12;
 
         // JP (HL)
         case 0xE9: jp_hl(cpu_p); return 4;
         
         // JR n
-        case 0x18: jr(cpu_p, &cpu_p->AF.lo, FALSE, FALSE, 0); return 8;
-        case 0x20: jr(cpu_p, &cpu_p->AF.lo, TRUE, FALSE, ZERO_FLAG); return 8;
-        case 0x28: jr(cpu_p, &cpu_p->AF.lo, TRUE, TRUE, ZERO_FLAG); return 8;
-        case 0x30: jr(cpu_p, &cpu_p->AF.lo, TRUE, FALSE, CARRY_FLAG); return 8;
-        case 0x38: jr(cpu_p, &cpu_p->AF.lo, TRUE, TRUE, CARRY_FLAG); return 8;
+        case 0x18: jr(cpu_p, get_immediate_8_bit(cpu_p), &cpu_p->AF.lo, FALSE, FALSE, 0); return 8;
+        case 0x20: jr(cpu_p, get_immediate_8_bit(cpu_p), &cpu_p->AF.lo, TRUE, FALSE, ZERO_FLAG); return 8;
+        case 0x28: jr(cpu_p, get_immediate_8_bit(cpu_p), &cpu_p->AF.lo, TRUE, TRUE, ZERO_FLAG); return 8;
+        case 0x30: jr(cpu_p, get_immediate_8_bit(cpu_p), &cpu_p->AF.lo, TRUE, FALSE, CARRY_FLAG); return 8;
+        case 0x38: jr(cpu_p, get_immediate_8_bit(cpu_p), &cpu_p->AF.lo, TRUE, TRUE, CARRY_FLAG); return 8;
         
         // CALL
-        case 0xCD: call(cpu_p, &cpu_p->AF.lo, FALSE, FALSE, 0); return 12;
-        case 0xC4: call(cpu_p, &cpu_p->AF.lo, TRUE, FALSE, ZERO_FLAG); return 12;
-        case 0xCC: call(cpu_p, &cpu_p->AF.lo, TRUE, TRUE, ZERO_FLAG); return 12; 
-        case 0xD4: call(cpu_p, &cpu_p->AF.lo, TRUE, FALSE, CARRY_FLAG); return 12;
-        case 0xDC: call(cpu_p, &cpu_p->AF.lo, TRUE, TRUE, CARRY_FLAG); return 12;
+        case 0xCD: call(cpu_p, get_immediate_16_bit(cpu_p), &cpu_p->AF.lo, FALSE, FALSE, 0); return 12;
+        case 0xC4: call(cpu_p, get_immediate_16_bit(cpu_p), &cpu_p->AF.lo, TRUE, FALSE, ZERO_FLAG); return 12;
+        case 0xCC: call(cpu_p, get_immediate_16_bit(cpu_p), &cpu_p->AF.lo, TRUE, TRUE, ZERO_FLAG); return 12; 
+        case 0xD4: call(cpu_p, get_immediate_16_bit(cpu_p), &cpu_p->AF.lo, TRUE, FALSE, CARRY_FLAG); return 12;
+        case 0xDC: call(cpu_p, get_immediate_16_bit(cpu_p), &cpu_p->AF.lo, TRUE, TRUE, CARRY_FLAG); return 12;
 
         // PUSH
         case 0xF5: push_word_to_stack(cpu_p->memory_p, &cpu_p->SP, get_registers_word(&cpu_p->AF)); return 16;
@@ -474,7 +687,7 @@ static int execute_extended_opcode(cpu *cpu_p){
     
     byte extended_opcode = get_immediate_8_bit(cpu_p);
     
-    printf("EXTENDED OPCODE 0x%02X\n", extended_opcode);
+    TRACE_LOG(TRACE_LEVEL_DEBUG, TRACE_CPU, TRACE_EXECUTE_EXTENDED, extended_opcode, 0);
 
     switch(extended_opcode){
 
@@ -764,10 +977,488 @@ static int execute_extended_opcode(cpu *cpu_p){
     //return 0;
 }
 
-static void load_immediate_8_bit(cpu *cpu_p, byte *register_p){
-    byte data = get_immediate_8_bit(cpu_p);
-    printf("LD IMMEDIATE 8 BIT 0x%02X\n", data);
-    *register_p = data;
+#endif
+
+// run a whole cached block when PC is in ROM and the cache is enabled, a single opcode otherwise
+int execute_next_block(cpu *cpu_p){
+
+    if (cpu_p->block_cache_p != NULL && IS_CACHEABLE_ADDRESS(cpu_p->PC)){
+        return execute_block(cpu_p, cpu_p->block_cache_p);
+    }
+    byte opcode = read_memory(cpu_p->memory_p, cpu_p->PC);
+    TRACE_LOG(TRACE_LEVEL_DEBUG, TRACE_CPU, TRACE_EXECUTE_OPCODE, opcode, cpu_p->PC);
+    cpu_p->PC += 1;
+    return dispatch_opcode(cpu_p, opcode);
+}
+
+/*
+    opcode handlers referenced by opcodes.def
+    operand holds the immediate value already fetched by the dispatcher
+*/
+
+static int op_nop(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    nop();
+    return entry_p->cycles;
+}
+
+static int op_stop(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    stop(cpu_p);
+    return entry_p->cycles;
+}
+
+static int op_halt(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    halt(cpu_p);
+    return entry_p->cycles;
+}
+
+static int op_di(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    di(cpu_p);
+    return entry_p->cycles;
+}
+
+static int op_ei(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    ei(cpu_p);
+    return entry_p->cycles;
+}
+
+static int op_daa(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    daa(FLAGS_AF(cpu_p));
+    return entry_p->cycles;
+}
+
+static int op_cpl(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    cpl(FLAGS_AF(cpu_p));
+    return entry_p->cycles;
+}
+
+static int op_scf(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    scf(FLAGS_F(cpu_p));
+    return entry_p->cycles;
+}
+
+static int op_ccf(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    ccf(FLAGS_F(cpu_p));
+    return entry_p->cycles;
+}
+
+// the CB opcode is the operand of the prefix, its own entry gives the cycles
+static int op_prefix_cb(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    const opcode_entry *extended_p = &extended_opcode_table[operand & 0xFF];
+    return extended_p->handler(cpu_p, extended_p, 0);
+}
+
+static int op_illegal(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    printf("ERROR : OPCODE NOT FOUND : 0x%02X", read_memory(cpu_p->memory_p, cpu_p->PC - 1));
+    exit(1);
+}
+
+// 8-bit loads
+
+static int op_ld_r_immediate(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    load_8_bit(get_register_8_bit(cpu_p, entry_p->target), operand);
+    return entry_p->cycles;
+}
+
+static int op_ld_memory_immediate(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    write_memory(cpu_p->memory_p, get_registers_word(&cpu_p->HL), operand);
+    return entry_p->cycles;
+}
+
+static int op_ld_r_r(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    load_8_bit(get_register_8_bit(cpu_p, entry_p->target), *get_register_8_bit(cpu_p, entry_p->source));
+    return entry_p->cycles;
+}
+
+static int op_ld_r_memory(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    load_8_bit(get_register_8_bit(cpu_p, entry_p->target), read_memory(cpu_p->memory_p, get_registers_word(&cpu_p->HL)));
+    return entry_p->cycles;
+}
+
+static int op_ld_memory_r(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    write_memory(cpu_p->memory_p, get_registers_word(&cpu_p->HL), *get_register_8_bit(cpu_p, entry_p->source));
+    return entry_p->cycles;
+}
+
+static int op_ld_a_pair(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    load_8_bit(&cpu_p->AF.hi, read_memory(cpu_p->memory_p, get_registers_word(get_register_16_bit(cpu_p, entry_p->source))));
+    return entry_p->cycles;
+}
+
+static int op_ld_pair_a(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    write_memory(cpu_p->memory_p, get_registers_word(get_register_16_bit(cpu_p, entry_p->target)), cpu_p->AF.hi);
+    return entry_p->cycles;
+}
+
+static int op_ld_a_address(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    load_8_bit(&cpu_p->AF.hi, read_memory(cpu_p->memory_p, operand));
+    return entry_p->cycles;
+}
+
+static int op_ld_address_a(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    write_memory(cpu_p->memory_p, operand, cpu_p->AF.hi);
+    return entry_p->cycles;
+}
+
+static int op_ld_a_c(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    load_8_bit(&cpu_p->AF.hi, read_memory(cpu_p->memory_p, 0xFF00 + cpu_p->BC.lo));
+    return entry_p->cycles;
+}
+
+static int op_ld_c_a(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    write_memory(cpu_p->memory_p, 0xFF00 + cpu_p->BC.lo, cpu_p->AF.hi);
+    return entry_p->cycles;
+}
+
+static int op_ld_a_hld(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    load_8_bit(&cpu_p->AF.hi, read_memory(cpu_p->memory_p, get_registers_word(&cpu_p->HL)));
+    decrement(&cpu_p->HL);
+    return entry_p->cycles;
+}
+
+static int op_ld_hld_a(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    write_memory(cpu_p->memory_p, get_registers_word(&cpu_p->HL), cpu_p->AF.hi);
+    decrement(&cpu_p->HL);
+    return entry_p->cycles;
+}
+
+static int op_ld_a_hli(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    load_8_bit(&cpu_p->AF.hi, read_memory(cpu_p->memory_p, get_registers_word(&cpu_p->HL)));
+    increment(&cpu_p->HL);
+    return entry_p->cycles;
+}
+
+static int op_ld_hli_a(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    write_memory(cpu_p->memory_p, get_registers_word(&cpu_p->HL), cpu_p->AF.hi);
+    increment(&cpu_p->HL);
+    return entry_p->cycles;
+}
+
+static int op_ldh_immediate_a(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    write_memory(cpu_p->memory_p, 0xFF00 + operand, cpu_p->AF.hi);
+    return entry_p->cycles;
+}
+
+static int op_ldh_a_immediate(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    load_8_bit(&cpu_p->AF.hi, read_memory(cpu_p->memory_p, 0xFF00 + operand));
+    return entry_p->cycles;
+}
+
+// 16-bit loads
+
+static int op_ld_pair_immediate(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    set_registers_word(get_register_16_bit(cpu_p, entry_p->target), operand);
+    return entry_p->cycles;
+}
+
+static int op_ld_sp_hl(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    set_registers_word(&cpu_p->SP, get_registers_word(&cpu_p->HL));
+    return entry_p->cycles;
+}
+
+static int op_ld_hl_sp_immediate(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    load_hl(cpu_p, FLAGS_AF(cpu_p), &cpu_p->HL, operand);
+    return entry_p->cycles;
+}
+
+static int op_ld_address_sp(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    write_memory(cpu_p->memory_p, operand, cpu_p->SP.lo);
+    write_memory(cpu_p->memory_p, operand + 1, cpu_p->SP.hi);
+    return entry_p->cycles;
+}
+
+static int op_push(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    if (entry_p->source == PAIR_AF){
+        materialize_flags(cpu_p);
+    }
+    push_word_to_stack(cpu_p->memory_p, &cpu_p->SP, get_registers_word(get_register_16_bit(cpu_p, entry_p->source)));
+    return entry_p->cycles;
+}
+
+static int op_pop(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    // POP AF replaces F, drop any pending flags first
+    if (entry_p->target == PAIR_AF){
+        materialize_flags(cpu_p);
+    }
+    set_registers_word(get_register_16_bit(cpu_p, entry_p->target), pop_word_from_stack(cpu_p->memory_p, &cpu_p->SP));
+    return entry_p->cycles;
+}
+
+// 8-bit ALU, every operation exists for a register, (HL) and an immediate value
+#define ALU_OPCODE_HANDLERS(name, operation) \
+    static int op_##name##_r(cpu *cpu_p, const opcode_entry *entry_p, word operand){ \
+        operation(ALU_TARGET(cpu_p), *get_register_8_bit(cpu_p, entry_p->source)); \
+        return entry_p->cycles; \
+    } \
+    static int op_##name##_memory(cpu *cpu_p, const opcode_entry *entry_p, word operand){ \
+        operation(ALU_TARGET(cpu_p), read_memory(cpu_p->memory_p, get_registers_word(&cpu_p->HL))); \
+        return entry_p->cycles; \
+    } \
+    static int op_##name##_immediate(cpu *cpu_p, const opcode_entry *entry_p, word operand){ \
+        operation(ALU_TARGET(cpu_p), operand); \
+        return entry_p->cycles; \
+    }
+
+#ifdef LAZY_FLAGS
+ALU_OPCODE_HANDLERS(add, lazy_add_8_bit)
+ALU_OPCODE_HANDLERS(adc, lazy_add_carry_8_bit)
+ALU_OPCODE_HANDLERS(sub, lazy_sub_8_bit)
+ALU_OPCODE_HANDLERS(sbc, lazy_sub_carry_8_bit)
+ALU_OPCODE_HANDLERS(and, lazy_and_8_bit)
+ALU_OPCODE_HANDLERS(xor, lazy_xor_8_bit)
+ALU_OPCODE_HANDLERS(or, lazy_or_8_bit)
+ALU_OPCODE_HANDLERS(cp, lazy_cp_8_bit)
+#else
+ALU_OPCODE_HANDLERS(add, add_8_bit)
+ALU_OPCODE_HANDLERS(adc, add_carry_8_bit)
+ALU_OPCODE_HANDLERS(sub, sub_8_bit)
+ALU_OPCODE_HANDLERS(sbc, sub_carry_8_bit)
+ALU_OPCODE_HANDLERS(and, and_8_bit)
+ALU_OPCODE_HANDLERS(xor, xor_8_bit)
+ALU_OPCODE_HANDLERS(or, or_8_bit)
+ALU_OPCODE_HANDLERS(cp, cp_8_bit)
+#endif
+
+#undef ALU_OPCODE_HANDLERS
+
+static int op_inc_r(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+#ifdef LAZY_FLAGS
+    lazy_inc_8_bit(cpu_p, get_register_8_bit(cpu_p, entry_p->target));
+#else
+    inc_8_bit(get_register_8_bit(cpu_p, entry_p->target), &cpu_p->AF);
+#endif
+    return entry_p->cycles;
+}
+
+static int op_dec_r(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+#ifdef LAZY_FLAGS
+    lazy_dec_8_bit(cpu_p, get_register_8_bit(cpu_p, entry_p->target));
+#else
+    dec_8_bit(get_register_8_bit(cpu_p, entry_p->target), &cpu_p->AF);
+#endif
+    return entry_p->cycles;
+}
+
+static int op_inc_memory(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    inc_memory_8_bit(cpu_p, FLAGS_AF(cpu_p));
+    return entry_p->cycles;
+}
+
+static int op_dec_memory(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    dec_memory_8_bit(cpu_p, FLAGS_AF(cpu_p));
+    return entry_p->cycles;
+}
+
+// 16-bit ALU
+
+static int op_add_hl_pair(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    add_16_bit_hl(&cpu_p->HL, FLAGS_AF(cpu_p), get_registers_word(get_register_16_bit(cpu_p, entry_p->source)));
+    return entry_p->cycles;
+}
+
+static int op_add_sp_immediate(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    add_16_bit_sp(&cpu_p->SP, FLAGS_AF(cpu_p), (signed_byte) operand);
+    return entry_p->cycles;
+}
+
+static int op_inc_pair(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    inc_16_bit(get_register_16_bit(cpu_p, entry_p->target));
+    return entry_p->cycles;
+}
+
+static int op_dec_pair(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    dec_16_bit(get_register_16_bit(cpu_p, entry_p->target));
+    return entry_p->cycles;
+}
+
+// rotates on A
+
+static int op_rlca(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    rlc(&cpu_p->AF.hi, FLAGS_AF(cpu_p));
+    return entry_p->cycles;
+}
+
+static int op_rla(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    rl(&cpu_p->AF.hi, FLAGS_F(cpu_p));
+    return entry_p->cycles;
+}
+
+static int op_rrca(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    rrc(&cpu_p->AF.hi, FLAGS_AF(cpu_p));
+    return entry_p->cycles;
+}
+
+static int op_rra(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    rr(&cpu_p->AF.hi, FLAGS_F(cpu_p));
+    return entry_p->cycles;
+}
+
+// jumps, target holds the flag tested and source the value expected
+
+static int op_jp(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    jp(cpu_p, operand, &cpu_p->AF.lo, FALSE, FALSE, 0);
+    return entry_p->cycles;
+}
+
+static int op_jp_condition(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    jp(cpu_p, operand, FLAGS_F(cpu_p), TRUE, entry_p->source, entry_p->target);
+    return entry_p->cycles;
+}
+
+static int op_jp_hl(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    jp_hl(cpu_p);
+    return entry_p->cycles;
+}
+
+static int op_jr(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    jr(cpu_p, (signed_byte) operand, &cpu_p->AF.lo, FALSE, FALSE, 0);
+    return entry_p->cycles;
+}
+
+static int op_jr_condition(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    jr(cpu_p, (signed_byte) operand, FLAGS_F(cpu_p), TRUE, entry_p->source, entry_p->target);
+    return entry_p->cycles;
+}
+
+static int op_call(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    call(cpu_p, operand, &cpu_p->AF.lo, FALSE, FALSE, 0);
+    return entry_p->cycles;
+}
+
+static int op_call_condition(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    call(cpu_p, operand, FLAGS_F(cpu_p), TRUE, entry_p->source, entry_p->target);
+    return entry_p->cycles;
+}
+
+static int op_rst(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    rst(cpu_p, entry_p->source);
+    return entry_p->cycles;
+}
+
+static int op_ret(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    ret(cpu_p, &cpu_p->AF.lo, &cpu_p->SP, FALSE, FALSE, 0);
+    return entry_p->cycles;
+}
+
+static int op_ret_condition(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    ret(cpu_p, FLAGS_F(cpu_p), &cpu_p->SP, TRUE, entry_p->source, entry_p->target);
+    return entry_p->cycles;
+}
+
+static int op_reti(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    reti(cpu_p, &cpu_p->SP);
+    return entry_p->cycles;
+}
+
+// CB page, source holds the bit position for BIT, RES and SET
+
+static int op_rlc(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    rlc(get_register_8_bit(cpu_p, entry_p->target), FLAGS_AF(cpu_p));
+    return entry_p->cycles;
+}
+
+static int op_rlc_memory(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    rlc_memory(cpu_p->memory_p, get_registers_word(&cpu_p->HL), FLAGS_AF(cpu_p));
+    return entry_p->cycles;
+}
+
+static int op_rrc(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    rrc(get_register_8_bit(cpu_p, entry_p->target), FLAGS_AF(cpu_p));
+    return entry_p->cycles;
+}
+
+static int op_rrc_memory(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    rrc_memory(cpu_p->memory_p, get_registers_word(&cpu_p->HL), FLAGS_AF(cpu_p));
+    return entry_p->cycles;
+}
+
+static int op_rl(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    rl(get_register_8_bit(cpu_p, entry_p->target), FLAGS_F(cpu_p));
+    return entry_p->cycles;
+}
+
+static int op_rl_memory(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    rl_memory(cpu_p->memory_p, get_registers_word(&cpu_p->HL), FLAGS_F(cpu_p));
+    return entry_p->cycles;
+}
+
+static int op_rr(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    rr(get_register_8_bit(cpu_p, entry_p->target), FLAGS_F(cpu_p));
+    return entry_p->cycles;
+}
+
+static int op_rr_memory(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    rr_memory(cpu_p->memory_p, get_registers_word(&cpu_p->HL), FLAGS_F(cpu_p));
+    return entry_p->cycles;
+}
+
+static int op_sla(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    sla(get_register_8_bit(cpu_p, entry_p->target), FLAGS_F(cpu_p));
+    return entry_p->cycles;
+}
+
+static int op_sla_memory(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    sla_memory(cpu_p->memory_p, get_registers_word(&cpu_p->HL), FLAGS_F(cpu_p));
+    return entry_p->cycles;
+}
+
+static int op_sra(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    sra(get_register_8_bit(cpu_p, entry_p->target), FLAGS_F(cpu_p));
+    return entry_p->cycles;
+}
+
+static int op_sra_memory(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    sra_memory(cpu_p->memory_p, get_registers_word(&cpu_p->HL), FLAGS_F(cpu_p));
+    return entry_p->cycles;
+}
+
+static int op_swap(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    swap_nibble(get_register_8_bit(cpu_p, entry_p->target), FLAGS_F(cpu_p));
+    return entry_p->cycles;
+}
+
+static int op_swap_memory(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    swap_nibble_memory(cpu_p->memory_p, FLAGS_F(cpu_p), get_registers_word(&cpu_p->HL));
+    return entry_p->cycles;
+}
+
+static int op_srl(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    srl(get_register_8_bit(cpu_p, entry_p->target), FLAGS_F(cpu_p));
+    return entry_p->cycles;
+}
+
+static int op_srl_memory(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    srl_memory(cpu_p->memory_p, get_registers_word(&cpu_p->HL), FLAGS_F(cpu_p));
+    return entry_p->cycles;
+}
+
+static int op_bit(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    bit(entry_p->source, get_register_8_bit(cpu_p, entry_p->target), FLAGS_F(cpu_p));
+    return entry_p->cycles;
+}
+
+static int op_bit_memory(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    bit_memory(entry_p->source, cpu_p->memory_p, get_registers_word(&cpu_p->HL), FLAGS_F(cpu_p));
+    return entry_p->cycles;
+}
+
+static int op_res(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    res(entry_p->source, get_register_8_bit(cpu_p, entry_p->target));
+    return entry_p->cycles;
+}
+
+static int op_res_memory(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    res_memory(entry_p->source, cpu_p->memory_p, get_registers_word(&cpu_p->HL));
+    return entry_p->cycles;
+}
+
+static int op_set(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    set(entry_p->source, get_register_8_bit(cpu_p, entry_p->target));
+    return entry_p->cycles;
+}
+
+static int op_set_memory(cpu *cpu_p, const opcode_entry *entry_p, word operand){
+    set_memory(entry_p->source, cpu_p->memory_p, get_registers_word(&cpu_p->HL));
+    return entry_p->cycles;
 }
 
 static byte get_immediate_8_bit(cpu *cpu_p){
@@ -777,7 +1468,7 @@ static byte get_immediate_8_bit(cpu *cpu_p){
 }
 
 static void load_8_bit(byte *register_p, byte data){
-    printf("LOAD 0x%02X\n", data);
+    TRACE_LOG(TRACE_LEVEL_DEBUG, TRACE_CPU, TRACE_LOAD, data, 0);
     *register_p = data;
 }
 
@@ -789,12 +1480,6 @@ static word get_immediate_16_bit(cpu *cpu_p){
     return address;
 }
 
-static void load_immediate_16_bit(cpu *cpu_p, cpu_register *register_p){
-    word address = get_immediate_16_bit(cpu_p);
-    printf("LD IMMEDIATE 0x%04X\n", address);
-    set_registers_word(register_p, address);
-}
-
 word get_registers_word(cpu_register *register_p){
     return ((register_p->hi << 8) | (register_p->lo));
 }
@@ -804,10 +1489,9 @@ static void set_registers_word(cpu_register *register_p, word data){
     register_p->lo = (data & 0x00FF);
 }
 
-static void load_hl(cpu *cpu_p, cpu_register *AF_p, cpu_register *HL_p){
+static void load_hl(cpu *cpu_p, cpu_register *AF_p, cpu_register *HL_p, byte n){
     
     unsigned int overflow;
-    byte n = get_immediate_8_bit(cpu_p);
 
     AF_p->lo = CLEAR_BIT(AF_p->lo, ZERO_FLAG);
     AF_p->lo = CLEAR_BIT(AF_p->lo, SUBTRACT_FLAG);
@@ -831,6 +1515,8 @@ static void load_hl(cpu *cpu_p, cpu_register *AF_p, cpu_register *HL_p){
     }
 } 
 
+// eager flags, LAZY_FLAGS replaces these with the lazy_ helpers below
+#ifndef LAZY_FLAGS
 
 static void add_carry_8_bit(cpu_register *AF_p, byte data){
     byte result = AF_p->hi;
@@ -852,7 +1538,7 @@ static void add_carry_8_bit(cpu_register *AF_p, byte data){
     }
 
     word overflow = AF_p->hi & 0xF;
-    overflow += ((data + carry) & 0xF);
+    overflow += (data & 0xF) + carry;
     
     if (overflow > 0xF){
         AF_p->lo = SET_BIT(AF_p->lo, HALF_CARRY_FLAG);
@@ -907,13 +1593,12 @@ static void sub_8_bit(cpu_register *AF_p, byte data){
         AF_p->lo = SET_BIT(AF_p->lo, ZERO_FLAG);
     }
 
-    if (AF_p->lo < data){
+    if (AF_p->hi < data){
         AF_p->lo = SET_BIT(AF_p->lo, CARRY_FLAG);
     }
 
-    // should this be signed ? 
-    word borrow = AF_p->hi & 0xF;
-    borrow -= (result & 0xF);
+    signed_word borrow = AF_p->hi & 0xF;
+    borrow -= (data & 0xF);
 
     if (borrow < 0){
         AF_p->lo = SET_BIT(AF_p->lo, HALF_CARRY_FLAG);
@@ -927,13 +1612,12 @@ static void sub_carry_8_bit(cpu_register *AF_p, byte data){
     byte result = AF_p->hi;
     byte carry = 0;
     
-    // add carry
+    // subtract carry
     if(TEST_BIT(AF_p->lo, CARRY_FLAG)){
         carry = 1;
     }
 
-    result += carry;
-    result -= data;
+    result -= (data + carry);
 
     AF_p->lo = 0;
     AF_p->lo = SET_BIT(AF_p->lo, SUBTRACT_FLAG);
@@ -941,14 +1625,12 @@ static void sub_carry_8_bit(cpu_register *AF_p, byte data){
         AF_p->lo = SET_BIT(AF_p->lo, ZERO_FLAG);
     }
 
-    if ((AF_p->lo + carry) < data){
+    if (AF_p->hi < (data + carry)){
         AF_p->lo = SET_BIT(AF_p->lo, CARRY_FLAG);
     }
 
-    // should this be signed ? 
-    word borrow = AF_p->hi & 0xF;
-    borrow += carry;
-    borrow -= (result & 0xF);
+    signed_word borrow = AF_p->hi & 0xF;
+    borrow -= (data & 0xF) + carry;
 
     if (borrow < 0){
         AF_p->lo = SET_BIT(AF_p->lo, HALF_CARRY_FLAG);
@@ -1026,6 +1708,156 @@ static void cp_8_bit(cpu_register *AF_p, byte data){
     }
 }
 
+#endif
+
+#ifdef LAZY_FLAGS
+
+/*
+    lazy flags : the 8-bit ALU only records its operands, materialize_flags rebuilds AF.lo
+    from them with the same rules as the helpers above once something reads F
+*/
+void materialize_flags(cpu *cpu_p){
+
+    byte operand = cpu_p->flags_operand;
+    byte data = cpu_p->flags_data;
+    byte carry = cpu_p->flags_carry;
+    byte flags = 0;
+
+    switch(cpu_p->flags_operation){
+        case FLAGS_NONE : return;
+        case FLAGS_ADD : {
+            word result = operand + data + carry;
+            if ((result & 0xFF) == 0) flags = SET_BIT(flags, ZERO_FLAG);
+            if ((operand & 0xF) + (data & 0xF) + carry > 0xF) flags = SET_BIT(flags, HALF_CARRY_FLAG);
+            if (result > 0xFF) flags = SET_BIT(flags, CARRY_FLAG);
+            break;
+        }
+        case FLAGS_SUB : {
+            signed_word result = operand - data - carry;
+            flags = SET_BIT(flags, SUBTRACT_FLAG);
+            if ((result & 0xFF) == 0) flags = SET_BIT(flags, ZERO_FLAG);
+            if ((operand & 0xF) - (data & 0xF) - carry < 0) flags = SET_BIT(flags, HALF_CARRY_FLAG);
+            if (result < 0) flags = SET_BIT(flags, CARRY_FLAG);
+            break;
+        }
+        // AND / OR / XOR keep the result in flags_operand
+        case FLAGS_AND :
+            flags = SET_BIT(flags, HALF_CARRY_FLAG);
+            // fall through
+        case FLAGS_LOGIC :
+            if (operand == 0) flags = SET_BIT(flags, ZERO_FLAG);
+            break;
+        // INC / DEC keep the bits they don't touch in flags_carry
+        case FLAGS_INC :
+            flags = carry;
+            if (((operand + 1) & 0xFF) == 0) flags = SET_BIT(flags, ZERO_FLAG);
+            if ((operand & 0xF) == 0xF) flags = SET_BIT(flags, HALF_CARRY_FLAG);
+            break;
+        case FLAGS_DEC :
+            flags = SET_BIT(carry, SUBTRACT_FLAG);
+            if (((operand - 1) & 0xFF) == 0) flags = SET_BIT(flags, ZERO_FLAG);
+            if ((operand & 0xF) == 0) flags = SET_BIT(flags, HALF_CARRY_FLAG);
+            break;
+    }
+
+    cpu_p->AF.lo = flags;
+    cpu_p->flags_operation = FLAGS_NONE;
+}
+
+static inline void set_lazy_flags(cpu *cpu_p, byte operation, byte operand, byte data, byte carry){
+    cpu_p->flags_operation = operation;
+    cpu_p->flags_operand = operand;
+    cpu_p->flags_data = data;
+    cpu_p->flags_carry = carry;
+}
+
+/*
+    C and the low nibble of F as they would be after materialize_flags, without computing Z and H
+    INC / DEC keep these bits and ADC / SBC only need the carry
+*/
+static inline byte get_kept_flags(cpu *cpu_p){
+
+    byte operand = cpu_p->flags_operand;
+    byte data = cpu_p->flags_data;
+    byte carry = cpu_p->flags_carry;
+
+    switch(cpu_p->flags_operation){
+        case FLAGS_ADD : return (operand + data + carry > 0xFF) ? 0x10 : 0;
+        case FLAGS_SUB : return (operand < data + carry) ? 0x10 : 0;
+        case FLAGS_AND : return 0;
+        case FLAGS_LOGIC : return 0;
+        case FLAGS_INC : return carry;
+        case FLAGS_DEC : return carry;
+    }
+    return cpu_p->AF.lo & 0x1F;
+}
+
+static inline byte get_carry(cpu *cpu_p){
+    return TEST_BIT(get_kept_flags(cpu_p), CARRY_FLAG) ? 1 : 0;
+}
+
+static void lazy_add_8_bit(cpu *cpu_p, byte data){
+    set_lazy_flags(cpu_p, FLAGS_ADD, cpu_p->AF.hi, data, 0);
+    cpu_p->AF.hi += data;
+}
+
+static void lazy_add_carry_8_bit(cpu *cpu_p, byte data){
+    byte carry = get_carry(cpu_p);
+    set_lazy_flags(cpu_p, FLAGS_ADD, cpu_p->AF.hi, data, carry);
+    cpu_p->AF.hi += data + carry;
+}
+
+static void lazy_sub_8_bit(cpu *cpu_p, byte data){
+    set_lazy_flags(cpu_p, FLAGS_SUB, cpu_p->AF.hi, data, 0);
+    cpu_p->AF.hi -= data;
+}
+
+static void lazy_sub_carry_8_bit(cpu *cpu_p, byte data){
+    byte carry = get_carry(cpu_p);
+    set_lazy_flags(cpu_p, FLAGS_SUB, cpu_p->AF.hi, data, carry);
+    cpu_p->AF.hi -= data + carry;
+}
+
+static void lazy_and_8_bit(cpu *cpu_p, byte data){
+    cpu_p->AF.hi &= data;
+    set_lazy_flags(cpu_p, FLAGS_AND, cpu_p->AF.hi, 0, 0);
+}
+
+static void lazy_or_8_bit(cpu *cpu_p, byte data){
+    cpu_p->AF.hi |= data;
+    set_lazy_flags(cpu_p, FLAGS_LOGIC, cpu_p->AF.hi, 0, 0);
+}
+
+static void lazy_xor_8_bit(cpu *cpu_p, byte data){
+    cpu_p->AF.hi ^= data;
+    set_lazy_flags(cpu_p, FLAGS_LOGIC, cpu_p->AF.hi, 0, 0);
+}
+
+static void lazy_cp_8_bit(cpu *cpu_p, byte data){
+    set_lazy_flags(cpu_p, FLAGS_SUB, cpu_p->AF.hi, data, 0);
+}
+
+static void lazy_inc_8_bit(cpu *cpu_p, byte *register_p){
+    byte kept = get_kept_flags(cpu_p);
+    set_lazy_flags(cpu_p, FLAGS_INC, *register_p, 0, kept);
+    *register_p += 1;
+}
+
+static void lazy_dec_8_bit(cpu *cpu_p, byte *register_p){
+    byte kept = get_kept_flags(cpu_p);
+    set_lazy_flags(cpu_p, FLAGS_DEC, *register_p, 0, kept);
+    *register_p -= 1;
+}
+
+#else
+
+// flags are always up to date without LAZY_FLAGS
+void materialize_flags(cpu *cpu_p){
+}
+
+#endif
+
+#ifndef LAZY_FLAGS
 static void inc_8_bit(byte *register_p, cpu_register *AF_p){
     
     byte result = *register_p;
@@ -1048,6 +1880,7 @@ static void inc_8_bit(byte *register_p, cpu_register *AF_p){
     *register_p = result;
     
 }
+#endif
 
 static void inc_memory_8_bit(cpu *cpu_p, cpu_register *AF_p){
 
@@ -1094,14 +1927,13 @@ static void dec_memory_8_bit(cpu *cpu_p, cpu_register *AF_p){
     } else {
         AF_p->lo = CLEAR_BIT(AF_p->lo, HALF_CARRY_FLAG);
     }
-
-    *register_p = result;
 }
 
+#ifndef LAZY_FLAGS
 static void dec_8_bit(byte *register_p, cpu_register *AF_p){
-    printf("DEC\n");
     byte result = *register_p;
     result--;
+    TRACE_LOG(TRACE_LEVEL_DEBUG, TRACE_CPU, TRACE_DEC, result, 0);
 
     if (result == 0){
         AF_p->lo = SET_BIT(AF_p->lo, ZERO_FLAG);
@@ -1119,6 +1951,7 @@ static void dec_8_bit(byte *register_p, cpu_register *AF_p){
 
     *register_p = result;
 }
+#endif
 
 static void increment(cpu_register *register_p){
     word value = get_registers_word(register_p);
@@ -1169,9 +2002,8 @@ static void add_16_bit_hl(cpu_register *HL_p, cpu_register *AF_p, word data){
     set_registers_word(HL_p, result);
 
 }
-static void add_16_bit_sp(cpu *cpu_p, cpu_register *SP_p, cpu_register *AF_p){
+static void add_16_bit_sp(cpu_register *SP_p, cpu_register *AF_p, signed_byte data){
     
-    signed_byte data = get_immediate_8_bit(cpu_p);
     word result = get_registers_word(SP_p) + data;
 
     // flag configurations
@@ -1195,6 +2027,7 @@ static void add_16_bit_sp(cpu *cpu_p, cpu_register *SP_p, cpu_register *AF_p){
         AF_p->lo = CLEAR_BIT(AF_p->lo, HALF_CARRY_FLAG);
     }
 
+    set_registers_word(SP_p, result);
 }
 
 static void swap_nibble(byte *register_p, byte *F_p){
@@ -1698,10 +2531,9 @@ static void res_memory(byte position, memory_map *memory_p, word address){
     write_memory(memory_p, address, result);
 }
 
-static void jp(cpu *cpu_p, byte *F_p, byte has_condition, byte condition, byte flag){
-    word address = get_immediate_16_bit(cpu_p);
+static void jp(cpu *cpu_p, word address, byte *F_p, byte has_condition, byte condition, byte flag){
 
-    printf("JP : 0x%04X\n", address);
+    TRACE_LOG(TRACE_LEVEL_DEBUG, TRACE_JUMP, TRACE_JP, address, has_condition);
 
     if (!has_condition){
         cpu_p->PC = address;
@@ -1718,24 +2550,22 @@ static void jp_hl(cpu *cpu_p){
     cpu_p->PC = get_registers_word(&cpu_p->HL);
 }
 
-static void jr(cpu *cpu_p, byte *F_p, byte has_condition, byte condition, byte flag){
-    signed_byte value = (signed_byte) get_immediate_8_bit(cpu_p);
+static void jr(cpu *cpu_p, signed_byte value, byte *F_p, byte has_condition, byte condition, byte flag){
     
     if (!has_condition){
         cpu_p->PC += value;
-        printf("JR IMMEDIATE new PC: 0x%04X\n", cpu_p->PC);
+        TRACE_LOG(TRACE_LEVEL_DEBUG, TRACE_JUMP, TRACE_JR, cpu_p->PC, FALSE);
         return;
     }
 
     bool flag_result = TEST_BIT(*F_p, flag) ? TRUE : FALSE;
     if (flag_result == condition){
         cpu_p->PC += value;
-        printf("JR CONDITION new PC: 0x%04X\n", cpu_p->PC);
+        TRACE_LOG(TRACE_LEVEL_DEBUG, TRACE_JUMP, TRACE_JR, cpu_p->PC, TRUE);
     }
 }
 
-static void call(cpu *cpu_p, byte* F_p, byte has_condition, byte condition, byte flag){
-    word address = get_immediate_16_bit(cpu_p);
+static void call(cpu *cpu_p, word address, byte* F_p, byte has_condition, byte condition, byte flag){
 
     if (!has_condition){
         push_word_to_stack(cpu_p->memory_p, &cpu_p->SP, cpu_p->PC);
@@ -1743,7 +2573,8 @@ static void call(cpu *cpu_p, byte* F_p, byte has_condition, byte condition, byte
         return;
     }
 
-    if (TEST_BIT(*F_p, flag) == condition){
+    bool flag_result = TEST_BIT(*F_p, flag) ? TRUE : FALSE;
+    if (flag_result == condition){
         push_word_to_stack(cpu_p->memory_p, &cpu_p->SP, cpu_p->PC);
         cpu_p->PC = address;
     }
@@ -1769,7 +2600,7 @@ word pop_word_from_stack(memory_map *memory_p, cpu_register *SP_p){
 
     set_registers_word(SP_p, sp_address + 2);
     word result = (hi_byte << 8) | lo_byte;
-    printf("POPPED 0x%04X\n", result);
+    TRACE_LOG(TRACE_LEVEL_DEBUG, TRACE_STACK, TRACE_POP, result, 0);
     return result;
 }
 
@@ -1785,7 +2616,8 @@ static void ret(cpu *cpu_p, byte *F_p, cpu_register *SP_p, byte has_condition, b
         return;
     }
 
-    if (TEST_BIT(*F_p, flag) == condition){
+    bool flag_result = TEST_BIT(*F_p, flag) ? TRUE : FALSE;
+    if (flag_result == condition){
         cpu_p->PC = pop_word_from_stack(cpu_p->memory_p, SP_p);
     }
 }
@@ -1843,6 +2675,7 @@ void initialize_game_state(cpu *cpu_p, memory_map *memory_p){
     memory_p->memory[BACKGROUND_PALETTE] = 0xFC; 
     memory_p->memory[SPRITE_PALETTE_1] = 0xFF; 
     memory_p->memory[SPRITE_PALETTE_2] = 0xFF; 
+    refresh_palettes(&memory_p->palettes, &memory_p->memory[BACKGROUND_PALETTE]);
     memory_p->memory[WINDOW_Y_INDEX] = 0x00; 
     memory_p->memory[WINDOW_X_INDEX] = 0x00; 
     memory_p->memory[INTERRUPT_ENABLE_INDEX] = 0x00; 
@@ -8,6 +8,12 @@
 #define CPU_MAX_CYCLES 4194304
 #define CPU_MAX_CYCLES_PER_SECOND CPU_MAX_CYCLES / CPU_FREQUENCY
 
+// opcode_entry flags
+#define ENDS_BLOCK 0x01
+
+typedef struct block_cache block_cache;
+typedef struct jit_compiler jit_compiler;
+
 typedef union cpu_register {
     struct {
         byte lo;
@@ -27,12 +33,47 @@ typedef struct cpu {
     byte pending_interrupt_enable;
     byte interrupt_enable;
     byte interrupt_request;
+    block_cache *block_cache_p;
+    jit_compiler *jit_p; // NULL runs cached blocks through the interpreter
+#ifdef LAZY_FLAGS
+    // last 8-bit ALU operation, AF.lo is only computed from it when an instruction reads the flags
+    byte flags_operation;
+    byte flags_operand;
+    byte flags_data;
+    byte flags_carry;
+#endif
 
 } cpu;
 
+/*
+    each opcode is described once in opcodes.def and expanded into a 256 entry table
+    for the main page and another one for the CB page.
+        - length : size of the instruction in bytes, the operand is fetched before the handler runs
+        - target / source : register selectors or condition flag decoded from the opcode
+        - cycles : cycles used by the instruction
+        - flags : ENDS_BLOCK for jumps, calls, returns, HALT, STOP, DI and EI
+*/
+typedef struct opcode_entry opcode_entry;
+typedef int (*opcode_handler)(cpu *cpu_p, const opcode_entry *entry_p, word operand);
+
+struct opcode_entry {
+    opcode_handler handler;
+    byte length;
+    byte target;
+    byte source;
+    byte cycles;
+    byte flags;
+    const char *mnemonic;
+};
+
 cpu *initialize_cpu(memory_map *memory_p);
 int execute_opcode(cpu *cpu_p, byte opcode);
 int execute_next_opcode(cpu *cpu_p);
+int execute_next_block(cpu *cpu_p);
+void materialize_flags(cpu *cpu_p);
+int run_opcodes(cpu *cpu_p, int cycles);
+const opcode_entry *get_opcode_entry(byte opcode);
+const opcode_entry *get_extended_opcode_entry(byte opcode);
 void initialize_game_state(cpu *cpu_p, memory_map *memory_p);
 word get_registers_word(cpu_register *register_p);
 void push_word_to_stack(memory_map *memory_p, cpu_register *SP_p, word address);
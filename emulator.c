@@ -1,853 +1,433 @@
+/*
+    matchaGB frontend
+
+        gcc -O2 emulator.c backend.c block_cache.c cartridge.c cpu.c framebuffer.c gameboy.c jit.c mbc.c memory.c palette.c plane_cache.c render_thread.c renderer.c rom_registry.c save.c scheduler.c sprite_cache.c tile_cache.c trace.c $(sdl2-config --cflags --libs) -lm -lpthread -o matchagb
+        gcc -O2 -DHEADLESS emulator.c backend.c ... -lm -lpthread -o matchagb    (no SDL, headless backend only)
+
+    usage : matchagb [options] rom.gb
+        --headless          no window, frames stay in an indexed framebuffer
+        --frames N          stop after N frames, 0 runs until the window is closed (headless default 3600)
+        --boot FILE         run the boot ROM before the game
+        --format FORMAT     framebuffer format : indexed, rgb or rgba, the backend picks by default (the SDL window only shows rgba)
+        --dump FILE         write the last frame as a PPM / PGM
+        --hash              print the FNV-1a hash of the last frame
+
+    the emulation runs unthrottled and prints the frames per second at exit
+    MATCHAGB_JIT, MATCHAGB_TIMED_DMA, MATCHAGB_PALETTE and MATCHAGB_TRACE are still read from the environment,
+    MATCHAGB_LINE_RENDERING draws every line when it's due instead of batching unchanged frames at V-BLANK
+    and MATCHAGB_RENDER_THREAD draws the lines on a second thread
+*/
+#include <getopt.h>
+#include <time.h>
+#ifndef HEADLESS
 #include <SDL2/SDL.h>
-#include <SDL2/SDL_opengl.h>
+#endif
 #include "environment.h"
-#include "cartridge.h"
-#include "memory.h"
-#include "cpu.h"
-#include <GLUT/glut.h>
-
-#define SCREEN_WIDTH 160
-#define SCREEN_HEIGHT 144
-
-void emulate(cpu *cpu_p);
-
-// set by EI and ACK the interrupt setting by the IE register
-byte interrupt_master_enable;
-
-// Interrupts
-void run_interrupts(cpu *cpu_p);
-void request_interrupt(cpu *cpu_p, int id);
-void service_interrupt(cpu *cpu_p, int interrupt_id);
-
-// Timers
-int timer_counter;
-int divider_register;
-void update_timers(cpu *cpu_p, int cycles);
-byte get_clock_frequency(memory_map *memory_p);
-void set_clock_frequency(memory_map *memory_p);
-byte clock_enabled(memory_map *memory_p);
-void update_timers(cpu *cpu_p, int cycles);
-void update_divider_register(memory_map *memory_p, int cycles);
-
-// Graphics
-int scanline_counter = 456;
-byte screen_data[SCREEN_HEIGHT][SCREEN_WIDTH][3];
-void set_lcd_status(cpu *cpu_p);
-bool lcd_enabled(memory_map *memory_p);
-void update_graphics(cpu *cpu_p, int cycles);
-void render_sprites(memory_map *memory_p, byte lcdc);
-void render_tiles(memory_map *memory_p, byte lcdc);
-int bit_get_value(byte data, int position);
-byte get_color(memory_map *memory_p, byte column_number, word address);
-void draw_scanline(memory_map *memory_p);
-void draw_scanline(memory_map *memory_p);
-void initialize_screen_data();
-void render_screen();
-
-// open GL
-SDL_Window* sdl_window = NULL;
-SDL_GLContext gl_context = NULL;
-void setup_gl_context();
-void initialize_gl_context();
-void initialize_sdl_window();
+#include "gameboy.h"
+#include "rom_registry.h"
+#include "block_cache.h"
+#include "jit.h"
+#include "trace.h"
+#include "save.h"
+#include "backend.h"
+#include "render_thread.h"
+
+#define HEADLESS_FRAMES 3600 // one emulated minute
+#define GAMEBOY_FPS 59.73
+
+typedef struct options{
+    char *rom_file;
+    char *boot_file;
+    char *dump_file;
+    unsigned long frames;
+    int format; // -1 when the backend picks it
+    bool headless;
+    bool hash;
+} options;
+
+void parse_options(options *options_p, int argc, char *argv[]);
+void print_usage(char *program);
+char *get_save_file_name(char *rom_file);
+double get_time(void);
+
+#ifndef HEADLESS
+// SDL, frames are uploaded to a streaming texture
+typedef struct sdl_backend{
+    SDL_Window *window;
+    SDL_Renderer *renderer;
+    SDL_Texture *texture;
+} sdl_backend;
+
+backend *initialize_sdl_backend(void);
+bool sdl_open(backend *backend_p);
+bool sdl_poll_events(backend *backend_p, gb_context *gb_p);
+void sdl_present(backend *backend_p, gb_context *gb_p);
+void sdl_close(backend *backend_p);
+#endif
 
 // Debugging
 void print_cpu_content(cpu *cpu_p);
-void print_screen_data();
-void step_graphics(cpu *cpu_p, int iterations);
-void step(cpu *cpu_p, int iterations);
-void test_bootstrap_rom(cpu *cpu);
-
-int main(void){
-    cartridge *cartridge_p = NULL;
-    memory_map *memory_p = NULL;
-    cpu *cpu_p = NULL;
-    bool bootstrapped = TRUE;
-    
-    if(bootstrapped){
-        cartridge_p = initialize_cartridge("DMG_ROM.bin");
-        set_nintendo_logo_data(cartridge_p);
-    } else {
-        cartridge_p = initialize_cartridge("Tetris.gb");
+void print_screen_data(gb_context *gb_p);
+void step_graphics(gb_context *gb_p, backend *backend_p, int iterations);
+void step(gb_context *gb_p, int iterations);
+void test_bootstrap_rom(gb_context *gb_p);
+
+int main(int argc, char *argv[]){
+    options options;
+    cartridge *boot_cartridge_p = NULL;
+    backend *backend_p = NULL;
+
+    parse_options(&options, argc, argv);
+
+    cartridge *cartridge_p = acquire_cartridge(options.rom_file);
+    gb_context *gb_p = initialize_gb_context(cartridge_p);
+
+    // battery backed RAM is kept next to the ROM
+    if (cartridge_p->battery){
+        char *save_file = get_save_file_name(options.rom_file);
+        attach_battery_save(gb_p->memory_p, save_file);
+        free(save_file);
     }
+    gb_p->cpu_p->block_cache_p = initialize_block_cache();
 
-    memory_p = initialize_memory(cartridge_p);
-    cpu_p = initialize_cpu(memory_p);
-
-    if (!bootstrapped){
-        initialize_game_state(cpu_p, memory_p);
+    // hot ROM blocks are recompiled to x86-64 when MATCHAGB_JIT is set, the interpreter runs them otherwise
+    if (getenv("MATCHAGB_JIT") != NULL){
+        gb_p->cpu_p->jit_p = initialize_jit_compiler();
     }
 
-    // initialize timer_counter
-    set_clock_frequency(memory_p);
+    // OAM DMA is copied at once unless MATCHAGB_TIMED_DMA asks for the cycle accurate transfer
+    if (getenv("MATCHAGB_TIMED_DMA") != NULL){
+        gb_p->memory_p->dma_mode = DMA_TIMED;
+    }
 
-    initialize_sdl_window();
-    initialize_gl_context();
+    // MATCHAGB_PALETTE picks the displayed colors : 0 gray, 1 DMG green, 2 pocket
+    if (getenv("MATCHAGB_PALETTE") != NULL){
+        set_color_scheme(&gb_p->memory_p->palettes, strtol(getenv("MATCHAGB_PALETTE"), NULL, 0));
+    }
 
-    test_bootstrap_rom(cpu_p);
-    
-    SDL_Event event;
-    bool exit_sdl = FALSE;
-    int iteration = 0;
+    // MATCHAGB_LINE_RENDERING draws every line when it's due instead of deferring unchanged frames to V-BLANK
+    if (getenv("MATCHAGB_LINE_RENDERING") != NULL){
+        gb_p->frame_batching = FALSE;
+    }
 
-    while (exit_sdl == FALSE) {
-        while (SDL_PollEvent(&event)) {
+#ifdef TRACE
+    // MATCHAGB_TRACE selects the traced categories, everything is traced by default
+    if (getenv("MATCHAGB_TRACE") != NULL){
+        trace_configure(TRACE_LEVEL_DEBUG, strtol(getenv("MATCHAGB_TRACE"), NULL, 0));
+    }
+#endif
 
-            if (event.type == SDL_QUIT){
-                exit_sdl = TRUE;
-                continue;
-            }
+    // the boot ROM sets the registers up itself, otherwise start in the state it leaves
+    if (options.boot_file != NULL){
+        boot_cartridge_p = initialize_cartridge(options.boot_file);
+        map_boot_rom(gb_p->memory_p, boot_cartridge_p->cartridge_memory);
+    } else {
+        initialize_game_state(gb_p->cpu_p, gb_p->memory_p);
+    }
 
-            if (event.type == SDL_KEYDOWN) {
+#ifndef HEADLESS
+    backend_p = options.headless ? initialize_headless_backend() : initialize_sdl_backend();
+#else
+    backend_p = initialize_headless_backend();
+#endif
+    if (options.format >= 0 && options.format != backend_p->framebuffer_format && !backend_p->any_format){
+        printf("ERROR : The %s backend can't present the requested framebuffer format\n", backend_p->name);
+        exit(1);
+    }
+    if (!backend_p->open(backend_p)){
+        printf("ERROR : Couldn't open the %s backend\n", backend_p->name);
+        exit(1);
+    }
+    set_framebuffer_format(&gb_p->framebuffer, (options.format < 0) ? backend_p->framebuffer_format : options.format);
+    gb_p->frames_p = initialize_frame_exchange(&gb_p->framebuffer);
 
-                // emulating 1 frame
-                // step_graphics(cpu_p, 153);
-                // render_screen();
+    // MATCHAGB_RENDER_THREAD draws the lines on a second thread from snapshots pushed by the PPU
+    if (getenv("MATCHAGB_RENDER_THREAD") != NULL){
+        gb_p->render_thread_p = initialize_render_thread(gb_p);
+    }
 
-                // int cycles = execute_next_opcode(cpu_p);
-                // //cycles_used += cycles;
-                // update_timers(cpu_p, cycles);
-                // //run_interrupts(cpu_p);
-                // //update_graphics(cpu_p, cycles);
-                // print_cpu_content(cpu_p);
-            }
+    unsigned long frames = 0;
+    double start = get_time();
+    while ((options.frames == 0 || frames < options.frames) && backend_p->poll_events(backend_p, gb_p)){
+        emulate_frame(gb_p);
+        backend_p->present(backend_p, gb_p);
+        frames++;
+    }
+    double elapsed = get_time() - start;
+    printf("%lu frames in %.2f s : %.1f fps (%.1fx)\n", frames, elapsed, frames / elapsed, (frames / elapsed) / GAMEBOY_FPS);
+    if (frames > 0){
+        // cells of the 2 tile maps drawn again per frame, the rest of the background came from the planes
+        double cells = (double) gb_p->memory_p->plane_cache.drawn_cells / frames;
+        printf("background cells drawn : %.1f per frame (%.1f%% of the planes)\n", cells, (cells * 100) / (PLANE_COUNT * PLANE_CELLS));
+        // slow frames had a raster effect, their lines were drawn one by one from the first write
+        raster_log *log_p = &gb_p->memory_p->raster_log;
+        printf("frames rendered in one pass : %lu, line by line : %lu\n", log_p->fast_frames, log_p->slow_frames);
+        frame_exchange *exchange_p = gb_p->frames_p;
+        printf("frames published : %lu, dropped : %lu, presented again : %lu\n", exchange_p->published_frames, exchange_p->dropped_frames, exchange_p->repeated_frames);
+        if (gb_p->render_thread_p != NULL){
+            printf("render thread : %lu VRAM / OAM copies, the emulation thread waited %lu times\n", gb_p->render_thread_p->made_copies, gb_p->render_thread_p->full_waits);
         }
-        emulate(cpu_p);
     }
-    //printf("NEW iterations %d\n", iteration);
 
-    free(cartridge_p);
-    cartridge_p = NULL;
+    // the last finished frame, the back buffer may be half drawn
+    framebuffer *frame_p = take_frame(gb_p->frames_p);
+    if (options.hash){
+        printf("frame hash : %016llx\n", (unsigned long long) hash_framebuffer(frame_p));
+    }
+    if (options.dump_file != NULL){
+        dump_framebuffer(frame_p, options.dump_file);
+    }
 
-    free(memory_p);
-    memory_p = NULL;
-    
-    free(cpu_p);
-    cpu_p = NULL;
+#ifdef TRACE
+    trace_dump(stdout);
+#endif
 
+    free_backend(backend_p);
+    free_gb_context(gb_p);
+    if (boot_cartridge_p != NULL){
+        free_cartridge(boot_cartridge_p);
+    }
     return 0;
 }
 
-/* bootstrap testing in steps
-    In progress :
-        - Checksum
-*/ 
-void test_bootstrap_rom(cpu *cpu_p){
-
-    step(cpu_p, 1); // load SP to 0xFFFE
-    step(cpu_p, 24579); // initialize VRAM to 0
-    step(cpu_p, 10); // initialize audio
-    step(cpu_p, 2); // initialize color palette with 0xFC
-    step(cpu_p, 4084); // write Nintendo logo into tile data
-    step(cpu_p, 132); // write Nintendo logo into tile map
-    step(cpu_p, 6); // enable LCD
-}
-
-void step_graphics(cpu *cpu_p, int iterations){
-    int cycles_used = 0;
-    int cycles = 456;
-
-    for (int i = 0; i < iterations; i++){
-        cycles_used += cycles;
-        update_graphics(cpu_p, cycles);
-        if (cycles_used >= CPU_MAX_CYCLES_PER_SECOND){
-            cycles_used = 0;
-            render_screen();
+void parse_options(options *options_p, int argc, char *argv[]){
+
+    static struct option long_options[] = {
+        { "headless", no_argument, NULL, 'H' },
+        { "frames", required_argument, NULL, 'n' },
+        { "boot", required_argument, NULL, 'b' },
+        { "format", required_argument, NULL, 'f' },
+        { "dump", required_argument, NULL, 'd' },
+        { "hash", no_argument, NULL, 'x' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    memset(options_p, 0, sizeof(options));
+    options_p->format = -1;
+#ifdef HEADLESS
+    options_p->headless = TRUE;
+#endif
+
+    int option;
+    while ((option = getopt_long(argc, argv, "Hn:b:f:d:xh", long_options, NULL)) != -1){
+        switch(option){
+            case 'H': options_p->headless = TRUE; break;
+            case 'n': options_p->frames = strtoul(optarg, NULL, 0); break;
+            case 'b': options_p->boot_file = optarg; break;
+            case 'd': options_p->dump_file = optarg; break;
+            case 'x': options_p->hash = TRUE; break;
+            case 'f':
+                if (strcmp(optarg, "indexed") == 0){
+                    options_p->format = FRAMEBUFFER_INDEXED;
+                } else if (strcmp(optarg, "rgb") == 0){
+                    options_p->format = FRAMEBUFFER_RGB24;
+                } else if (strcmp(optarg, "rgba") == 0){
+                    options_p->format = FRAMEBUFFER_RGBA32;
+                } else {
+                    print_usage(argv[0]);
+                    exit(1);
+                }
+                break;
+            case 'h': print_usage(argv[0]); exit(0);
+            default: print_usage(argv[0]); exit(1);
         }
     }
-}
-
- void step(cpu *cpu_p, int iterations){
 
-    for(int i = 0; i < iterations; i++){
-        execute_next_opcode(cpu_p);
+    if (optind != argc - 1){
+        print_usage(argv[0]);
+        exit(1);
     }
-    print_cpu_content(cpu_p);
-}
-
-void print_screen_data(){
+    options_p->rom_file = argv[optind];
 
-    for (byte height = 0; height < 144; height++){
-        printf("\n");
-        printf("%u  - ", height);
-        for(byte width = 0; width < 160; width++){
-            byte r = screen_data[height][width][0];
-            printf("%u ", r);
-            if (r == 0){
-                printf("B"); // black
-            }
-            else if (r == 255){
-                printf("W"); // white
-            }
-        }
+    // nothing would ever stop a headless run
+    if (options_p->headless && options_p->frames == 0){
+        options_p->frames = HEADLESS_FRAMES;
     }
 }
 
- void emulate(cpu *cpu_p){
-
-    int cycles_used = 0;
-    while (cycles_used < CPU_MAX_CYCLES_PER_SECOND){
-        int cycles = execute_next_opcode(cpu_p);
-        cycles_used += cycles;
-        //update_timers(cpu_p, cycles);
-        //run_interrupts(cpu_p);
-        update_graphics(cpu_p, cycles);
-    }
-    render_screen();
+void print_usage(char *program){
+    printf("usage : %s [--headless] [--frames N] [--boot FILE] [--format indexed|rgb|rgba] [--dump FILE] [--hash] rom.gb\n", program);
 }
 
- byte get_clock_frequency(memory_map *memory_p){
-    return read_memory(memory_p, TMA_INDEX);
-}
+// rom.gb -> rom.sav, the extension is added when the ROM has none
+char *get_save_file_name(char *rom_file){
 
- void set_clock_frequency(memory_map *memory_p){
-    byte tma = get_clock_frequency(memory_p);
+    char *extension_p = strrchr(rom_file, '.');
+    char *separator_p = strrchr(rom_file, '/');
+    size_t length = (extension_p != NULL && (separator_p == NULL || extension_p > separator_p)) ? (size_t) (extension_p - rom_file) : strlen(rom_file);
 
-    switch(tma){
-        case 0: timer_counter = 1024; break; // frequency 4096
-        case 1: timer_counter = 16; break; // frequency 262144
-        case 2: timer_counter = 64; break; // frequency 65536
-        case 3: timer_counter = 256; break; // frequency 16382
-    }
+    char *save_file = malloc(length + sizeof(".sav"));
+    memcpy(save_file, rom_file, length);
+    strcpy(&save_file[length], ".sav");
+    return save_file;
 }
 
- byte clock_enabled(memory_map *memory_p){
-    // bit 2 enable or disable the clock
-    byte enabled = TEST_BIT(read_memory(memory_p, TMC_INDEX), 2) ? TRUE : FALSE;
-    return enabled;
+double get_time(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + (now.tv_nsec / 1000000000.0);
 }
 
- void update_timers(cpu *cpu_p, int cycles){
-
-    update_divider_register(cpu_p->memory_p, cycles);
+#ifndef HEADLESS
+backend *initialize_sdl_backend(void){
+
+    backend *backend_p = calloc(sizeof(backend), 1);
+    backend_p->name = "SDL";
+    // the texture takes RGBA lines as they are in the framebuffer
+    backend_p->framebuffer_format = FRAMEBUFFER_RGBA32;
+    backend_p->open = sdl_open;
+    backend_p->poll_events = sdl_poll_events;
+    backend_p->present = sdl_present;
+    backend_p->close = sdl_close;
+    backend_p->data_p = calloc(sizeof(sdl_backend), 1);
+    return backend_p;
+}
 
-    if (clock_enabled(cpu_p->memory_p)){
-        timer_counter -= cycles;
-        
-        // reset timer counter value
-        if (timer_counter <= 0){
-            set_clock_frequency(cpu_p->memory_p);
-        }
+// SDL_PIXELFORMAT_RGBA32 is R, G, B, A in memory whatever the endianness
+bool sdl_open(backend *backend_p){
+    sdl_backend *sdl_p = backend_p->data_p;
 
-        // interrupt requested when TIMA overflows
-        if (read_memory(cpu_p->memory_p, TIMA_INDEX) == 255){
-            write_memory(cpu_p->memory_p, TIMA_INDEX, 0);
-            service_interrupt(cpu_p, 0);
-        } 
-        else {
-            write_memory(cpu_p->memory_p, TIMA_INDEX, (read_memory(cpu_p->memory_p, TIMA_INDEX) + 1));
-        }
+    if (SDL_Init(SDL_INIT_VIDEO) < 0){
+        printf("SDL could not initialize! SDL_Error: %s\n", SDL_GetError());
+        return FALSE;
     }
-}
-
- void update_divider_register(memory_map *memory_p, int cycles){
-    divider_register += cycles;
-    // divider register overflow
-    if (divider_register >= 255){
-        divider_register = 0;
-        // directly increment memory value since writing to this memory address resets value to 0
-        memory_p->memory[0xFF04]++; 
+    sdl_p->window = SDL_CreateWindow("matchaGb", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_SHOWN);
+    if (sdl_p->window == NULL){
+        printf("Window could not be created! SDL_Error: %s\n", SDL_GetError());
+        return FALSE;
     }
-}
-
-/*
-    Interrupt Procedure
-        IME (interrupt_master_enable) reset by DI (disable interrupt) and prohibits all interrupts
-        IME is set by EI and acknowledges the interrupt setting by the IE register 
-
-        1- When the interrupt is generated, the IF flag will be set
-        2- if the  IME flag is set and the corresponding IE flag is set then step 3-5 are executed
-        3-  Reset the IME flag and prevent all interrupts
-        4- PC is pushed onto the stack
-        5- Jump to the starting address of the interrupt
-
-    return from an interrupt routine can be performed by either RETI or RET instruction
-      if RET is used as final operation, interrupt are disabled until a EI was used in interrupt routine.
- */
- void run_interrupts(cpu *cpu_p){
-
-    if (interrupt_master_enable){
-        byte ir_content = read_memory(cpu_p->memory_p, INTERRUPT_REQUEST_INDEX);
-        byte ie_content = read_memory(cpu_p->memory_p, INTERRUPT_ENABLE_INDEX);
-
-        // run all interrupts that are both in interrupt request and interrupt enable based on priority
-        if (ir_content > 0){
-            for (int interrupt_index = 0; interrupt_index < MAX_INTERRUPTS + 1; interrupt_index++){
-                if (TEST_BIT(ie_content, interrupt_index)){
-                    if (TEST_BIT(ir_content, interrupt_index)){
-                        service_interrupt(cpu_p, interrupt_index);
-                    }
-                }
-            }
-        }
+    sdl_p->renderer = SDL_CreateRenderer(sdl_p->window, -1, SDL_RENDERER_ACCELERATED);
+    if (sdl_p->renderer == NULL){
+        printf("Renderer could not be created! SDL_Error: %s\n", SDL_GetError());
+        return FALSE;
     }
+    sdl_p->texture = SDL_CreateTexture(sdl_p->renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STREAMING, SCREEN_WIDTH, SCREEN_HEIGHT);
+    if (sdl_p->texture == NULL){
+        printf("Texture could not be created! SDL_Error: %s\n", SDL_GetError());
+        return FALSE;
+    }
+    return TRUE;
 }
 
- void request_interrupt(cpu *cpu_p, int id){
-    byte request_value = read_memory(cpu_p->memory_p, INTERRUPT_REQUEST_INDEX);
-    request_value = SET_BIT(request_value, id);
-    write_memory(cpu_p->memory_p, INTERRUPT_REQUEST_INDEX, request_value);
-}
-
- void service_interrupt(cpu *cpu_p, int interrupt_id){
-
-    // when servicing interrupt, master interrupt is turned off and interrupt request memory cleared of interrupt serviced.
-    interrupt_master_enable = FALSE;
-    byte ir_content = read_memory(cpu_p->memory_p, INTERRUPT_REQUEST_INDEX);
-    ir_content = CLEAR_BIT(ir_content, interrupt_id);
-    write_memory(cpu_p->memory_p, INTERRUPT_REQUEST_INDEX, ir_content);
+bool sdl_poll_events(backend *backend_p, gb_context *gb_p){
+    SDL_Event event;
 
-    push_word_to_stack(cpu_p->memory_p, &cpu_p->SP, cpu_p->PC);
-    
-    switch(interrupt_id){
-        case 0: cpu_p->PC = 0x40; break;
-        case 1: cpu_p->PC = 0x48; break;
-        case 2: cpu_p->PC = 0x50; break;
-        case 4: cpu_p->PC = 0x60; break;
+    while (SDL_PollEvent(&event)){
+        if (event.type == SDL_QUIT){
+            return FALSE;
+        }
     }
+    return TRUE;
 }
 
 /*
-Screen resolution is 160 x 144 
-    - only 144 visible lines, 8 invisible
-    - Vertical blank between 144-153 
-        - 
-
-Scanline takes 456 cycles to complete before switching to next line 
-  -  increment memory from LY_INDEX when enough cycles passed.
+    the RGBA32 framebuffer has the layout of the texture, a frame is a single memcpy
+    unless the driver pads the texture lines. the texture already holds a repeated frame
 */
-
- void update_graphics(cpu *cpu_p, int cycles){
-    set_lcd_status(cpu_p);
-    
-    // scanline_counter decrement starting from 456 when lcd is enabled
-    if(lcd_enabled(cpu_p->memory_p)){
-        scanline_counter -= cycles;
-    } else {
+void sdl_present(backend *backend_p, gb_context *gb_p){
+    sdl_backend *sdl_p = backend_p->data_p;
+    unsigned long taken_frames = gb_p->frames_p->taken_frames;
+    framebuffer *framebuffer_p = take_frame(gb_p->frames_p);
+    void *texture_pixels = NULL;
+    int texture_pitch = 0;
+
+    if (taken_frames == gb_p->frames_p->taken_frames){
+        SDL_RenderCopy(sdl_p->renderer, sdl_p->texture, NULL, NULL);
+        SDL_RenderPresent(sdl_p->renderer);
         return;
     }
-
-    if (scanline_counter <= 0){
-        // move to next scanline
-
-        byte current_line = read_memory(cpu_p->memory_p, LY_INDEX);
-        //printf("CURRENT LINE %u \n", current_line);
-
-        // reset counter
-        scanline_counter = 456;
-
-        // in vertical blank
-        if (current_line == 144){
-            //request_interrupt(cpu_p, 0);
-        }
-        
-        // wrap around back to 0
-        else if (current_line > 153){
-            cpu_p->memory_p->memory[LY_INDEX] = 0;
-        }
-
-        else if (current_line < 144){
-            draw_scanline(cpu_p->memory_p);
-        }
-
-        cpu_p->memory_p->memory[LY_INDEX]++;
-    }
-}
-
- void set_lcd_status(cpu *cpu_p){
-    byte status = read_memory(cpu_p->memory_p, LCDC_STATUS_INDEX);
-
-    // if LCD is turned off
-    if (lcd_enabled(cpu_p->memory_p) == FALSE){
-        // set mode to 1 when lcd is disabled and reset scanline
-        scanline_counter = 456;
-        cpu_p->memory_p->memory[LY_INDEX] = 0;
-        // keep all the bits but modify the last 2 bits to become V-BLANK mode 1
-        status &= 252;
-        status = SET_BIT(status, 0);
-        write_memory(cpu_p->memory_p, LCDC_STATUS_INDEX, status);
+    if (SDL_LockTexture(sdl_p->texture, NULL, &texture_pixels, &texture_pitch) < 0){
         return;
     }
-
-    byte current_line = read_memory(cpu_p->memory_p, LY_INDEX);
-    byte current_mode = status & 0x3;
-
-    /*
-        4 modes
-        00 - H-BLANK
-        01 - V-BLANK
-        10 - OAM search
-        11 - Transfering Data to LCD driver
-
-        mode 2 when first 80 cycles
-        mode 3 when 172 cycles after mode 2 = 172 + 80 = 202
-        mode 0 when the rest of the cycles 
-     */
-    byte mode = 0;
-    bool interrupted = FALSE;
-
-    if (current_line >= 144){
-        mode = 1;
-        // set status 2 LSB : 01
-        // check for V blank interrupts
-        status = SET_BIT(status, 0);
-        status = CLEAR_BIT(status, 1);
-        interrupted = TEST_BIT(status, 4);
+    if (texture_pitch == framebuffer_p->pitch){
+        memcpy(texture_pixels, framebuffer_p->pixels, FRAMEBUFFER_SIZE(framebuffer_p));
     } else {
-        int oam_cycles = 80;
-        int vram_cycles = 172;
-        int mode2_bounds = 456 - oam_cycles;
-        int mode3_bounds = mode2_bounds - vram_cycles;
-
-        // mode 2 
-        if (scanline_counter >= mode2_bounds){
-            mode = 2;
-            // set status 2 LSB : 10 
-            status = SET_BIT(status, 1);
-            status = CLEAR_BIT(status, 0);
-            interrupted = TEST_BIT(status, 5);
-        } else if (scanline_counter >= mode3_bounds){
-            mode = 3;
-            // set status 2 LSB : 11 
-            status = SET_BIT(status, 1);
-            status = SET_BIT(status, 0);
-        } else {
-            mode = 0;
-            // set status 2 LSB : 00 
-            status = CLEAR_BIT(status, 1);
-            status = CLEAR_BIT(status, 0);
-            // check for H blank interrupt
-            interrupted = TEST_BIT(status, 3);
-        }
-    }
-
-    // check if H blank or V Blank interrupt
-    if (interrupted && (mode != current_mode)){
-       // service_interrupt(cpu_p, 1);
-    }
-
-    // when 0xFF44 == 0xFF45
-    if (current_line == read_memory(cpu_p->memory_p, LYC_INDEX)){
-        // bit 2 (coincidence flag) is set when condition is true 
-        status = SET_BIT(status, 2);
-        // if bit 6 and bit 2 are enabled then request interrupt
-        if (TEST_BIT(status, 6) > 0){
-           // request_interrupt(cpu_p, 1);
+        for (int line = 0; line < SCREEN_HEIGHT; line++){
+            memcpy((byte *) texture_pixels + (line * texture_pitch), FRAMEBUFFER_LINE(framebuffer_p, line), framebuffer_p->pitch);
         }
-    } else {
-        status = CLEAR_BIT(status, 2);
     }
-
-    // update LCDC status
-    write_memory(cpu_p->memory_p, LCDC_STATUS_INDEX, status);
-}
-
- bool lcd_enabled(memory_map *memory_p){
-    bool enabled = TEST_BIT(read_memory(memory_p, LCDC_INDEX), 7);
-    return enabled;
+    SDL_UnlockTexture(sdl_p->texture);
+    SDL_RenderCopy(sdl_p->renderer, sdl_p->texture, NULL, NULL);
+    SDL_RenderPresent(sdl_p->renderer);
 }
 
- void draw_scanline(memory_map *memory_p){
-    byte lcdc = read_memory(memory_p, LCDC_INDEX);
-    
-    // background
-    if (TEST_BIT(lcdc, 0)){
-        render_tiles(memory_p, lcdc);
-    }
-
-    // sprite
-    // if (TEST_BIT(lcdc, 1)){
-    //     render_sprites(memory_p, lcdc);
-    // }
-}
+void sdl_close(backend *backend_p){
+    sdl_backend *sdl_p = backend_p->data_p;
 
- void render_tiles(memory_map *memory_p, byte lcdc){
-    word tile_data = 0;
-    word background_memory = 0;
-    bool unsig = TRUE;
-
-    // where to draw the visial area and the window
-    byte scroll_y = read_memory(memory_p, SCROLL_Y_INDEX);
-    byte scroll_x = read_memory(memory_p, SCROLL_X_INDEX);
-    byte window_y = read_memory(memory_p, WINDOW_Y_INDEX);
-    byte window_x = read_memory(memory_p, WINDOW_X_INDEX) - 7;
-    
-    // testing scroll Y
-    //scroll_y = 0;
-    //printf("SCROLL Y : %u\n", scroll_y);
-
-    bool windowed = FALSE;
-
-    // verify if window is enabled in LCD
-    if (TEST_BIT(lcdc, 5)){
-        // check is current scanline is within the window Y
-        if (window_y <= read_memory(memory_p, LY_INDEX)){
-            windowed = TRUE;
-        }
+    if (sdl_p->texture != NULL){
+        SDL_DestroyTexture(sdl_p->texture);
     }
-
-    /* background tile data set selection
-            bit 4 of LCD
-                0 -> 0x8800 - 0x97FF (UNSIGNED)
-                1 -> 0x8000 - 0x8FFF (SIGNED)
-     */ 
-
-    if (TEST_BIT(lcdc, 4)){
-        tile_data = 0x8000;
-    } else {
-        tile_data = 0x8800;
-        unsig = FALSE;
-    }
-
-    if (windowed == FALSE){
-        /* background tile map selection
-            bit 3 of LCD 
-                0 -> 0x9800 - 0x9BFF
-                1 -> 0x9C00 - 0x9FFF
-         */
-        if (TEST_BIT(lcdc, 3)){
-            background_memory = 0x9C00;
-        } else {
-            background_memory = 0x9800;
-        }
-    } 
-    else {
-        /* window tile map selection
-            bit 6 of LCD
-                0 -> 0x9800 - 0x9BFF
-                1 -> 0x9C00 - 0x9FFF
-         */
-        if (TEST_BIT(lcdc, 6)){
-            background_memory = 0x9C00;
-        } else {
-            background_memory = 0x9800;
-        }
+    if (sdl_p->renderer != NULL){
+        SDL_DestroyRenderer(sdl_p->renderer);
     }
-
-    byte y_position = 0;
-    
-    // y position used to calculate which 32 vertical tiles the current scanline is drawing
-    if (windowed == FALSE){
-        y_position = scroll_y + read_memory(memory_p, LY_INDEX);
-    } 
-    else {
-        y_position = read_memory(memory_p, LY_INDEX) - window_y;
+    if (sdl_p->window != NULL){
+        SDL_DestroyWindow(sdl_p->window);
     }
+    SDL_Quit();
+    free(sdl_p);
+}
+#endif
 
-    // which 8 vertical pixel are currently tile is the scanline on 
-    word tile_row = (((byte) (y_position / 8)) * 32);
-
-    // printf(" Y POSITION %u : ", y_position);
-    // printf("bg_tile_row : %u \n", tile_row);
-
-    // draw the 160 horizontal pixels for the scanline
-    for (int pixel = 0; pixel < 160; pixel++){
-        byte x_position = pixel + scroll_x;
-
-        // translate the current x position to window space if necessary
-        if (windowed){
-            if (pixel >= window_x){
-                x_position = pixel - window_x;
-            }
-        }
-
-        // which of the 32 horizontal tile does this x_position fall within
-        word tile_column = (x_position / 8);
-        signed_word tile_number;
-
-        // get tile identity number based on signed or unsigned.
-        // 32x32 tiles in BG. each tile can be picked based on horizontal and vertical tile
-        word tile_address = background_memory + tile_row + tile_column;
-        if (unsig){
-            tile_number = (byte) read_memory(memory_p, tile_address);
-        } 
-        else {
-            tile_number = (signed_byte) read_memory(memory_p, tile_address);
-        }
-
-        // find the tile data related to tile identity number
-        word tile_location = tile_data;
+/* bootstrap testing in steps
+    In progress :
+        - Checksum
+*/ 
+void test_bootstrap_rom(gb_context *gb_p){
+
+    step(gb_p, 1); // load SP to 0xFFFE
+    step(gb_p, 24579); // initialize VRAM to 0
+    step(gb_p, 10); // initialize audio
+    step(gb_p, 2); // initialize color palette with 0xFC
+    step(gb_p, 4084); // write Nintendo logo into tile data
+    step(gb_p, 132); // write Nintendo logo into tile map
+    step(gb_p, 6); // enable LCD
+}
 
-        if (unsig){
-            tile_location += (tile_number * TILE_SIZE);
-        } else {
-            tile_location += ((tile_number + 128) * TILE_SIZE);
-        }
+void step_graphics(gb_context *gb_p, backend *backend_p, int iterations){
+    int cycles_used = 0;
+    int cycles = 456;
 
-        // find correct vertical line of the tile to get the tile data from memory
-        byte line = y_position % 8;
-        line *= 2; // each vertical line takes 2 bytes of memory
-        byte data1 = read_memory(memory_p, tile_location + line);
-        byte data2 = read_memory(memory_p, tile_location + line + 1);
-
-        // pixel 0 in the tile is 7 of data 1 and data 2
-        // invert the position of pixel
-        int color_bit = x_position % 8;
-        color_bit -= 7;
-        color_bit *= -1;
-
-        // combine data 2 and data 1 to get color id for this pixel of the tile
-        int color_number = bit_get_value(data2, color_bit);
-        color_number <<= 1;
-        color_number |= bit_get_value(data1, color_bit);
-
-        // have to color for the bit; get the actual color from palette 0xFF47
-        
-        // get color 
-        byte col = get_color(memory_p, color_number, BACKGROUND_PALETTE);
-        int red;
-        int green;
-        int blue;
-
-        // setup RGB values
-        
-        switch(col){
-            case 0: red = 255; green = 255; blue = 255; break; // WHITE
-            case 1: red = 0xCC; green = 0xCC; blue = 0xCC; break ;// LIGHT GRAY
-            case 2:	red = 0x77; green = 0x77; blue = 0x77; break ;// DARK GRAY
-            case 3: red = 0; green = 0; blue =0; break; // BLACK
-        }
-        
-        // read current line
-        int final_y = read_memory(memory_p, LY_INDEX);
-
-        // safety check that in bound 
-        if ((final_y < 0 ) || (final_y > 143) || (pixel < 0) || (pixel > 159)){
-            printf("FAILED SAFETY CHECK");
-            continue;
+    for (int i = 0; i < iterations; i++){
+        cycles_used += cycles;
+        advance_cycles(gb_p, cycles);
+        if (cycles_used >= CPU_MAX_CYCLES_PER_SECOND){
+            cycles_used = 0;
+            backend_p->present(backend_p, gb_p);
         }
-        screen_data[final_y][pixel][0] = red;
-        screen_data[final_y][pixel][1] = green;
-        screen_data[final_y][pixel][2] = blue;
-
-        // print value 
-        // printf("bg_tile_column : %u ", tile_column);
-        // printf("tile_map_address : 0x%04X ", tile_address);
-        // printf("tile_map_number : %d ", tile_number);
-        // printf("tile_data_location : 0x%04X ", tile_location);
-        // printf("flipped %d ", color_bit);
-        // printf("pixel color number %d ", color_number);
-        // printf("pixel palette color %u ", col);
-        // printf(" screen_data[%d][%d] = %d", pixel, final_y, red);
-        // printf("\n");
     }
 }
 
+void step(gb_context *gb_p, int iterations){
 
- byte get_color(memory_map *memory_p, byte column_number, word address){
-    byte result = 0;
-    byte palette = read_memory(memory_p, address);
-    int hi = 0;
-    int lo = 0;
-
-    // which bit of the color palette does the color id map to
-    switch(column_number){
-        case 0: hi = 1; lo = 0; break;
-        case 1: hi = 3; lo = 2; break;
-        case 2: hi = 5; lo = 4; break;
-        case 3: hi = 7; lo = 6; break;
-    }
-
-    // use the palette to get the color
-    int color = 0;
-    color = bit_get_value(palette, hi) << 1;
-    color |= bit_get_value(palette, lo);
-
-    //convert the game color to emulator color
-    switch(color){
-        case 0: result = 0; break; // WHITE
-        case 1: result = 1; break; // LIGHT_GRAY
-        case 2: result = 2; break; // DARK_GRAY 
-        case 3: result = 3; break; // BLACK 
+    for(int i = 0; i < iterations; i++){
+        execute_next_opcode(gb_p->cpu_p);
     }
-
-    return result;
+    print_cpu_content(gb_p->cpu_p);
 }
 
- int bit_get_value(byte data, int position){
-    byte mask = 1 << position ;
-    int bit = (data & mask) ? 1 : 0;
-	return bit;
-}
-
-/* all sprites located in 0x8000-0x8FFF
-all sprites identifiers are unsigned value so easy to find
-40 tiles located in 0x8000-0x8FFF
-scan through them all and check their attribites to find where they rendered
-sprite attribute found in attribute table in 0xFE00-0xFE9F
-Each sprite has 4 bytes associated to it 
-
-0: Sprite Y Position: Position of the sprite on the Y axis of the viewing display minus 16
-1: Sprite X Position: Position of the sprite on the X axis of the viewing display minus 8
-2: Pattern number: This is the sprite identifier used for looking up the sprite data in memory region 0x8000-0x8FFF
-3: Attributes:
-    Bit7: Sprite to Background Priority
-        - 0 then sprite rendered above the background and the window.
-        - 1 hide behind the background
-    Bit6: Y flip
-      - sprite becomes upside down
-    Bit5: X flip
-      - change direction of character
-    Bit4: Palette number
-      - Sprite can either be in palette 0xFF48 or 0xFF49
-    Bit3: Not used in standard gameboy
-    Bit2-0: Not used in standard gameboy
-
-A sprite can be 8x8 pixel or 8x16 pixels
-
-*/
-
- void render_sprites(memory_map *memory_p, byte lcdc){
-
-    // spirte size configuration
-    bool use8x16 = FALSE;
-    if (TEST_BIT(lcdc, 2)){
-        use8x16 = TRUE;
-    }
-
-    for (int sprite = 0; sprite < 40; sprite++){
-        // sprite has 4 bytes in OAM table
-        byte index = sprite * 4;
-        byte y_position = read_memory(memory_p, OAM_INDEX + index) - 16;
-        byte x_position = read_memory(memory_p, OAM_INDEX + index + 1) - 8;
-        byte tile_location = read_memory(memory_p, OAM_INDEX + index + 2);
-        byte attributes = read_memory(memory_p, OAM_INDEX + index + 3);
-
-        bool y_flip = TEST_BIT(attributes, 6);
-        bool x_flip = TEST_BIT(attributes, 5);
-
-        int scanline = read_memory(memory_p, LY_INDEX);
-
-        int y_size = 8;
-        if (use8x16){
-            y_size = 16;
-        }
+void print_screen_data(gb_context *gb_p){
 
-        // does this sprite intercept with the scanline
-        if ((scanline >= y_position) && (scanline < (y_position + y_size))){
-            int line = scanline - y_position;
-
-
-            // read the sprite in backwards in the y axis
-            if (y_flip){
-                line -= y_size;
-                line *= -1;
+    for (byte height = 0; height < 144; height++){
+        printf("\n");
+        printf("%u  - ", height);
+        for(byte width = 0; width < 160; width++){
+            framebuffer *framebuffer_p = &gb_p->framebuffer;
+            byte r = FRAMEBUFFER_LINE(framebuffer_p, height)[width * framebuffer_p->bytes_per_pixel];
+            printf("%u ", r);
+            if (r == 0){
+                printf("B"); // black
             }
-
-            line *=2; // same as tiles
-            word data_address = (0x8000 + (tile_location * 16)) + line;
-            byte data1 = read_memory(memory_p, data_address);
-            byte data2 = read_memory(memory_p, data_address + 1);
-
-            // its easier to read in from right to left as pixel 0 is bit 7 in the color data
-
-            for (int tile_pixel = 7; tile_pixel >= 0; tile_pixel--){
-                int color_bit = tile_pixel;
-                // read the sprite in backwards for the x acis
-                if (x_flip){
-                    color_bit -= 7;
-                    color_bit *= -1;
-                }
-
-                // the rest is the same as for tile 
-                int color_number = bit_get_value(data2, color_bit);
-                color_number <<= 1;
-                color_number |= bit_get_value(data1, color_bit);
-
-                word color_address = TEST_BIT(attributes, 4) ? 0xFF49 : 0xFF48;
-                byte col = get_color(memory_p, color_number, color_address);
-
-                // white is transparent for sprites
-                if (col == 0){
-                    continue;
-                }
-
-                int red = 0;
-                int green = 0;
-                int blue = 0;
-
-                switch(col){
-                    case 0:red =255; green=255; blue=255; break; // WHITE
-                    // case 1:red =0xCC; green=0xCC; blue=0xCC; break; // LIGHT_GRAY
-                    // case 2:red=0x77; green=0x77; blue=0x77; break; // DARK GRAY
-                }
-
-                int x_pixel = 0 - tile_pixel;
-                x_pixel += 7;
-
-                int pixel = x_position + x_pixel;
-
-                // sanity check
-
-                screen_data[pixel][scanline][0] = red;
-                screen_data[pixel][scanline][1] = green;
-                screen_data[pixel][scanline][2] = blue;
-
+            else if (r == 255){
+                printf("W"); // white
             }
         }
     }
 }
 
-void setup_gl_context(){
-    glViewport(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
-    glMatrixMode(GL_MODELVIEW);
-    glLoadIdentity();
-    glOrtho(0, SCREEN_WIDTH, SCREEN_HEIGHT, 0, -1.0, 1.0);
-    glClearColor(0, 0, 0, 1.0);
-    glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
-    glShadeModel(GL_FLAT);
-    glEnable(GL_TEXTURE_2D);
-    glDisable(GL_DEPTH_TEST);
-    glDisable(GL_CULL_FACE);
-    glDisable(GL_DITHER);
-    glDisable(GL_BLEND);
-}
-
-void render_screen(){
- 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
- 	glLoadIdentity();
-    glRasterPos2i(-1, 1);
-	glPixelZoom(1, -1);
- 	glDrawPixels(160, 144, GL_RGB, GL_UNSIGNED_BYTE, &screen_data);
-	SDL_GL_SwapWindow(sdl_window);
-}
-
-void initialize_sdl_window(){
-	//Initialize SDL
-	if( SDL_Init( SDL_INIT_VIDEO ) < 0 ){
-		printf( "SDL could not initialize! SDL_Error: %s\n", SDL_GetError() );
-	}
-	else{
-        //Create window
-        sdl_window = SDL_CreateWindow( "matchaGb", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_OPENGL);
-        if( sdl_window == NULL )
-        {
-            printf( "Window could not be created! SDL_Error: %s\n", SDL_GetError() ); 
-        }
-	}
-}
-
-void initialize_gl_context(){
-    gl_context = SDL_GL_CreateContext(sdl_window);
-    if (gl_context == NULL){
-        printf("GL context could not be created!");
-    } else {
-        setup_gl_context();
-    }
-}
-
-void initialize_screen_data(){
-    for (int x = 0; x < SCREEN_WIDTH; x++){
-        for (int y = 0; y < SCREEN_HEIGHT; y++){
-            screen_data[x][y][0] = 255;
-            screen_data[x][y][1] = 255;
-            screen_data[x][y][2] = 255;
-        }
-    }
-}
-
 void print_cpu_content(cpu *cpu_p){
 
+    materialize_flags(cpu_p);
     printf("\nPC -- PC:0x%04X\n", cpu_p->PC);
 
     printf("AF -- A:0x%02X F:0x%02X \n", cpu_p->AF.hi, cpu_p->AF.lo);
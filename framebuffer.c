@@ -0,0 +1,126 @@
+#include "framebuffer.h"
+
+#define FRAMEBUFFER_CAPACITY (SCREEN_WIDTH * SCREEN_HEIGHT * 4)
+
+void initialize_framebuffer(framebuffer *framebuffer_p, byte format){
+
+    framebuffer_p->pixels = aligned_alloc(FRAMEBUFFER_ALIGNMENT, FRAMEBUFFER_CAPACITY);
+    if (framebuffer_p->pixels == NULL){
+        printf("ERROR : Couldn't allocate the framebuffer \n");
+        exit(1);
+    }
+    memset(framebuffer_p->pixels, 0, FRAMEBUFFER_CAPACITY);
+    set_framebuffer_format(framebuffer_p, format);
+}
+
+void free_framebuffer(framebuffer *framebuffer_p){
+    free(framebuffer_p->pixels);
+    framebuffer_p->pixels = NULL;
+}
+
+// the content isn't converted, the next frame is drawn in the new format
+void set_framebuffer_format(framebuffer *framebuffer_p, byte format){
+
+    switch(format){
+        case FRAMEBUFFER_RGB24: framebuffer_p->bytes_per_pixel = 3; break;
+        case FRAMEBUFFER_INDEXED: framebuffer_p->bytes_per_pixel = 1; break;
+        case FRAMEBUFFER_RGBA32: framebuffer_p->bytes_per_pixel = 4; break;
+        default:
+            printf("WARNING : Unknown framebuffer format %u, using RGB24 \n", format);
+            format = FRAMEBUFFER_RGB24;
+            framebuffer_p->bytes_per_pixel = 3;
+    }
+    framebuffer_p->format = format;
+    framebuffer_p->pitch = SCREEN_WIDTH * framebuffer_p->bytes_per_pixel;
+}
+
+// white screen, shade 0 in indexed format
+void clear_framebuffer(framebuffer *framebuffer_p){
+    byte white = (framebuffer_p->format == FRAMEBUFFER_INDEXED) ? 0 : 0xFF;
+    memset(framebuffer_p->pixels, white, FRAMEBUFFER_SIZE(framebuffer_p));
+}
+
+// FNV-1a of the pixels, only frames of the same format can be compared
+uint64_t hash_framebuffer(framebuffer *framebuffer_p){
+
+    uint64_t hash = 0xCBF29CE484222325;
+    for (int i = 0; i < FRAMEBUFFER_SIZE(framebuffer_p); i++){
+        hash ^= framebuffer_p->pixels[i];
+        hash *= 0x100000001B3;
+    }
+    return hash;
+}
+
+// binary PPM of the frame, indexed frames are written as a PGM with shade 0 as white
+bool dump_framebuffer(framebuffer *framebuffer_p, char *file_name){
+
+    FILE *file_p = fopen(file_name, "wb");
+    if (file_p == NULL){
+        printf("WARNING : Couldn't open %s, the frame isn't dumped \n", file_name);
+        return FALSE;
+    }
+
+    bool indexed = (framebuffer_p->format == FRAMEBUFFER_INDEXED);
+    fprintf(file_p, "%s\n%d %d\n255\n", indexed ? "P5" : "P6", SCREEN_WIDTH, SCREEN_HEIGHT);
+    for (int line = 0; line < SCREEN_HEIGHT; line++){
+        byte *pixel_p = FRAMEBUFFER_LINE(framebuffer_p, line);
+        for (int pixel = 0; pixel < SCREEN_WIDTH; pixel++, pixel_p += framebuffer_p->bytes_per_pixel){
+            if (indexed){
+                fputc(255 - (*pixel_p * 85), file_p);
+            } else {
+                fwrite(pixel_p, 1, 3, file_p);
+            }
+        }
+    }
+    fclose(file_p);
+    return TRUE;
+}
+
+/*
+    the exchange takes the pixels of back_p as its first back buffer, the other two get the same format
+    back_p stays the view of the buffer being drawn, the exchange owns all three
+*/
+frame_exchange *initialize_frame_exchange(framebuffer *back_p){
+
+    frame_exchange *exchange_p = calloc(sizeof(frame_exchange), 1);
+    exchange_p->frames[0] = *back_p;
+    for (int frame = 1; frame < EXCHANGE_FRAMES; frame++){
+        initialize_framebuffer(&exchange_p->frames[frame], back_p->format);
+        clear_framebuffer(&exchange_p->frames[frame]);
+    }
+    exchange_p->back = 0;
+    exchange_p->middle = 1;
+    exchange_p->front = 2;
+    return exchange_p;
+}
+
+void free_frame_exchange(frame_exchange *exchange_p){
+    for (int frame = 0; frame < EXCHANGE_FRAMES; frame++){
+        free_framebuffer(&exchange_p->frames[frame]);
+    }
+    free(exchange_p);
+}
+
+// the finished back buffer becomes the newest frame, back_p is pointed at the free one
+void publish_frame(frame_exchange *exchange_p, framebuffer *back_p){
+
+    int previous = __atomic_exchange_n(&exchange_p->middle, exchange_p->back | FRAME_FRESH, __ATOMIC_ACQ_REL);
+    if (previous & FRAME_FRESH){
+        exchange_p->dropped_frames++;
+    }
+    exchange_p->back = previous & FRAME_INDEX;
+    exchange_p->published_frames++;
+    *back_p = exchange_p->frames[exchange_p->back];
+}
+
+// newest published frame, it isn't written until the next take
+framebuffer *take_frame(frame_exchange *exchange_p){
+
+    if (__atomic_load_n(&exchange_p->middle, __ATOMIC_ACQUIRE) & FRAME_FRESH){
+        exchange_p->front = __atomic_exchange_n(&exchange_p->middle, exchange_p->front, __ATOMIC_ACQ_REL) & FRAME_INDEX;
+        exchange_p->taken_frames++;
+    } else {
+        exchange_p->repeated_frames++;
+    }
+    return &exchange_p->frames[exchange_p->front];
+}
@@ -0,0 +1,65 @@
+#ifndef __FRAMEBUFFER_H__
+#define __FRAMEBUFFER_H__
+
+#include "environment.h"
+
+#define SCREEN_WIDTH 160
+#define SCREEN_HEIGHT 144
+
+// pixel formats the renderer can write
+#define FRAMEBUFFER_RGB24 0 // R, G, B bytes
+#define FRAMEBUFFER_INDEXED 1 // shade 0 - 3 after the palette, one byte per pixel
+#define FRAMEBUFFER_RGBA32 2 // R, G, B, A bytes, the layout display textures take
+
+#define FRAMEBUFFER_ALIGNMENT 64
+
+// frames of a frame exchange, the middle index carries FRAME_FRESH until the frame is taken
+#define EXCHANGE_FRAMES 3
+#define FRAME_INDEX 0x3
+#define FRAME_FRESH 0x4
+
+/*
+    the finished pixels of the screen, the storage is sized and aligned for the widest format
+    so switching formats never reallocates and a frame is handed to a texture in one memcpy
+*/
+typedef struct framebuffer{
+    byte format;
+    int bytes_per_pixel;
+    int pitch; // bytes per line, lines follow each other without padding
+    byte *pixels;
+} framebuffer;
+
+/*
+    triple buffer between the emulation and whoever shows, records or reads the frames
+    the emulation draws into frames[back] while frames[front] belongs to the consumer,
+    a finished frame and the newest unread one only trade places through the middle index.
+    neither side copies pixels or waits for the other, a frame published before the last
+    one was taken is dropped and a take without a new frame returns the same one again.
+*/
+typedef struct frame_exchange{
+    framebuffer frames[EXCHANGE_FRAMES];
+    int back; // emulation side
+    int middle; // swapped atomically by both sides
+    int front; // consumer side
+    unsigned long published_frames;
+    unsigned long dropped_frames;
+    unsigned long taken_frames;
+    unsigned long repeated_frames;
+} frame_exchange;
+
+void initialize_framebuffer(framebuffer *framebuffer_p, byte format);
+void free_framebuffer(framebuffer *framebuffer_p);
+void set_framebuffer_format(framebuffer *framebuffer_p, byte format);
+void clear_framebuffer(framebuffer *framebuffer_p);
+uint64_t hash_framebuffer(framebuffer *framebuffer_p);
+bool dump_framebuffer(framebuffer *framebuffer_p, char *file_name);
+
+frame_exchange *initialize_frame_exchange(framebuffer *back_p);
+void free_frame_exchange(frame_exchange *exchange_p);
+void publish_frame(frame_exchange *exchange_p, framebuffer *back_p);
+framebuffer *take_frame(frame_exchange *exchange_p);
+
+// first byte of line y
+#define FRAMEBUFFER_LINE(framebuffer_p, y) (&(framebuffer_p)->pixels[(y) * (framebuffer_p)->pitch])
+#define FRAMEBUFFER_SIZE(framebuffer_p) ((framebuffer_p)->pitch * SCREEN_HEIGHT)
+#endif
@@ -0,0 +1,542 @@
+#include "gameboy.h"
+#include "block_cache.h"
+#include "jit.h"
+#include "rom_registry.h"
+#include "save.h"
+#include "renderer.h"
+#include "render_thread.h"
+
+// cycles of each PPU step
+#define SCANLINE_CYCLES 456
+#define OAM_SEARCH_CYCLES 80
+#define PIXEL_TRANSFER_CYCLES 172
+#define HBLANK_CYCLES (SCANLINE_CYCLES - OAM_SEARCH_CYCLES - PIXEL_TRANSFER_CYCLES)
+#define VBLANK_LINE 144
+#define LAST_LINE 153
+
+#define DIVIDER_CYCLES 256
+
+#define IDLE_LOOP_MAX_INSTRUCTIONS 8
+#define NOT_CHECKED 0
+#define IDLE_LOOP 1
+#define BUSY_LOOP 2
+
+static void run_due_events(gb_context *gb_p);
+static void skip_halt(gb_context *gb_p, unsigned long long frame_end);
+static bool interrupt_pending(memory_map *memory_p);
+static void skip_idle_loop(gb_context *gb_p, word start, int loop_cycles, unsigned long long frame_end);
+static bool is_idle_loop(memory_map *memory_p, word start);
+static void divider_event(gb_context *gb_p, unsigned long long timestamp);
+static void timer_event(gb_context *gb_p, unsigned long long timestamp);
+static int get_timer_period(memory_map *memory_p);
+static byte clock_enabled(memory_map *memory_p);
+static void ppu_event(gb_context *gb_p, unsigned long long timestamp);
+static void set_lcd_mode(gb_context *gb_p, byte mode);
+static void next_line(gb_context *gb_p, unsigned long long timestamp);
+static void compare_line(gb_context *gb_p);
+static void transfer_line(gb_context *gb_p);
+static void flush_deferred_lines(gb_context *gb_p);
+static void raster_write(void *context_p);
+static void publish_screen(gb_context *gb_p);
+static bool lcd_enabled(memory_map *memory_p);
+
+/*
+    the context takes ownership of the cartridge, or of one reference to it when it's a registered ROM image
+    block cache, JIT and render thread are left to the caller, free_gb_context releases them if they were set
+*/
+gb_context *initialize_gb_context(cartridge *cartridge_p){
+
+    gb_context *gb_p = calloc(sizeof(gb_context), 1);
+    gb_p->cartridge_p = cartridge_p;
+    gb_p->memory_p = initialize_memory(cartridge_p);
+    gb_p->cpu_p = initialize_cpu(gb_p->memory_p);
+    gb_p->scheduler_p = initialize_scheduler();
+    gb_p->memory_p->scheduler_p = gb_p->scheduler_p;
+    gb_p->idle_detection = TRUE;
+    gb_p->frame_batching = TRUE;
+    gb_p->memory_p->raster_log.flush = raster_write;
+    gb_p->memory_p->raster_log.context_p = gb_p;
+    initialize_framebuffer(&gb_p->framebuffer, FRAMEBUFFER_RGB24);
+
+    // the PPU starts as if the LCD was just turned on
+    gb_p->lcd_mode = LCD_OFF;
+    schedule_event(gb_p->scheduler_p, EVENT_PPU, 0);
+    schedule_event(gb_p->scheduler_p, EVENT_DIVIDER, DIVIDER_CYCLES);
+    schedule_event(gb_p->scheduler_p, EVENT_TIMER, get_timer_period(gb_p->memory_p));
+    return gb_p;
+}
+
+void free_gb_context(gb_context *gb_p){
+
+    free_render_thread(gb_p->render_thread_p);
+    free_jit_compiler(gb_p->cpu_p->jit_p);
+    free(gb_p->cpu_p->block_cache_p);
+    free(gb_p->cpu_p);
+    free_memory(gb_p->memory_p);
+    release_cartridge(gb_p->cartridge_p);
+    free(gb_p->scheduler_p);
+    if (gb_p->frames_p != NULL){
+        free_frame_exchange(gb_p->frames_p);
+    } else {
+        free_framebuffer(&gb_p->framebuffer);
+    }
+    free(gb_p);
+}
+
+/*
+    run the cycles of one frame, the screen data is complete when it returns
+    the subsystems only run when the master clock reaches their next event
+*/
+void emulate_frame(gb_context *gb_p){
+
+    scheduler *scheduler_p = gb_p->scheduler_p;
+    unsigned long long frame_end = scheduler_p->cycles + CPU_MAX_CYCLES_PER_SECOND;
+
+    gb_p->frame_halted_cycles = 0;
+    gb_p->memory_p->plane_cache.frame_cells = 0;
+
+    while (scheduler_p->cycles < frame_end){
+        if (gb_p->cpu_p->halted){
+            skip_halt(gb_p, frame_end);
+            continue;
+        }
+        word start = gb_p->cpu_p->PC;
+        int cycles = execute_next_block(gb_p->cpu_p);
+        scheduler_p->cycles += cycles;
+
+        // a block that jumped back to its own start might be polling something only an event can change
+        if (gb_p->cpu_p->PC == start && gb_p->idle_detection){
+            skip_idle_loop(gb_p, start, cycles, frame_end);
+        }
+        if (scheduler_p->cycles >= scheduler_p->next_event){
+            run_due_events(gb_p);
+        }
+        //run_interrupts(gb_p);
+    }
+
+    // the lines pushed to the render thread are drawn by then
+    if (gb_p->render_thread_p != NULL){
+        wait_render_thread(gb_p->render_thread_p);
+    }
+}
+
+// advance the clock without running the CPU
+void advance_cycles(gb_context *gb_p, int cycles){
+    gb_p->scheduler_p->cycles += cycles;
+    run_due_events(gb_p);
+}
+
+void initialize_screen_data(gb_context *gb_p){
+    clear_framebuffer(&gb_p->framebuffer);
+}
+
+/*
+    nothing runs on a halted CPU until an enabled interrupt is requested, and only events can request one
+    jump the clock from event to event instead of executing anything until then
+*/
+static void skip_halt(gb_context *gb_p, unsigned long long frame_end){
+
+    scheduler *scheduler_p = gb_p->scheduler_p;
+    unsigned long long start = scheduler_p->cycles;
+
+    while (scheduler_p->cycles < frame_end){
+        if (interrupt_pending(gb_p->memory_p)){
+            gb_p->cpu_p->halted = FALSE;
+            break;
+        }
+        scheduler_p->cycles = scheduler_p->next_event < frame_end ? scheduler_p->next_event : frame_end;
+        run_due_events(gb_p);
+    }
+
+    gb_p->frame_halted_cycles += scheduler_p->cycles - start;
+    gb_p->halted_cycles += scheduler_p->cycles - start;
+}
+
+// HALT ends when an interrupt is both requested and enabled, even with IME off
+static bool interrupt_pending(memory_map *memory_p){
+    return (memory_p->memory[INTERRUPT_REQUEST_INDEX] & memory_p->memory[INTERRUPT_ENABLE_INDEX] & 0x1F) != 0;
+}
+
+/*
+    an idle loop spins on values only an event can change, every iteration until then does exactly the same
+    run whole iterations at once up to the next event, the loop checks its condition again after it
+    the last loop checked is remembered so busy loops are only decoded once
+*/
+static void skip_idle_loop(gb_context *gb_p, word start, int loop_cycles, unsigned long long frame_end){
+
+    scheduler *scheduler_p = gb_p->scheduler_p;
+    word bank = start < 0x4000 ? gb_p->memory_p->current_rom0_bank : gb_p->memory_p->current_rom_bank;
+
+    // code outside of ROM can be rewritten between two checks
+    if (start >= 0x8000 || start != gb_p->idle_loop_address || bank != gb_p->idle_loop_bank || gb_p->idle_loop_state == NOT_CHECKED){
+        gb_p->idle_loop_address = start;
+        gb_p->idle_loop_bank = bank;
+        gb_p->idle_loop_state = is_idle_loop(gb_p->memory_p, start) ? IDLE_LOOP : BUSY_LOOP;
+    }
+
+    unsigned long long target = scheduler_p->next_event < frame_end ? scheduler_p->next_event : frame_end;
+    if (gb_p->idle_loop_state == BUSY_LOOP || loop_cycles <= 0 || target <= scheduler_p->cycles){
+        return;
+    }
+
+    unsigned long long iterations = (target - scheduler_p->cycles + loop_cycles - 1) / loop_cycles;
+    scheduler_p->cycles += iterations * loop_cycles;
+    gb_p->idle_skipped_cycles += iterations * loop_cycles;
+    gb_p->idle_loops_skipped++;
+}
+
+/*
+    idle loop : a few instructions ending with a jump back to start, that only
+        - load A from memory or I/O registers (nothing in the loop writes memory)
+        - test A with CP / AND / OR / XOR / BIT
+    A is loaded before it's used so an iteration only depends on memory, the other registers are never changed
+*/
+static bool is_idle_loop(memory_map *memory_p, word start){
+
+    word address = start;
+    bool loaded = FALSE;
+
+    for (int i = 0; i < IDLE_LOOP_MAX_INSTRUCTIONS; i++){
+        byte opcode = read_memory(memory_p, address);
+        word next = address + get_opcode_entry(opcode)->length;
+        signed_byte offset = read_memory(memory_p, address + 1);
+        word jump_address = (read_memory(memory_p, address + 2) << 8) | read_memory(memory_p, address + 1);
+
+        switch(opcode){
+            // NOP
+            case 0x00: break;
+
+            // LD A, (BC) / LD A, (DE) / LD A, (HL) / LD A, (nn) / LDH A, (n) / LD A, (C)
+            case 0x0A: case 0x1A: case 0x7E: case 0xFA: case 0xF0: case 0xF2:
+                loaded = TRUE;
+                break;
+
+            // AND / XOR / OR / CP with a register, A is only read after it was loaded
+            case 0xA0 ... 0xBF:
+            // AND n / XOR n / OR n / CP n
+            case 0xE6: case 0xEE: case 0xF6: case 0xFE:
+                if (!loaded){
+                    return FALSE;
+                }
+                break;
+
+            // BIT b, A
+            case 0xCB:
+                if (!loaded || (read_memory(memory_p, address + 1) & 0xC7) != 0x47){
+                    return FALSE;
+                }
+                break;
+
+            // JR e / JR cc, e
+            case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:
+                return (word) (next + offset) == start;
+
+            // JP cc, nn
+            case 0xC2: case 0xCA: case 0xD2: case 0xDA:
+                return jump_address == start;
+
+            default:
+                return FALSE;
+        }
+        address = next;
+    }
+    return FALSE;
+}
+
+static void run_due_events(gb_context *gb_p){
+
+    unsigned long long timestamp;
+    int event;
+
+    while ((event = pop_due_event(gb_p->scheduler_p, &timestamp)) != NO_EVENT){
+        switch(event){
+            case EVENT_PPU: ppu_event(gb_p, timestamp); break;
+            case EVENT_DIVIDER: divider_event(gb_p, timestamp); break;
+            case EVENT_TIMER: timer_event(gb_p, timestamp); break;
+            case EVENT_DMA: dma_event(gb_p->memory_p, timestamp); break;
+            case EVENT_SAVE: flush_battery_save(gb_p->memory_p); break;
+        }
+    }
+}
+
+static void divider_event(gb_context *gb_p, unsigned long long timestamp){
+    // directly increment memory value since writing to this memory address resets value to 0
+    gb_p->memory_p->memory[0xFF04]++;
+    schedule_event(gb_p->scheduler_p, EVENT_DIVIDER, timestamp + DIVIDER_CYCLES);
+}
+
+// TIMA is incremented once per period, when it overflows it's reloaded from TMA and requests the timer interrupt
+static void timer_event(gb_context *gb_p, unsigned long long timestamp){
+
+    memory_map *memory_p = gb_p->memory_p;
+
+    if (clock_enabled(memory_p)){
+        if (memory_p->memory[TIMA_INDEX] == 255){
+            memory_p->memory[TIMA_INDEX] = memory_p->memory[TMA_INDEX];
+            request_interrupt(gb_p, INTERRUPT_TIMER);
+        }
+        else {
+            memory_p->memory[TIMA_INDEX]++;
+        }
+    }
+    // a stopped timer keeps its event so a new TMC value is picked up at the next period
+    schedule_event(gb_p->scheduler_p, EVENT_TIMER, timestamp + get_timer_period(memory_p));
+}
+
+static int get_timer_period(memory_map *memory_p){
+
+    switch(memory_p->memory[TMC_INDEX] & 0x3){
+        case 0: return 1024; // frequency 4096
+        case 1: return 16; // frequency 262144
+        case 2: return 64; // frequency 65536
+    }
+    return 256; // frequency 16384
+}
+
+static byte clock_enabled(memory_map *memory_p){
+    // bit 2 enable or disable the clock
+    byte enabled = TEST_BIT(memory_p->memory[TMC_INDEX], 2) ? TRUE : FALSE;
+    return enabled;
+}
+
+/*
+    Interrupt Procedure
+        IME (interrupt_master_enable) reset by DI (disable interrupt) and prohibits all interrupts
+        IME is set by EI and acknowledges the interrupt setting by the IE register 
+
+        1- When the interrupt is generated, the IF flag will be set
+        2- if the  IME flag is set and the corresponding IE flag is set then step 3-5 are executed
+        3-  Reset the IME flag and prevent all interrupts
+        4- PC is pushed onto the stack
+        5- Jump to the starting address of the interrupt
+
+    return from an interrupt routine can be performed by either RETI or RET instruction
+      if RET is used as final operation, interrupt are disabled until a EI was used in interrupt routine.
+ */
+void run_interrupts(gb_context *gb_p){
+
+    if (gb_p->interrupt_master_enable){
+        byte ir_content = read_memory(gb_p->memory_p, INTERRUPT_REQUEST_INDEX);
+        byte ie_content = read_memory(gb_p->memory_p, INTERRUPT_ENABLE_INDEX);
+
+        // run all interrupts that are both in interrupt request and interrupt enable based on priority
+        if (ir_content > 0){
+            for (int interrupt_index = 0; interrupt_index < MAX_INTERRUPTS + 1; interrupt_index++){
+                if (TEST_BIT(ie_content, interrupt_index)){
+                    if (TEST_BIT(ir_content, interrupt_index)){
+                        service_interrupt(gb_p, interrupt_index);
+                    }
+                }
+            }
+        }
+    }
+}
+
+void request_interrupt(gb_context *gb_p, int id){
+    byte request_value = read_memory(gb_p->memory_p, INTERRUPT_REQUEST_INDEX);
+    request_value = SET_BIT(request_value, id);
+    write_memory(gb_p->memory_p, INTERRUPT_REQUEST_INDEX, request_value);
+}
+
+void service_interrupt(gb_context *gb_p, int interrupt_id){
+
+    cpu *cpu_p = gb_p->cpu_p;
+
+    // when servicing interrupt, master interrupt is turned off and interrupt request memory cleared of interrupt serviced.
+    gb_p->interrupt_master_enable = FALSE;
+    byte ir_content = read_memory(gb_p->memory_p, INTERRUPT_REQUEST_INDEX);
+    ir_content = CLEAR_BIT(ir_content, interrupt_id);
+    write_memory(gb_p->memory_p, INTERRUPT_REQUEST_INDEX, ir_content);
+
+    push_word_to_stack(gb_p->memory_p, &cpu_p->SP, cpu_p->PC);
+    
+    switch(interrupt_id){
+        case 0: cpu_p->PC = 0x40; break;
+        case 1: cpu_p->PC = 0x48; break;
+        case 2: cpu_p->PC = 0x50; break;
+        case 4: cpu_p->PC = 0x60; break;
+    }
+}
+
+
+/*
+Screen resolution is 160 x 144 
+    - only 144 visible lines, 8 invisible
+    - Vertical blank between 144-153 
+
+Scanline takes 456 cycles to complete before switching to next line 
+    - 80 cycles of OAM search (mode 2), 172 cycles of pixel transfer (mode 3), the rest in H-BLANK (mode 0)
+    - each mode change is an event, the scanline is drawn when the pixel transfer ends
+*/
+static void ppu_event(gb_context *gb_p, unsigned long long timestamp){
+
+    memory_map *memory_p = gb_p->memory_p;
+
+    // LCD turned off : LY stays at 0, check again after a scanline
+    if (lcd_enabled(memory_p) == FALSE){
+        memory_p->memory[LY_INDEX] = 0;
+        set_lcd_mode(gb_p, LCD_OFF);
+        schedule_event(gb_p->scheduler_p, EVENT_PPU, timestamp + SCANLINE_CYCLES);
+        return;
+    }
+
+    switch(gb_p->lcd_mode){
+        case LCD_OFF:
+            memory_p->memory[LY_INDEX] = 0;
+            compare_line(gb_p);
+            set_lcd_mode(gb_p, LCD_MODE_OAM);
+            schedule_event(gb_p->scheduler_p, EVENT_PPU, timestamp + OAM_SEARCH_CYCLES);
+            break;
+
+        case LCD_MODE_OAM:
+            set_lcd_mode(gb_p, LCD_MODE_TRANSFER);
+            schedule_event(gb_p->scheduler_p, EVENT_PPU, timestamp + PIXEL_TRANSFER_CYCLES);
+            break;
+
+        case LCD_MODE_TRANSFER:
+            transfer_line(gb_p);
+            set_lcd_mode(gb_p, LCD_MODE_HBLANK);
+            schedule_event(gb_p->scheduler_p, EVENT_PPU, timestamp + HBLANK_CYCLES);
+            break;
+
+        case LCD_MODE_HBLANK:
+        case LCD_MODE_VBLANK:
+            next_line(gb_p, timestamp);
+            break;
+    }
+}
+
+static void next_line(gb_context *gb_p, unsigned long long timestamp){
+
+    memory_map *memory_p = gb_p->memory_p;
+    byte line = memory_p->memory[LY_INDEX] + 1;
+
+    // wrap around back to 0 after the last V-BLANK line
+    if (line > LAST_LINE){
+        line = 0;
+    }
+    memory_p->memory[LY_INDEX] = line;
+    compare_line(gb_p);
+
+    if (line == VBLANK_LINE){
+        // nothing the visible lines read changed during the frame, they're drawn all at once
+        if (memory_p->raster_log.deferring){
+            flush_deferred_lines(gb_p);
+            memory_p->raster_log.fast_frames++;
+        }
+        if (gb_p->frames_p != NULL){
+            publish_screen(gb_p);
+        }
+        set_lcd_mode(gb_p, LCD_MODE_VBLANK);
+        request_interrupt(gb_p, INTERRUPT_VBLANK);
+        schedule_event(gb_p->scheduler_p, EVENT_PPU, timestamp + SCANLINE_CYCLES);
+    }
+    else if (line > VBLANK_LINE){
+        schedule_event(gb_p->scheduler_p, EVENT_PPU, timestamp + SCANLINE_CYCLES);
+    }
+    else {
+        set_lcd_mode(gb_p, LCD_MODE_OAM);
+        schedule_event(gb_p->scheduler_p, EVENT_PPU, timestamp + OAM_SEARCH_CYCLES);
+    }
+}
+
+/*
+    end of the pixel transfer of a line, with a render thread it only gets a snapshot of the line
+    from line 0 the lines are only counted, they're rendered in one pass when V-BLANK starts.
+    a write to the PPU registers, palettes, VRAM or OAM meanwhile renders them first,
+    the rest of the frame is then drawn line by line
+*/
+static void transfer_line(gb_context *gb_p){
+
+    raster_log *log_p = &gb_p->memory_p->raster_log;
+    byte ly = gb_p->memory_p->memory[LY_INDEX];
+
+    if (gb_p->render_thread_p != NULL){
+        push_scanline(gb_p->render_thread_p, gb_p->memory_p);
+        return;
+    }
+    if (ly == 0 && gb_p->frame_batching){
+        log_p->deferring = TRUE;
+    }
+    if (log_p->deferring){
+        log_p->deferred_lines = ly + 1;
+        return;
+    }
+    draw_scanline(gb_p);
+}
+
+static void flush_deferred_lines(gb_context *gb_p){
+
+    raster_log *log_p = &gb_p->memory_p->raster_log;
+    log_p->deferring = FALSE;
+    render_lines(gb_p, 0, log_p->deferred_lines);
+    log_p->deferred_lines = 0;
+}
+
+// called by the memory map before a write changes what the deferred lines show
+static void raster_write(void *context_p){
+
+    gb_context *gb_p = context_p;
+    flush_deferred_lines(gb_p);
+    gb_p->memory_p->raster_log.slow_frames++;
+}
+
+// the frame is finished, the next one is drawn into the buffer the exchange gives back
+static void publish_screen(gb_context *gb_p){
+
+    if (gb_p->render_thread_p != NULL){
+        wait_render_thread(gb_p->render_thread_p);
+    }
+    publish_frame(gb_p->frames_p, &gb_p->framebuffer);
+    if (gb_p->render_thread_p != NULL){
+        gb_p->render_thread_p->shadow.framebuffer = gb_p->framebuffer;
+    }
+}
+
+/*
+    update the 2 LSB of the LCDC status
+        00 - H-BLANK
+        01 - V-BLANK
+        10 - OAM search
+        11 - Transfering Data to LCD driver
+    bits 3, 4 and 5 enable the STAT interrupt for H-BLANK, V-BLANK and OAM search
+*/
+static void set_lcd_mode(gb_context *gb_p, byte mode){
+
+    byte status = gb_p->memory_p->memory[LCDC_STATUS_INDEX];
+    gb_p->lcd_mode = mode;
+
+    // mode 1 is reported while the LCD is disabled
+    if (mode == LCD_OFF){
+        mode = LCD_MODE_VBLANK;
+    }
+    else if ((mode == LCD_MODE_HBLANK && TEST_BIT(status, 3)) || (mode == LCD_MODE_VBLANK && TEST_BIT(status, 4)) || (mode == LCD_MODE_OAM && TEST_BIT(status, 5))){
+        request_interrupt(gb_p, INTERRUPT_LCD_STAT);
+    }
+
+    gb_p->memory_p->memory[LCDC_STATUS_INDEX] = (status & 0xFC) | mode;
+}
+
+// when 0xFF44 == 0xFF45
+static void compare_line(gb_context *gb_p){
+
+    memory_map *memory_p = gb_p->memory_p;
+    byte status = memory_p->memory[LCDC_STATUS_INDEX];
+
+    if (memory_p->memory[LY_INDEX] == memory_p->memory[LYC_INDEX]){
+        // bit 2 (coincidence flag) is set when condition is true 
+        status = SET_BIT(status, 2);
+        // if bit 6 and bit 2 are enabled then request interrupt
+        if (TEST_BIT(status, 6)){
+            request_interrupt(gb_p, INTERRUPT_LCD_STAT);
+        }
+    } else {
+        status = CLEAR_BIT(status, 2);
+    }
+    memory_p->memory[LCDC_STATUS_INDEX] = status;
+}
+
+static bool lcd_enabled(memory_map *memory_p){
+    bool enabled = TEST_BIT(read_memory(memory_p, LCDC_INDEX), 7);
+    return enabled;
+}
@@ -0,0 +1,74 @@
+#ifndef __GAMEBOY_H__
+#define __GAMEBOY_H__
+
+#include "environment.h"
+#include "cartridge.h"
+#include "memory.h"
+#include "cpu.h"
+#include "scheduler.h"
+#include "framebuffer.h"
+
+typedef struct render_thread render_thread;
+
+// interrupt bits of IE / IF
+#define INTERRUPT_VBLANK 0
+#define INTERRUPT_LCD_STAT 1
+#define INTERRUPT_TIMER 2
+#define INTERRUPT_SERIAL 3
+#define INTERRUPT_JOYPAD 4
+
+// PPU modes as reported in the 2 LSB of the LCDC status
+#define LCD_MODE_HBLANK 0
+#define LCD_MODE_VBLANK 1
+#define LCD_MODE_OAM 2
+#define LCD_MODE_TRANSFER 3
+#define LCD_OFF 4
+
+/*
+    one emulated gameboy
+    everything an instance changes while running lives in its context so several of them
+    can run in the same process, one per thread or many on the same thread
+*/
+typedef struct gb_context {
+    cartridge *cartridge_p;
+    memory_map *memory_p;
+    cpu *cpu_p;
+    scheduler *scheduler_p;
+
+    // set by EI and ACK the interrupt setting by the IE register
+    byte interrupt_master_enable;
+
+    // graphics
+    byte lcd_mode;
+    framebuffer framebuffer;
+    frame_exchange *frames_p; // finished frames are published there at V-BLANK when it's set, framebuffer is its back buffer
+    bool frame_batching; // defer the visible lines to V-BLANK while nothing they read changes, on by default
+    render_thread *render_thread_p; // draws the lines instead when it's set
+
+    // instrumentation, cycles fast-forwarded while halted instead of being executed
+    unsigned long long halted_cycles;
+    unsigned long frame_halted_cycles;
+
+    // idle loop detection, on by default
+    bool idle_detection;
+    word idle_loop_address;
+    word idle_loop_bank;
+    byte idle_loop_state;
+    unsigned long long idle_skipped_cycles;
+    unsigned long idle_loops_skipped;
+} gb_context;
+
+gb_context *initialize_gb_context(cartridge *cartridge_p);
+void free_gb_context(gb_context *gb_p);
+void emulate_frame(gb_context *gb_p);
+void advance_cycles(gb_context *gb_p, int cycles);
+
+// interrupts
+void run_interrupts(gb_context *gb_p);
+void request_interrupt(gb_context *gb_p, int id);
+void service_interrupt(gb_context *gb_p, int interrupt_id);
+
+// graphics
+void initialize_screen_data(gb_context *gb_p);
+
+#endif
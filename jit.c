@@ -0,0 +1,638 @@
+#include <stddef.h>
+#include "jit.h"
+
+// compiled blocks keep F in al, which doesn't mix with the pending flags of LAZY_FLAGS
+#if defined(__x86_64__) && !defined(LAZY_FLAGS)
+
+#include <sys/mman.h>
+
+// x86 encodings of the 8 bit registers that don't need a REX prefix
+#define X86_AL 0
+#define X86_CL 1
+#define X86_DL 2
+#define X86_BL 3
+#define X86_AH 4
+#define X86_CH 5
+#define X86_DH 6
+#define X86_BH 7
+
+// x86 encodings of the 16 bit registers holding AF, BC, DE and HL
+#define X86_AX 0
+#define X86_CX 1
+#define X86_DX 2
+#define X86_BX 3
+
+#define X86_JB 0x82
+#define X86_JAE 0x83
+#define X86_JE 0x84
+#define X86_JNE 0x85
+
+// operand bits of the LR35902 opcodes
+#define REGISTER_HL_INDIRECT 6
+#define PAIR_SP 3
+
+#define FLAG_ZERO 0x80
+#define FLAG_SUBTRACT 0x40
+#define FLAG_HALF_CARRY 0x20
+#define FLAG_CARRY 0x10
+
+typedef struct code_emitter {
+    byte *start_p;
+    byte *p;
+    byte *end_p;
+} code_emitter;
+
+static bool emit_instruction(code_emitter *emitter_p, cached_block *block_p, decoded_instruction *instruction_p, word next_address, int *cycles_p);
+static void emit_prologue(code_emitter *emitter_p);
+static void emit_exit(code_emitter *emitter_p, int cycles);
+static void emit_load_registers(code_emitter *emitter_p);
+static void emit_store_registers(code_emitter *emitter_p);
+static void emit_store_pc(code_emitter *emitter_p, word address);
+static void emit_call_handler(code_emitter *emitter_p, decoded_instruction *instruction_p, word next_address);
+static void emit_bank_check(code_emitter *emitter_p, cached_block *block_p, int cycles);
+static void emit_read_hl(code_emitter *emitter_p, byte gb_register);
+static void emit_write_hl(code_emitter *emitter_p, cached_block *block_p, byte gb_register, word next_address, int cycles);
+static void emit_inc_8_bit(code_emitter *emitter_p, byte x86_register);
+static void emit_dec_8_bit(code_emitter *emitter_p, byte x86_register);
+static void emit_logic_8_bit(code_emitter *emitter_p, byte operation, bool immediate, byte value);
+static void emit_add_8_bit(code_emitter *emitter_p, bool immediate, byte value);
+static void emit_conditional_exit(code_emitter *emitter_p, byte opcode, word taken_address, word next_address, int cycles);
+static byte *emit_jump(code_emitter *emitter_p, byte condition);
+static void patch_jump(code_emitter *emitter_p, byte *jump_p);
+static void emit_byte(code_emitter *emitter_p, byte value);
+static void emit_word(code_emitter *emitter_p, word value);
+static void emit_dword(code_emitter *emitter_p, unsigned int value);
+static void emit_qword(code_emitter *emitter_p, unsigned long value);
+static void flush_jit(jit_compiler *jit_p, block_cache *cache_p);
+
+// B, C, D, E, H, L, (HL), A
+static const byte x86_register_8_bit[8] = { X86_BH, X86_BL, X86_CH, X86_CL, X86_DH, X86_DL, 0, X86_AH };
+// BC, DE, HL
+static const byte x86_register_16_bit[3] = { X86_BX, X86_CX, X86_DX };
+
+jit_compiler *initialize_jit_compiler(){
+
+    jit_compiler *jit_p = calloc(sizeof(jit_compiler), 1);
+    jit_p->code_p = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (jit_p->code_p == MAP_FAILED){
+        printf("ERROR : Couldn't allocate JIT code buffer\n");
+        free(jit_p);
+        return NULL;
+    }
+    return jit_p;
+}
+
+void free_jit_compiler(jit_compiler *jit_p){
+
+    if (jit_p == NULL){
+        return;
+    }
+    munmap(jit_p->code_p, JIT_CODE_SIZE);
+    free(jit_p);
+}
+
+jit_block_function compile_block(jit_compiler *jit_p, block_cache *cache_p, cached_block *block_p){
+
+    for (int attempt = 0; attempt < 2; attempt++){
+        code_emitter emitter = { jit_p->code_p + jit_p->used, jit_p->code_p + jit_p->used, jit_p->code_p + JIT_CODE_SIZE };
+        word address = block_p->address;
+        int cycles = 0;
+        bool ended = FALSE;
+
+        emit_prologue(&emitter);
+        for (int i = 0; i < block_p->instruction_count && !ended; i++){
+            decoded_instruction *instruction_p = &block_p->instructions[i];
+            address += instruction_p->length;
+            ended = emit_instruction(&emitter, block_p, instruction_p, address, &cycles);
+        }
+        // block stopped on its size limit, continue after the last instruction
+        if (!ended){
+            emit_store_pc(&emitter, address);
+            emit_exit(&emitter, cycles);
+        }
+
+        if (emitter.p <= emitter.end_p){
+            jit_p->used += emitter.p - emitter.start_p;
+            jit_p->compiled_blocks++;
+            return (jit_block_function) emitter.start_p;
+        }
+        // out of code space, drop every compiled block and start over
+        flush_jit(jit_p, cache_p);
+    }
+    return NULL;
+}
+
+static void flush_jit(jit_compiler *jit_p, block_cache *cache_p){
+
+    for (int i = 0; i < BLOCK_CACHE_SIZE; i++){
+        cache_p->blocks[i].compiled = NULL;
+        cache_p->blocks[i].executions = 0;
+    }
+    jit_p->used = 0;
+    jit_p->flushes++;
+}
+
+/*
+    emit host code for one instruction, PC in the cpu struct is only written back when
+    the block exits or before calling out to C. returns TRUE when the block exited.
+*/
+static bool emit_instruction(code_emitter *emitter_p, cached_block *block_p, decoded_instruction *instruction_p, word next_address, int *cycles_p){
+
+    byte opcode = instruction_p->opcode;
+    word operand = instruction_p->operand;
+    byte target = (opcode >> 3) & 7;
+    byte source = opcode & 7;
+
+    // NOP
+    if (opcode == 0x00){
+        *cycles_p += instruction_p->entry_p->cycles;
+        return FALSE;
+    }
+
+    // LD r, r' / LD r, (HL) / LD (HL), r
+    if (opcode >= 0x40 && opcode < 0x80 && opcode != 0x76){
+        *cycles_p += instruction_p->entry_p->cycles;
+        if (source == REGISTER_HL_INDIRECT){
+            emit_read_hl(emitter_p, target);
+        }
+        else if (target == REGISTER_HL_INDIRECT){
+            emit_write_hl(emitter_p, block_p, source, next_address, *cycles_p);
+        }
+        else if (source != target){
+            // mov r8, r8
+            emit_byte(emitter_p, 0x88);
+            emit_byte(emitter_p, 0xC0 | (x86_register_8_bit[source] << 3) | x86_register_8_bit[target]);
+        }
+        return FALSE;
+    }
+
+    // LD r, n
+    if ((opcode & 0xC7) == 0x06 && target != REGISTER_HL_INDIRECT){
+        *cycles_p += instruction_p->entry_p->cycles;
+        emit_byte(emitter_p, 0xB0 + x86_register_8_bit[target]);
+        emit_byte(emitter_p, operand);
+        return FALSE;
+    }
+
+    // INC r / DEC r
+    if ((opcode & 0xC6) == 0x04 && target != REGISTER_HL_INDIRECT){
+        *cycles_p += instruction_p->entry_p->cycles;
+        if (opcode & 1){
+            emit_dec_8_bit(emitter_p, x86_register_8_bit[target]);
+        } else {
+            emit_inc_8_bit(emitter_p, x86_register_8_bit[target]);
+        }
+        return FALSE;
+    }
+
+    // AND / XOR / OR r and n
+    if ((opcode >= 0xA0 && opcode < 0xB8 && source != REGISTER_HL_INDIRECT) || opcode == 0xE6 || opcode == 0xEE || opcode == 0xF6){
+        *cycles_p += instruction_p->entry_p->cycles;
+        if (opcode >= 0xE6){
+            emit_logic_8_bit(emitter_p, target & 3, TRUE, operand);
+        } else {
+            emit_logic_8_bit(emitter_p, target & 3, FALSE, x86_register_8_bit[source]);
+        }
+        return FALSE;
+    }
+
+    // ADD A, r and n
+    if ((opcode >= 0x80 && opcode < 0x88 && source != REGISTER_HL_INDIRECT) || opcode == 0xC6){
+        *cycles_p += instruction_p->entry_p->cycles;
+        if (opcode == 0xC6){
+            emit_add_8_bit(emitter_p, TRUE, operand);
+        } else {
+            emit_add_8_bit(emitter_p, FALSE, x86_register_8_bit[source]);
+        }
+        return FALSE;
+    }
+
+    // LD (HLI), A / LD A, (HLI) / LD (HLD), A / LD A, (HLD)
+    if (opcode == 0x22 || opcode == 0x2A || opcode == 0x32 || opcode == 0x3A){
+        *cycles_p += instruction_p->entry_p->cycles;
+        if (opcode & 0x08){
+            emit_read_hl(emitter_p, 7);
+        } else {
+            emit_write_hl(emitter_p, block_p, 7, next_address, *cycles_p);
+        }
+        // inc dx / dec dx
+        emit_byte(emitter_p, 0x66);
+        emit_byte(emitter_p, 0xFF);
+        emit_byte(emitter_p, (opcode & 0x10) ? 0xCA : 0xC2);
+        return FALSE;
+    }
+
+    // LD rr, nn
+    if ((opcode & 0xCF) == 0x01){
+        byte pair = opcode >> 4;
+        *cycles_p += instruction_p->entry_p->cycles;
+        if (pair == PAIR_SP){
+            // mov word [rbp + SP], imm16
+            emit_byte(emitter_p, 0x66);
+            emit_byte(emitter_p, 0xC7);
+            emit_byte(emitter_p, 0x45);
+            emit_byte(emitter_p, offsetof(cpu, SP));
+        } else {
+            // mov r16, imm16
+            emit_byte(emitter_p, 0x66);
+            emit_byte(emitter_p, 0xB8 + x86_register_16_bit[pair]);
+        }
+        emit_word(emitter_p, operand);
+        return FALSE;
+    }
+
+    // INC rr / DEC rr
+    if ((opcode & 0xC7) == 0x03){
+        byte pair = opcode >> 4;
+        byte decrement = (opcode & 0x08) ? 0x08 : 0;
+        *cycles_p += instruction_p->entry_p->cycles;
+        emit_byte(emitter_p, 0x66);
+        emit_byte(emitter_p, 0xFF);
+        if (pair == PAIR_SP){
+            // inc / dec word [rbp + SP]
+            emit_byte(emitter_p, 0x45 | decrement);
+            emit_byte(emitter_p, offsetof(cpu, SP));
+        } else {
+            // inc / dec r16
+            emit_byte(emitter_p, 0xC0 | decrement | x86_register_16_bit[pair]);
+        }
+        return FALSE;
+    }
+
+    // JP nn / JR e / JP (HL)
+    if (opcode == 0xC3 || opcode == 0x18 || opcode == 0xE9){
+        *cycles_p += instruction_p->entry_p->cycles;
+        if (opcode == 0xC3){
+            emit_store_pc(emitter_p, operand);
+        }
+        else if (opcode == 0x18){
+            emit_store_pc(emitter_p, next_address + (signed_byte) operand);
+        }
+        else {
+            // mov word [rbp + PC], dx
+            emit_byte(emitter_p, 0x66);
+            emit_byte(emitter_p, 0x89);
+            emit_byte(emitter_p, 0x45 | (X86_DX << 3));
+            emit_byte(emitter_p, offsetof(cpu, PC));
+        }
+        emit_exit(emitter_p, *cycles_p);
+        return TRUE;
+    }
+
+    // JP cc, nn / JR cc, e
+    if ((opcode & 0xE7) == 0xC2 || (opcode & 0xE7) == 0x20){
+        word taken_address = (opcode & 0xE7) == 0xC2 ? operand : next_address + (signed_byte) operand;
+        *cycles_p += instruction_p->entry_p->cycles;
+        emit_conditional_exit(emitter_p, opcode, taken_address, next_address, *cycles_p);
+        return TRUE;
+    }
+
+    // everything else goes through the opcode handler
+    emit_call_handler(emitter_p, instruction_p, next_address);
+    if (instruction_p->entry_p->flags & ENDS_BLOCK){
+        emit_exit(emitter_p, *cycles_p);
+        return TRUE;
+    }
+    emit_bank_check(emitter_p, block_p, *cycles_p);
+    return FALSE;
+}
+
+static void emit_prologue(code_emitter *emitter_p){
+
+    // push rbx, rbp, r12, r13, r14, r15 and keep the stack 16 bytes aligned for calls
+    emit_byte(emitter_p, 0x53);
+    emit_byte(emitter_p, 0x55);
+    emit_byte(emitter_p, 0x41); emit_byte(emitter_p, 0x54);
+    emit_byte(emitter_p, 0x41); emit_byte(emitter_p, 0x55);
+    emit_byte(emitter_p, 0x41); emit_byte(emitter_p, 0x56);
+    emit_byte(emitter_p, 0x41); emit_byte(emitter_p, 0x57);
+    emit_byte(emitter_p, 0x48); emit_byte(emitter_p, 0x83); emit_byte(emitter_p, 0xEC); emit_byte(emitter_p, 0x08);
+
+    // mov rbp, rdi
+    emit_byte(emitter_p, 0x48); emit_byte(emitter_p, 0x89); emit_byte(emitter_p, 0xFD);
+    // mov r14, [rbp + memory_p]
+    emit_byte(emitter_p, 0x4C); emit_byte(emitter_p, 0x8B); emit_byte(emitter_p, 0x75);
+    emit_byte(emitter_p, offsetof(cpu, memory_p));
+    // xor r12d, r12d
+    emit_byte(emitter_p, 0x45); emit_byte(emitter_p, 0x31); emit_byte(emitter_p, 0xE4);
+
+    emit_load_registers(emitter_p);
+}
+
+// write the registers back and return r12d + the cycles of the inlined instructions
+static void emit_exit(code_emitter *emitter_p, int cycles){
+
+    emit_store_registers(emitter_p);
+
+    // mov eax, r12d / add eax, imm32
+    emit_byte(emitter_p, 0x44); emit_byte(emitter_p, 0x89); emit_byte(emitter_p, 0xE0);
+    emit_byte(emitter_p, 0x05);
+    emit_dword(emitter_p, cycles);
+
+    // add rsp, 8 / pop r15, r14, r13, r12, rbp, rbx / ret
+    emit_byte(emitter_p, 0x48); emit_byte(emitter_p, 0x83); emit_byte(emitter_p, 0xC4); emit_byte(emitter_p, 0x08);
+    emit_byte(emitter_p, 0x41); emit_byte(emitter_p, 0x5F);
+    emit_byte(emitter_p, 0x41); emit_byte(emitter_p, 0x5E);
+    emit_byte(emitter_p, 0x41); emit_byte(emitter_p, 0x5D);
+    emit_byte(emitter_p, 0x41); emit_byte(emitter_p, 0x5C);
+    emit_byte(emitter_p, 0x5D);
+    emit_byte(emitter_p, 0x5B);
+    emit_byte(emitter_p, 0xC3);
+}
+
+static void emit_load_registers(code_emitter *emitter_p){
+
+    byte registers[4] = { X86_AX, X86_BX, X86_CX, X86_DX };
+    byte offsets[4] = { offsetof(cpu, AF), offsetof(cpu, BC), offsetof(cpu, DE), offsetof(cpu, HL) };
+
+    // movzx r32, word [rbp + offset]
+    for (int i = 0; i < 4; i++){
+        emit_byte(emitter_p, 0x0F);
+        emit_byte(emitter_p, 0xB7);
+        emit_byte(emitter_p, 0x45 | (registers[i] << 3));
+        emit_byte(emitter_p, offsets[i]);
+    }
+}
+
+static void emit_store_registers(code_emitter *emitter_p){
+
+    byte registers[4] = { X86_AX, X86_BX, X86_CX, X86_DX };
+    byte offsets[4] = { offsetof(cpu, AF), offsetof(cpu, BC), offsetof(cpu, DE), offsetof(cpu, HL) };
+
+    // mov word [rbp + offset], r16
+    for (int i = 0; i < 4; i++){
+        emit_byte(emitter_p, 0x66);
+        emit_byte(emitter_p, 0x89);
+        emit_byte(emitter_p, 0x45 | (registers[i] << 3));
+        emit_byte(emitter_p, offsets[i]);
+    }
+}
+
+static void emit_store_pc(code_emitter *emitter_p, word address){
+
+    // mov word [rbp + PC], imm16
+    emit_byte(emitter_p, 0x66);
+    emit_byte(emitter_p, 0xC7);
+    emit_byte(emitter_p, 0x45);
+    emit_byte(emitter_p, offsetof(cpu, PC));
+    emit_word(emitter_p, address);
+}
+
+// handler(cpu_p, entry_p, operand) with PC already pointing after the instruction
+static void emit_call_handler(code_emitter *emitter_p, decoded_instruction *instruction_p, word next_address){
+
+    emit_store_pc(emitter_p, next_address);
+    emit_store_registers(emitter_p);
+
+    // mov rdi, rbp / mov rsi, entry_p / mov edx, operand / mov rax, handler / call rax
+    emit_byte(emitter_p, 0x48); emit_byte(emitter_p, 0x89); emit_byte(emitter_p, 0xEF);
+    emit_byte(emitter_p, 0x48); emit_byte(emitter_p, 0xBE);
+    emit_qword(emitter_p, (unsigned long) instruction_p->entry_p);
+    emit_byte(emitter_p, 0xBA);
+    emit_dword(emitter_p, instruction_p->operand);
+    emit_byte(emitter_p, 0x48); emit_byte(emitter_p, 0xB8);
+    emit_qword(emitter_p, (unsigned long) instruction_p->entry_p->handler);
+    emit_byte(emitter_p, 0xFF); emit_byte(emitter_p, 0xD0);
+
+    // add r12d, eax
+    emit_byte(emitter_p, 0x41); emit_byte(emitter_p, 0x01); emit_byte(emitter_p, 0xC4);
+
+    emit_load_registers(emitter_p);
+}
+
+// leave the block when a call switched out the ROM bank it was compiled from, in either window
+static void emit_bank_check(code_emitter *emitter_p, cached_block *block_p, int cycles){
+
+    // cmp word [r14 + current_rom0_bank / current_rom_bank], bank
+    emit_byte(emitter_p, 0x66); emit_byte(emitter_p, 0x41); emit_byte(emitter_p, 0x81); emit_byte(emitter_p, 0xBE);
+    emit_dword(emitter_p, block_p->address < 0x4000 ? offsetof(memory_map, current_rom0_bank) : offsetof(memory_map, current_rom_bank));
+    emit_word(emitter_p, block_p->bank);
+
+    byte *same_bank_p = emit_jump(emitter_p, X86_JE);
+    emit_exit(emitter_p, cycles);
+    patch_jump(emitter_p, same_bank_p);
+}
+
+/*
+    (HL) is read through the page table like read_memory does, every page is mapped
+    so the echo RAM, the banked windows and the DMA open bus come out the same
+*/
+static void emit_read_hl(code_emitter *emitter_p, byte gb_register){
+
+    // movzx esi, dh / mov rsi, [r14 + rsi * 8 + read_pages]
+    emit_byte(emitter_p, 0x0F); emit_byte(emitter_p, 0xB6); emit_byte(emitter_p, 0xF6);
+    emit_byte(emitter_p, 0x49); emit_byte(emitter_p, 0x8B); emit_byte(emitter_p, 0xB4); emit_byte(emitter_p, 0xF6);
+    emit_dword(emitter_p, offsetof(memory_map, read_pages));
+    // movzx edi, dl / mov r8, [rsi + rdi]
+    emit_byte(emitter_p, 0x0F); emit_byte(emitter_p, 0xB6); emit_byte(emitter_p, 0xFA);
+    emit_byte(emitter_p, 0x8A);
+    emit_byte(emitter_p, 0x04 | (x86_register_8_bit[gb_register] << 3));
+    emit_byte(emitter_p, 0x3E);
+}
+
+/*
+    pages mapped for writing (WRAM, enabled external RAM) are written directly like write_memory does,
+    every other address keeps the write_memory side effects. a timed DMA unmaps every page, so the
+    writes after the one starting it are dropped by the handler like in the interpreter
+*/
+static void emit_write_hl(code_emitter *emitter_p, cached_block *block_p, byte gb_register, word next_address, int cycles){
+
+    // movzx esi, dh / mov rsi, [r14 + rsi * 8 + write_pages] / test rsi, rsi / jz slow
+    emit_byte(emitter_p, 0x0F); emit_byte(emitter_p, 0xB6); emit_byte(emitter_p, 0xF6);
+    emit_byte(emitter_p, 0x49); emit_byte(emitter_p, 0x8B); emit_byte(emitter_p, 0xB4); emit_byte(emitter_p, 0xF6);
+    emit_dword(emitter_p, offsetof(memory_map, write_pages));
+    emit_byte(emitter_p, 0x48); emit_byte(emitter_p, 0x85); emit_byte(emitter_p, 0xF6);
+    byte *unmapped_p = emit_jump(emitter_p, X86_JE);
+
+    // movzx edi, dl / mov [rsi + rdi], r8
+    emit_byte(emitter_p, 0x0F); emit_byte(emitter_p, 0xB6); emit_byte(emitter_p, 0xFA);
+    emit_byte(emitter_p, 0x88);
+    emit_byte(emitter_p, 0x04 | (x86_register_8_bit[gb_register] << 3));
+    emit_byte(emitter_p, 0x3E);
+    byte *done_p = emit_jump(emitter_p, 0);
+
+    // write_memory(memory_p, HL, r8)
+    patch_jump(emitter_p, unmapped_p);
+    emit_store_pc(emitter_p, next_address);
+    emit_store_registers(emitter_p);
+    emit_byte(emitter_p, 0x4C); emit_byte(emitter_p, 0x89); emit_byte(emitter_p, 0xF7);
+    emit_byte(emitter_p, 0x0F); emit_byte(emitter_p, 0xB7); emit_byte(emitter_p, 0xF2);
+    emit_byte(emitter_p, 0x0F); emit_byte(emitter_p, 0xB6);
+    emit_byte(emitter_p, 0xD0 | x86_register_8_bit[gb_register]);
+    emit_byte(emitter_p, 0x48); emit_byte(emitter_p, 0xB8);
+    emit_qword(emitter_p, (unsigned long) write_memory);
+    emit_byte(emitter_p, 0xFF); emit_byte(emitter_p, 0xD0);
+    emit_load_registers(emitter_p);
+    // writes below 0x8000 can switch the bank the block was compiled from
+    emit_bank_check(emitter_p, block_p, cycles);
+
+    patch_jump(emitter_p, done_p);
+}
+
+// Z and H from the result, N cleared and C kept
+static void emit_inc_8_bit(code_emitter *emitter_p, byte x86_register){
+
+    // and al, 0x1F / inc r8 / jnz +2 / or al, Z / test r8, 0x0F / jnz +2 / or al, H
+    emit_byte(emitter_p, 0x24); emit_byte(emitter_p, 0x1F);
+    emit_byte(emitter_p, 0xFE); emit_byte(emitter_p, 0xC0 | x86_register);
+    emit_byte(emitter_p, 0x75); emit_byte(emitter_p, 0x02);
+    emit_byte(emitter_p, 0x0C); emit_byte(emitter_p, FLAG_ZERO);
+    emit_byte(emitter_p, 0xF6); emit_byte(emitter_p, 0xC0 | x86_register); emit_byte(emitter_p, 0x0F);
+    emit_byte(emitter_p, 0x75); emit_byte(emitter_p, 0x02);
+    emit_byte(emitter_p, 0x0C); emit_byte(emitter_p, FLAG_HALF_CARRY);
+}
+
+// H is set when the low nibble borrows, Z from the result, N set and C kept
+static void emit_dec_8_bit(code_emitter *emitter_p, byte x86_register){
+
+    // and al, 0x1F / or al, N / test r8, 0x0F / jnz +2 / or al, H / dec r8 / jnz +2 / or al, Z
+    emit_byte(emitter_p, 0x24); emit_byte(emitter_p, 0x1F);
+    emit_byte(emitter_p, 0x0C); emit_byte(emitter_p, FLAG_SUBTRACT);
+    emit_byte(emitter_p, 0xF6); emit_byte(emitter_p, 0xC0 | x86_register); emit_byte(emitter_p, 0x0F);
+    emit_byte(emitter_p, 0x75); emit_byte(emitter_p, 0x02);
+    emit_byte(emitter_p, 0x0C); emit_byte(emitter_p, FLAG_HALF_CARRY);
+    emit_byte(emitter_p, 0xFE); emit_byte(emitter_p, 0xC8 | x86_register);
+    emit_byte(emitter_p, 0x75); emit_byte(emitter_p, 0x02);
+    emit_byte(emitter_p, 0x0C); emit_byte(emitter_p, FLAG_ZERO);
+}
+
+// AND (0), XOR (1), OR (2) on A with a register or an immediate, the flags only depend on the result being zero
+static void emit_logic_8_bit(code_emitter *emitter_p, byte operation, bool immediate, byte value){
+
+    // and / xor / or ah, imm8 is 80 /4, 80 /6, 80 /1
+    byte immediate_extensions[3] = { 0xE4, 0xF4, 0xCC };
+    // and / xor / or r/m8, r8
+    byte register_opcodes[3] = { 0x20, 0x30, 0x08 };
+
+    if (immediate){
+        emit_byte(emitter_p, 0x80);
+        emit_byte(emitter_p, immediate_extensions[operation]);
+        emit_byte(emitter_p, value);
+    } else {
+        emit_byte(emitter_p, register_opcodes[operation]);
+        emit_byte(emitter_p, 0xC0 | (value << 3) | X86_AH);
+    }
+
+    // setz al / shl al, 7 / or al, H for AND
+    emit_byte(emitter_p, 0x0F); emit_byte(emitter_p, 0x94); emit_byte(emitter_p, 0xC0);
+    emit_byte(emitter_p, 0xC0); emit_byte(emitter_p, 0xE0); emit_byte(emitter_p, 0x07);
+    if (operation == 0){
+        emit_byte(emitter_p, 0x0C); emit_byte(emitter_p, FLAG_HALF_CARRY);
+    }
+}
+
+// ADD A with a register or an immediate, H comes from the sum of the low nibbles kept in esi
+static void emit_add_8_bit(code_emitter *emitter_p, bool immediate, byte value){
+
+    // movzx esi, ah / movzx edi, r8 or mov edi, imm32 / and esi, 0x0F / and edi, 0x0F / add esi, edi
+    emit_byte(emitter_p, 0x0F); emit_byte(emitter_p, 0xB6); emit_byte(emitter_p, 0xF4);
+    if (immediate){
+        emit_byte(emitter_p, 0xBF);
+        emit_dword(emitter_p, value);
+    } else {
+        emit_byte(emitter_p, 0x0F); emit_byte(emitter_p, 0xB6); emit_byte(emitter_p, 0xF8 | value);
+    }
+    emit_byte(emitter_p, 0x83); emit_byte(emitter_p, 0xE6); emit_byte(emitter_p, 0x0F);
+    emit_byte(emitter_p, 0x83); emit_byte(emitter_p, 0xE7); emit_byte(emitter_p, 0x0F);
+    emit_byte(emitter_p, 0x01); emit_byte(emitter_p, 0xFE);
+
+    // add ah, r8 or add ah, imm8
+    if (immediate){
+        emit_byte(emitter_p, 0x80); emit_byte(emitter_p, 0xC4); emit_byte(emitter_p, value);
+    } else {
+        emit_byte(emitter_p, 0x00); emit_byte(emitter_p, 0xC0 | (value << 3) | X86_AH);
+    }
+
+    // mov al, 0 / jnc +2 / mov al, C / jnz +2 / or al, Z / cmp esi, 0x0F / jbe +2 / or al, H
+    emit_byte(emitter_p, 0xB0); emit_byte(emitter_p, 0x00);
+    emit_byte(emitter_p, 0x73); emit_byte(emitter_p, 0x02);
+    emit_byte(emitter_p, 0xB0); emit_byte(emitter_p, FLAG_CARRY);
+    emit_byte(emitter_p, 0x75); emit_byte(emitter_p, 0x02);
+    emit_byte(emitter_p, 0x0C); emit_byte(emitter_p, FLAG_ZERO);
+    emit_byte(emitter_p, 0x83); emit_byte(emitter_p, 0xFE); emit_byte(emitter_p, 0x0F);
+    emit_byte(emitter_p, 0x76); emit_byte(emitter_p, 0x02);
+    emit_byte(emitter_p, 0x0C); emit_byte(emitter_p, FLAG_HALF_CARRY);
+}
+
+static void emit_conditional_exit(code_emitter *emitter_p, byte opcode, word taken_address, word next_address, int cycles){
+
+    // NZ, Z, NC, C
+    byte condition = (opcode >> 3) & 3;
+    byte mask = (condition < 2) ? FLAG_ZERO : FLAG_CARRY;
+
+    // test al, mask / skip the taken exit when the condition doesn't hold
+    emit_byte(emitter_p, 0xA8);
+    emit_byte(emitter_p, mask);
+    byte *not_taken_p = emit_jump(emitter_p, (condition & 1) ? X86_JE : X86_JNE);
+
+    emit_store_pc(emitter_p, taken_address);
+    emit_exit(emitter_p, cycles);
+
+    patch_jump(emitter_p, not_taken_p);
+    emit_store_pc(emitter_p, next_address);
+    emit_exit(emitter_p, cycles);
+}
+
+// jcc / jmp rel32 with the displacement patched later, condition 0 is an unconditional jump
+static byte *emit_jump(code_emitter *emitter_p, byte condition){
+
+    if (condition == 0){
+        emit_byte(emitter_p, 0xE9);
+    } else {
+        emit_byte(emitter_p, 0x0F);
+        emit_byte(emitter_p, condition);
+    }
+    byte *jump_p = emitter_p->p;
+    emit_dword(emitter_p, 0);
+    return jump_p;
+}
+
+static void patch_jump(code_emitter *emitter_p, byte *jump_p){
+
+    if (jump_p + 4 > emitter_p->end_p){
+        return;
+    }
+    int displacement = emitter_p->p - (jump_p + 4);
+    memcpy(jump_p, &displacement, 4);
+}
+
+// bytes past the end of the buffer are dropped, compile_block checks for the overflow
+static void emit_byte(code_emitter *emitter_p, byte value){
+
+    if (emitter_p->p < emitter_p->end_p){
+        *emitter_p->p = value;
+    }
+    emitter_p->p++;
+}
+
+static void emit_word(code_emitter *emitter_p, word value){
+    emit_byte(emitter_p, value & 0xFF);
+    emit_byte(emitter_p, value >> 8);
+}
+
+static void emit_dword(code_emitter *emitter_p, unsigned int value){
+    emit_word(emitter_p, value & 0xFFFF);
+    emit_word(emitter_p, value >> 16);
+}
+
+static void emit_qword(code_emitter *emitter_p, unsigned long value){
+    emit_dword(emitter_p, value & 0xFFFFFFFF);
+    emit_dword(emitter_p, value >> 32);
+}
+
+#else
+
+// the recompiler only targets x86-64 with eager flags, other builds keep the interpreter
+jit_compiler *initialize_jit_compiler(){
+    return NULL;
+}
+
+void free_jit_compiler(jit_compiler *jit_p){
+}
+
+jit_block_function compile_block(jit_compiler *jit_p, block_cache *cache_p, cached_block *block_p){
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef __JIT_H__
+#define __JIT_H__
+
+#include "environment.h"
+#include "cpu.h"
+#include "block_cache.h"
+
+#define JIT_CODE_SIZE 0x400000
+#define JIT_HOT_THRESHOLD 16
+
+/*
+    x86-64 recompiler for hot ROM blocks of the block cache
+    guest registers live in host registers while a compiled block runs :
+        AF -> ax, BC -> bx, DE -> cx, HL -> dx, cpu_p -> rbp, memory_p -> r14, cycles -> r12d
+    loads, register moves, INC/DEC, ADD, AND/OR/XOR and jumps are emitted inline, everything
+    else calls the opcode handler of the table. the compiled block returns the cycles it used.
+*/
+struct jit_compiler {
+    byte *code_p;
+    unsigned long used;
+    unsigned long compiled_blocks;
+    unsigned long flushes;
+};
+
+jit_compiler *initialize_jit_compiler();
+void free_jit_compiler(jit_compiler *jit_p);
+jit_block_function compile_block(jit_compiler *jit_p, block_cache *cache_p, cached_block *block_p);
+
+#endif
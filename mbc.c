@@ -0,0 +1,309 @@
+#include "mbc.h"
+#include "memory.h"
+#include "save.h"
+
+#define BANK_SIZE 0x4000
+#define EXTERNAL_RAM_SIZE 0x2000
+#define MBC2_RAM_SIZE 0x200
+#define RTC_SELECT 0x08
+
+static void ignore_write(memory_map *memory_p, word address, byte data);
+static void write_mbc1(memory_map *memory_p, word address, byte data);
+static void write_mbc2(memory_map *memory_p, word address, byte data);
+static void write_mbc3(memory_map *memory_p, word address, byte data);
+static void write_mbc5(memory_map *memory_p, word address, byte data);
+static void write_mbc2_ram(memory_map *memory_p, word address, byte data);
+static void write_mbc3_rtc(memory_map *memory_p, word address, byte data);
+static void update_rom_only_banks(memory_map *memory_p);
+static void update_mbc1_banks(memory_map *memory_p);
+static void update_mbc2_banks(memory_map *memory_p);
+static void update_mbc3_banks(memory_map *memory_p);
+static void update_mbc5_banks(memory_map *memory_p);
+static void enable_ram(memory_map *memory_p, byte data);
+static void set_rom0_bank(memory_map *memory_p, word bank);
+static void set_rom_bank(memory_map *memory_p, word bank);
+static void set_ram_bank(memory_map *memory_p, byte bank);
+static void switch_banks(memory_map *memory_p);
+
+void initialize_mbc(memory_map *memory_p){
+
+    mbc *mbc_p = &memory_p->mbc;
+    mbc_p->bank_low = 1;
+    mbc_p->write_ram = ignore_write;
+    mbc_p->rtc_time = time(NULL);
+    memory_p->rom_banking = TRUE;
+
+    switch(memory_p->cartridge_p->cartridge_type){
+        case MBC1:
+            mbc_p->write_control = write_mbc1;
+            mbc_p->update_banks = update_mbc1_banks;
+            break;
+        case MBC2:
+            mbc_p->write_control = write_mbc2;
+            mbc_p->write_ram = write_mbc2_ram;
+            mbc_p->update_banks = update_mbc2_banks;
+            break;
+        case MBC3:
+            mbc_p->write_control = write_mbc3;
+            mbc_p->write_ram = write_mbc3_rtc;
+            mbc_p->update_banks = update_mbc3_banks;
+            break;
+        case MBC5:
+            mbc_p->write_control = write_mbc5;
+            mbc_p->update_banks = update_mbc5_banks;
+            break;
+        default:
+            mbc_p->write_control = ignore_write;
+            mbc_p->update_banks = update_rom_only_banks;
+            break;
+    }
+    mbc_p->update_banks(memory_p);
+}
+
+/*
+    bring the clock registers up to now, the day counter is 9 bits wide
+    and sets the carry bit of RTC_DAY_HIGH when it overflows
+*/
+void update_rtc(mbc *mbc_p, time_t now){
+
+    byte *rtc = mbc_p->rtc;
+    if (TEST_BIT(rtc[RTC_DAY_HIGH], 6) || now <= mbc_p->rtc_time){
+        mbc_p->rtc_time = now;
+        return;
+    }
+
+    unsigned long days = ((rtc[RTC_DAY_HIGH] & 0x1) << 8) | rtc[RTC_DAY_LOW];
+    unsigned long long seconds = rtc[RTC_SECONDS] + (rtc[RTC_MINUTES] * 60) + (rtc[RTC_HOURS] * 3600) + (days * 86400);
+    seconds += now - mbc_p->rtc_time;
+    mbc_p->rtc_time = now;
+
+    rtc[RTC_SECONDS] = seconds % 60;
+    rtc[RTC_MINUTES] = (seconds / 60) % 60;
+    rtc[RTC_HOURS] = (seconds / 3600) % 24;
+    days = seconds / 86400;
+    if (days > 0x1FF){
+        rtc[RTC_DAY_HIGH] = SET_BIT(rtc[RTC_DAY_HIGH], 7);
+        days &= 0x1FF;
+    }
+    rtc[RTC_DAY_LOW] = days & 0xFF;
+    rtc[RTC_DAY_HIGH] = (rtc[RTC_DAY_HIGH] & 0xFE) | (days >> 8);
+}
+
+static void ignore_write(memory_map *memory_p, word address, byte data){
+    return;
+}
+
+/*
+    0x0000 - 0x1FFF RAM enable, 0x2000 - 0x3FFF BANK1 (0 selects 1),
+    0x4000 - 0x5FFF BANK2, 0x6000 - 0x7FFF banking mode
+*/
+static void write_mbc1(memory_map *memory_p, word address, byte data){
+
+    mbc *mbc_p = &memory_p->mbc;
+    if (address < 0x2000){
+        enable_ram(memory_p, data);
+        return;
+    }
+    else if (address < 0x4000){
+        // only the 5 bits register is checked, so banks 0x20, 0x40 and 0x60 can't be selected
+        mbc_p->bank_low = data & 0x1F;
+        if (mbc_p->bank_low == 0){
+            mbc_p->bank_low = 1;
+        }
+    }
+    else if (address < 0x6000){
+        mbc_p->bank_high = data & 0x3;
+    }
+    else {
+        memory_p->rom_banking = ((data & 0x1) == 0) ? TRUE : FALSE;
+    }
+    switch_banks(memory_p);
+}
+
+// bit 8 of the address picks between RAM enable and ROM bank, there's no RAM banking
+static void write_mbc2(memory_map *memory_p, word address, byte data){
+
+    if (address >= 0x4000){
+        return;
+    }
+    if (TEST_BIT(address, 8) == 0){
+        enable_ram(memory_p, data);
+        return;
+    }
+    memory_p->mbc.bank_low = data & 0xF;
+    if (memory_p->mbc.bank_low == 0){
+        memory_p->mbc.bank_low = 1;
+    }
+    switch_banks(memory_p);
+}
+
+/*
+    0x0000 - 0x1FFF RAM and clock enable, 0x2000 - 0x3FFF ROM bank (0 selects 1),
+    0x4000 - 0x5FFF RAM bank or clock register, 0x6000 - 0x7FFF latch the clock on 0 then 1
+*/
+static void write_mbc3(memory_map *memory_p, word address, byte data){
+
+    mbc *mbc_p = &memory_p->mbc;
+    if (address < 0x2000){
+        enable_ram(memory_p, data);
+        return;
+    }
+    else if (address < 0x4000){
+        mbc_p->bank_low = data & 0x7F;
+        if (mbc_p->bank_low == 0){
+            mbc_p->bank_low = 1;
+        }
+    }
+    else if (address < 0x6000){
+        mbc_p->ram_select = data;
+    }
+    else {
+        if (mbc_p->latch == 0 && data == 1){
+            update_rtc(mbc_p, time(NULL));
+            memcpy(mbc_p->rtc_latched, mbc_p->rtc, RTC_REGISTERS);
+        }
+        mbc_p->latch = data;
+    }
+    switch_banks(memory_p);
+}
+
+/*
+    0x0000 - 0x1FFF RAM enable, 0x2000 - 0x2FFF ROM bank bits 0-7, 0x3000 - 0x3FFF ROM bank bit 8,
+    0x4000 - 0x5FFF RAM bank, bank 0 can be selected in the switchable window
+*/
+static void write_mbc5(memory_map *memory_p, word address, byte data){
+
+    mbc *mbc_p = &memory_p->mbc;
+    if (address < 0x2000){
+        enable_ram(memory_p, data);
+        return;
+    }
+    else if (address < 0x3000){
+        mbc_p->bank_low = data;
+    }
+    else if (address < 0x4000){
+        mbc_p->bank_high = data & 0x1;
+    }
+    else if (address < 0x6000){
+        mbc_p->ram_select = data & 0xF;
+    }
+    else {
+        return;
+    }
+    switch_banks(memory_p);
+}
+
+// the built-in RAM is 512 x 4 bits, the upper nibble reads back as 1s
+static void write_mbc2_ram(memory_map *memory_p, word address, byte data){
+
+    if (memory_p->enable_ram){
+        memory_p->ram_banks[address & (MBC2_RAM_SIZE - 1)] = data | 0xF0;
+        if (memory_p->save_p != NULL){
+            mark_save_dirty(memory_p, address & (MBC2_RAM_SIZE - 1));
+        }
+    }
+}
+
+// RAM banks are written directly, only the clock registers end up here
+static void write_mbc3_rtc(memory_map *memory_p, word address, byte data){
+
+    mbc *mbc_p = &memory_p->mbc;
+    if (!memory_p->enable_ram || mbc_p->ram_select < RTC_SELECT || mbc_p->ram_select > (RTC_SELECT + RTC_DAY_HIGH)){
+        return;
+    }
+    update_rtc(mbc_p, time(NULL));
+    mbc_p->rtc[mbc_p->ram_select - RTC_SELECT] = data;
+    mbc_p->rtc_latched[mbc_p->ram_select - RTC_SELECT] = data;
+    switch_banks(memory_p);
+}
+
+static void update_rom_only_banks(memory_map *memory_p){
+    set_rom0_bank(memory_p, 0);
+    set_rom_bank(memory_p, 1);
+    set_ram_bank(memory_p, 0);
+}
+
+static void update_mbc1_banks(memory_map *memory_p){
+
+    mbc *mbc_p = &memory_p->mbc;
+    set_rom_bank(memory_p, (mbc_p->bank_high << 5) | mbc_p->bank_low);
+
+    // mode 1 applies BANK2 to the fixed window and to the RAM bank as well
+    if (memory_p->rom_banking){
+        set_rom0_bank(memory_p, 0);
+        set_ram_bank(memory_p, 0);
+        return;
+    }
+    set_rom0_bank(memory_p, mbc_p->bank_high << 5);
+    set_ram_bank(memory_p, mbc_p->bank_high);
+}
+
+static void update_mbc2_banks(memory_map *memory_p){
+    mbc *mbc_p = &memory_p->mbc;
+    set_rom0_bank(memory_p, 0);
+    set_rom_bank(memory_p, mbc_p->bank_low);
+    memory_p->current_ram_bank = 0;
+    mbc_p->ram_bank_p = memory_p->ram_banks;
+    mbc_p->ram_bank_size = MBC2_RAM_SIZE;
+    mbc_p->ram_direct = FALSE;
+}
+
+static void update_mbc3_banks(memory_map *memory_p){
+
+    mbc *mbc_p = &memory_p->mbc;
+    set_rom0_bank(memory_p, 0);
+    set_rom_bank(memory_p, mbc_p->bank_low);
+    if (mbc_p->ram_select < RTC_SELECT){
+        set_ram_bank(memory_p, mbc_p->ram_select & 0x3);
+        return;
+    }
+
+    // a clock register is selected, the whole window reads its latched value
+    byte rtc_register = (mbc_p->ram_select <= (RTC_SELECT + RTC_DAY_HIGH)) ? mbc_p->rtc_latched[mbc_p->ram_select - RTC_SELECT] : 0xFF;
+    memset(mbc_p->rtc_page, rtc_register, sizeof(mbc_p->rtc_page));
+    mbc_p->ram_bank_p = mbc_p->rtc_page;
+    mbc_p->ram_bank_size = sizeof(mbc_p->rtc_page);
+    mbc_p->ram_direct = FALSE;
+}
+
+static void update_mbc5_banks(memory_map *memory_p){
+    mbc *mbc_p = &memory_p->mbc;
+    set_rom0_bank(memory_p, 0);
+    set_rom_bank(memory_p, (mbc_p->bank_high << 8) | mbc_p->bank_low);
+    set_ram_bank(memory_p, mbc_p->ram_select);
+}
+
+static void enable_ram(memory_map *memory_p, byte data){
+    bool enabled = memory_p->enable_ram;
+    memory_p->enable_ram = ((data & 0xF) == 0xA) ? TRUE : FALSE;
+    // games disable RAM once they are done saving, the writes so far are flushed together
+    if (enabled && !memory_p->enable_ram){
+        flush_battery_save(memory_p);
+    }
+    map_memory_banks(memory_p);
+}
+
+// bank 0 is read from the memory map, it's the one patched by the boot and the tests
+static void set_rom0_bank(memory_map *memory_p, word bank){
+    memory_p->current_rom0_bank = bank % memory_p->cartridge_p->rom_banks;
+    memory_p->mbc.rom0_bank_p = (memory_p->current_rom0_bank == 0) ? memory_p->memory : &memory_p->cartridge_p->cartridge_memory[memory_p->current_rom0_bank * BANK_SIZE];
+}
+
+// banks past the end of the ROM wrap around like on the MBC
+static void set_rom_bank(memory_map *memory_p, word bank){
+    memory_p->current_rom_bank = bank % memory_p->cartridge_p->rom_banks;
+    memory_p->mbc.rom_bank_p = &memory_p->cartridge_p->cartridge_memory[memory_p->current_rom_bank * BANK_SIZE];
+}
+
+static void set_ram_bank(memory_map *memory_p, byte bank){
+    byte ram_banks = memory_p->cartridge_p->ram_banks;
+    memory_p->current_ram_bank = (ram_banks > 1) ? bank % ram_banks : 0;
+    memory_p->mbc.ram_bank_p = &memory_p->ram_banks[memory_p->current_ram_bank * EXTERNAL_RAM_SIZE];
+    memory_p->mbc.ram_bank_size = EXTERNAL_RAM_SIZE;
+    memory_p->mbc.ram_direct = TRUE;
+}
+
+static void switch_banks(memory_map *memory_p){
+    memory_p->mbc.update_banks(memory_p);
+    map_memory_banks(memory_p);
+}
@@ -0,0 +1,45 @@
+#ifndef __MBC_H__
+#define __MBC_H__
+
+#include <time.h>
+#include "environment.h"
+
+// MBC3 clock registers, selected by writing 0x08 - 0x0C to 0x4000 - 0x5FFF
+#define RTC_SECONDS 0
+#define RTC_MINUTES 1
+#define RTC_HOURS 2
+#define RTC_DAY_LOW 3
+#define RTC_DAY_HIGH 4 // bit 0 : day bit 8, bit 6 : halt, bit 7 : day counter carry
+#define RTC_REGISTERS 5
+
+typedef struct memory_map memory_map;
+
+/*
+    memory bank controller of the cartridge
+    the handlers are picked from the cartridge type, every write to the MBC registers
+    recomputes the base pointers of the three banked windows and repoints their pages
+    so reads never have to multiply the bank number again.
+*/
+typedef struct mbc{
+    void (*write_control)(memory_map *memory_p, word address, byte data); // 0x0000 - 0x7FFF
+    void (*write_ram)(memory_map *memory_p, word address, byte data); // 0xA000 - 0xBFFF when it isn't written directly
+    void (*update_banks)(memory_map *memory_p);
+    byte bank_low; // MBC1 BANK1 (5 bits), MBC3 ROM bank (7 bits), MBC5 ROM bank bits 0-7
+    byte bank_high; // MBC1 BANK2 (2 bits), MBC5 ROM bank bit 8
+    byte ram_select; // RAM bank, or the RTC register on MBC3
+    byte latch; // last value written to the MBC3 latch
+    byte rtc[RTC_REGISTERS];
+    byte rtc_latched[RTC_REGISTERS];
+    time_t rtc_time; // host time the clock registers were last brought up to date
+    byte rtc_page[0x100]; // latched register seen through the external RAM window
+    // base pointers of the banked windows
+    byte *rom0_bank_p;
+    byte *rom_bank_p;
+    byte *ram_bank_p;
+    word ram_bank_size; // the window mirrors ram_bank_p every ram_bank_size bytes
+    bool ram_direct; // FALSE when every RAM write has to go through write_ram
+} mbc;
+
+void initialize_mbc(memory_map *memory_p);
+void update_rtc(mbc *mbc_p, time_t now);
+#endif
@@ -1,4 +1,7 @@
 #include "memory.h"
+#include "trace.h"
+#include "scheduler.h"
+#include "save.h"
 
 #define BANK0_INDEX 0x0000
 #define SWITCHING_BANK_INDEX 0x4000
@@ -6,6 +9,7 @@
 #define ROM_SIZE 0x8000
 #define VRAM_INDEX 0x8000
 #define VRAM_SIZE 0x2000
+#define TILE_MAP_INDEX 0x9800
 #define EXTERNAL_RAM_INDEX 0xA000
 #define EXTERNAL_RAM_SIZE 0x2000
 #define WRAM_INDEX 0xC000
@@ -15,64 +19,174 @@
 #define IO_PORTS_INDEX 0xFF00
 #define HRAM_INDEX 0xFF80
 #define INTERRUPT_ENABLE_REGISTER 0xFFFF
+#define DMA_CYCLES 640
+#define DMA_LENGTH 0xA0
+#define DMA_BYTE_CYCLES 4
 
 static void load_rom_to_memory_map(memory_map *memory_p);
+static void map_pages(byte **pages, word address, int size, byte *host_p);
+static void write_memory_handler(memory_map *memory_p, word address, byte data);
 static void print_memory(memory_map *memory_p, word address, word printSize);
-static void handle_bank_switching(memory_map *memory_p, word address, byte byte);
-static void enable_ram_bank(memory_map *memory_p, word address, byte data, byte mbc_type);
-static void switch_rom_bank_low(memory_map *memory_p, byte data, byte mbc_type);
-static void switch_rom_bank_high(memory_map *memory_p, byte data);
-static void switch_ram_bank(memory_map *memory_p, byte data);
-static void select_rom_ram_mode(memory_map *memory_p, byte data);
 static void dma_transfer(memory_map *memory_p, byte data);
+static void lock_dma_bus(memory_map *memory_p);
+static void log_raster_write(memory_map *memory_p, byte *target_p, byte data);
+static void log_video_write(memory_map *memory_p, byte *target_p, byte data);
+
+// what the CPU reads outside of HRAM while a timed DMA owns the bus, shared by every instance so it's never written
+static const byte open_bus_page[PAGE_SIZE] = { [0 ... PAGE_SIZE - 1] = 0xFF };
 
 memory_map *initialize_memory(cartridge *cartride_p){
     
     memory_map * memory_p = calloc(sizeof(memory_map), 1); 
     memory_p->cartridge_p = cartride_p;
-    memory_p->current_rom_bank = 1;
-    memory_p->current_ram_bank = 0;
+    memory_p->ram_banks = calloc(RAM_BANK_SIZE, 1);
     load_rom_to_memory_map(memory_p);
+    initialize_mbc(memory_p);
+    invalidate_tile_cache(&memory_p->tile_cache);
+    invalidate_plane_cache(&memory_p->plane_cache);
+    memory_p->sprite_cache.dirty = TRUE;
+    refresh_palettes(&memory_p->palettes, &memory_p->memory[BACKGROUND_PALETTE]);
+    map_memory_pages(memory_p);
     //print_memory(memory_p, BANK0_INDEX, 300);
 
     return memory_p;
 }
 
+// the battery save is written back before the RAM goes away
+void free_memory(memory_map *memory_p){
+
+    if (memory_p == NULL){
+        return;
+    }
+    if (memory_p->save_p != NULL){
+        detach_battery_save(memory_p);
+    } else {
+        free(memory_p->ram_banks);
+    }
+    free(memory_p);
+}
+
 byte read_memory(memory_map *memory_p, word address){
-    // reading from ROM switching memory bank
-    if ((address >= 0x4000) && (address <= 0x7FFF)){
-        word new_address = address - 0x4000;
-        //printf("\n READ MEMORY --- CURRENT ROM BANK : %u\n", memory_p->current_rom_bank);
-        return memory_p->cartridge_p->cartridge_memory[new_address + (memory_p->current_rom_bank * 0x4000)];
-    }
-    // reading from External RAM memory bank
-    else if ((address >= 0xA000) && (address <= 0xBFFF)){
-        word new_address = address - 0xA000;
-        //printf("\n READ MEMORY --- CURRENT RAM BANK : %u\n", memory_p->current_ram_bank);
-        return memory_p->ram_banks[new_address + (memory_p->current_ram_bank * 0x2000)];
-    }
-    return memory_p->memory[address];
+    // every page can be read directly, the switchable ROM and RAM banks are repointed on bank switches
+    return memory_p->read_pages[address >> 8][address & 0xFF];
 }
 
 void write_memory(memory_map *memory_p, word address, byte data){
-    printf("Write 0x%02X to memory at 0x%04X\n", data, address);
+    TRACE_LOG(TRACE_LEVEL_DEBUG, TRACE_MEMORY, TRACE_WRITE_MEMORY, address, data);
+    byte *page_p = memory_p->write_pages[address >> 8];
+    if (page_p != NULL){
+        page_p[address & 0xFF] = data;
+        return;
+    }
+    write_memory_handler(memory_p, address, data);
+}
+
+/*
+    rebuild both page tables from the current banks
+        - BANK0, VRAM, WRAM, OAM, I/O and HRAM are read from memory
+        - the banked windows point where the MBC says, see map_memory_banks
+        - echo RAM reads WRAM, its writes go through the handler to update both copies
+        - WRAM is always written directly, external RAM only while it's enabled and direct,
+          battery backed pages once they are dirty
+        - VRAM tile data and tile map writes go through the handler to update the tile and plane caches
+*/
+void map_memory_pages(memory_map *memory_p){
+
+    map_pages(memory_p->read_pages, 0x0000, 0x10000, memory_p->memory);
+    map_pages(memory_p->read_pages, WRAM_ECHO_INDEX, 0x1E00, &memory_p->memory[WRAM_INDEX]);
+
+    memset(memory_p->write_pages, 0, sizeof(memory_p->write_pages));
+    map_pages(memory_p->write_pages, WRAM_INDEX, WRAM_SIZE, &memory_p->memory[WRAM_INDEX]);
+
+    // the base pointers are rebuilt too, they point inside this memory map
+    memory_p->mbc.update_banks(memory_p);
+    map_memory_banks(memory_p);
+}
+
+static void map_pages(byte **pages, word address, int size, byte *host_p){
+    for (int page = 0; page < (size / PAGE_SIZE); page++){
+        pages[(address / PAGE_SIZE) + page] = (host_p == NULL) ? NULL : host_p + (page * PAGE_SIZE);
+    }
+}
+
+/*
+    repoint the three banked windows from the base pointers the MBC computed,
+    external RAM mirrors its bank when it's smaller than the window (MBC2, MBC3 clock)
+*/
+void map_memory_banks(memory_map *memory_p){
+
+    mbc *mbc_p = &memory_p->mbc;
+    map_pages(memory_p->read_pages, BANK0_INDEX, BANK_SIZE, mbc_p->rom0_bank_p);
+    map_pages(memory_p->read_pages, SWITCHING_BANK_INDEX, BANK_SIZE, mbc_p->rom_bank_p);
+    if (memory_p->boot_rom_p != NULL){
+        map_pages(memory_p->read_pages, BANK0_INDEX, BOOT_ROM_SIZE, memory_p->boot_rom_p);
+    }
+
+    byte *write_p = (memory_p->enable_ram && mbc_p->ram_direct) ? mbc_p->ram_bank_p : NULL;
+    for (int offset = 0; offset < EXTERNAL_RAM_SIZE; offset += mbc_p->ram_bank_size){
+        map_pages(memory_p->read_pages, EXTERNAL_RAM_INDEX + offset, mbc_p->ram_bank_size, mbc_p->ram_bank_p);
+        map_pages(memory_p->write_pages, EXTERNAL_RAM_INDEX + offset, mbc_p->ram_bank_size, write_p);
+    }
+
+    // battery backed pages stay unmapped until a write marks them dirty
+    if (memory_p->save_p != NULL && write_p != NULL){
+        for (int page = EXTERNAL_RAM_INDEX / PAGE_SIZE; page < (EXTERNAL_RAM_INDEX + EXTERNAL_RAM_SIZE) / PAGE_SIZE; page++){
+            if (!memory_p->save_p->dirty[(memory_p->write_pages[page] - memory_p->ram_banks) / PAGE_SIZE]){
+                memory_p->write_pages[page] = NULL;
+            }
+        }
+    }
+}
+
+// the boot ROM hides the start of BANK0 until it unmaps itself, the CPU starts at 0x0000
+void map_boot_rom(memory_map *memory_p, byte *boot_rom_p){
+    memory_p->boot_rom_p = boot_rom_p;
+    map_memory_banks(memory_p);
+}
+
+// I/O registers, MBC control, echo RAM and restricted areas
+static void write_memory_handler(memory_map *memory_p, word address, byte data){
+    // a timed DMA owns the bus, only HRAM and the I/O registers can be written
+    if (memory_p->dma_active && (memory_p->dma_mode == DMA_TIMED) && (address < IO_PORTS_INDEX)){
+        return;
+    }
     // addresses 0x0000 - 0x8000 {BANK0, switching BANK N} are read-only memory
     if (address < 0x8000){
         //printf("\n WRITE MEMORY --- BANK SWITCHING\n");
-        handle_bank_switching(memory_p, address, data);
+        memory_p->mbc.write_control(memory_p, address, data);
+    }
+    // VRAM tile data, the tile is decoded again before the next scanline
+    else if (address < TILE_MAP_INDEX){
+        log_video_write(memory_p, &memory_p->memory[address], data);
+        memory_p->memory[address] = data;
+        mark_tile_dirty(&memory_p->tile_cache, address);
+    }
+    // VRAM tile maps, only the cell of the byte is drawn again
+    else if (address < EXTERNAL_RAM_INDEX){
+        if (memory_p->memory[address] != data){
+            log_video_write(memory_p, &memory_p->memory[address], data);
+            memory_p->memory[address] = data;
+            mark_cell_dirty(&memory_p->plane_cache, address);
+        }
     }
-    // writing in external RAM bank
+    // external RAM is unmapped while it's disabled or when the MBC has to see the writes
     else if ((address >= 0xA000) && (address < 0xC000)){
-        if (memory_p->enable_ram){
-            word new_address = address - 0xA000;
-            memory_p->ram_banks[new_address + (memory_p->current_ram_bank * 0x2000)] = data;
+        mbc *mbc_p = &memory_p->mbc;
+        // first write to a battery backed page since the last flush
+        if (memory_p->save_p != NULL && memory_p->enable_ram && mbc_p->ram_direct){
+            byte *ram_p = mbc_p->ram_bank_p + (address - EXTERNAL_RAM_INDEX);
+            mark_save_dirty(memory_p, ram_p - memory_p->ram_banks);
+            memory_p->write_pages[address >> 8] = ram_p - (address & 0xFF);
+            *ram_p = data;
+            return;
         }
+        mbc_p->write_ram(memory_p, address, data);
     }
     // addresses 0xE000 - 0xFE00 are echoed with addresses 0xC000-0xE000 (Internal RAM)
     else if ((address >= 0xE000) && (address < 0xFE00)){
         memory_p->memory[address] = data;
         //printf("\n WRITE MEMORY --- ECHO\n");
-        write_memory(memory_p, (address - 0x2000), data);
+        memory_p->memory[address - 0x2000] = data;
     }
 
     else if (address == 0xFF04){
@@ -86,6 +200,31 @@ void write_memory(memory_map *memory_p, word address, byte data){
     else if (address == 0xFF46){
         dma_transfer(memory_p, data);
     }
+
+    else if (address == BOOT_ROM_DISABLE_INDEX){
+        memory_p->memory[address] = data;
+        if (data != 0 && memory_p->boot_rom_p != NULL){
+            map_boot_rom(memory_p, NULL);
+        }
+    }
+
+    // registers the PPU reads while drawing
+    else if ((address == LCDC_INDEX) || (address == SCROLL_Y_INDEX) || (address == SCROLL_X_INDEX) || (address == WINDOW_Y_INDEX) || (address == WINDOW_X_INDEX)){
+        log_raster_write(memory_p, &memory_p->memory[address], data);
+        memory_p->memory[address] = data;
+    }
+
+    else if ((address >= BACKGROUND_PALETTE) && (address <= SPRITE_PALETTE_2)){
+        log_raster_write(memory_p, &memory_p->memory[address], data);
+        memory_p->memory[address] = data;
+        write_palette(&memory_p->palettes, address - BACKGROUND_PALETTE, data);
+    }
+    // OAM, the sprite lines are built again before the next scanline
+    else if ((address >= OAM_INDEX) && (address < OAM_INDEX + DMA_LENGTH)){
+        log_video_write(memory_p, &memory_p->memory[address], data);
+        memory_p->memory[address] = data;
+        memory_p->sprite_cache.dirty = TRUE;
+    }
     // addresses 0xFEA0 - 0xFEFF {OAM, I/O, HRAM} are restricted
     else if ((address >= 0xFEA0) && (address < 0xFEFF)){
         return;
@@ -97,118 +236,90 @@ void write_memory(memory_map *memory_p, word address, byte data){
 
 static void load_rom_to_memory_map(memory_map *memory_p){
       // load BANK0 in 0x0000 - 0x3FFF and BANK1 in 0x4000 - 0x7FFFF
-    if (memory_p->cartridge_p->cartridge_type == 0){
-        memcpy(&memory_p->memory, &memory_p->cartridge_p->cartridge_memory, BANK_SIZE * 2);
+    if (memory_p->cartridge_p->cartridge_type == GAMEBOY){
+        memcpy(&memory_p->memory, memory_p->cartridge_p->cartridge_memory, BANK_SIZE * 2);
     }
     // only load BANK0 in 0x000 - 0x3FFF
-    else if (memory_p->cartridge_p->cartridge_type == 1 || memory_p->cartridge_p->cartridge_type == 2){
-        memcpy(&memory_p->memory, &memory_p->cartridge_p->cartridge_memory, BANK_SIZE);
+    else {
+        memcpy(&memory_p->memory, memory_p->cartridge_p->cartridge_memory, BANK_SIZE);
     }
 }
 
-static void handle_bank_switching(memory_map *memory_p, word address, byte data){
-    
-    byte mbc_type = memory_p->cartridge_p->cartridge_type;
-    // RAM bank switching Enabling
-    if (address < 0x2000){
-        if (mbc_type == MBC1 || mbc_type == MBC2){
-            enable_ram_bank(memory_p, address, data, mbc_type);
-        }
+/*
+    in mode 2 of LCD, dma copies data to the OAM without the main program doing it.
+    the source page is resolved once, the fast mode copies it straight away and only
+    lets the scheduler track when the transfer would end. the timed mode copies a byte
+    every M-cycle from dma_event and locks the bus until the transfer is done.
+*/
+static void dma_transfer(memory_map *memory_p, byte data){
+    // restarting a timed transfer, the source must be resolved from the unlocked pages
+    if (memory_p->dma_active && (memory_p->dma_mode == DMA_TIMED)){
+        map_memory_pages(memory_p);
     }
+    memory_p->dma_source_p = memory_p->read_pages[data];
+    memory_p->dma_index = 0;
 
-    // ROM bank switching
-    else if ((address >= 0x2000) && (address < 0x4000)){
-        if (mbc_type == MBC1 || mbc_type == MBC2){
-            switch_rom_bank_low(memory_p, data, mbc_type);
-        }
+    if ((memory_p->dma_mode == DMA_TIMED) && (memory_p->scheduler_p != NULL)){
+        memory_p->dma_active = TRUE;
+        lock_dma_bus(memory_p);
+        schedule_event(memory_p->scheduler_p, EVENT_DMA, memory_p->scheduler_p->cycles + DMA_BYTE_CYCLES);
+        return;
     }
 
-    // ROM or RAM bank switching for MBC1
-    else if ((address >= 0x4000) && (address < 0x6000)){
-        if (mbc_type == MBC1){
-            if (memory_p->rom_banking){
-                switch_rom_bank_high(memory_p, data);
-            }
-            else {
-                switch_ram_bank(memory_p, data);
-            }
+    if (memcmp(&memory_p->memory[OAM_INDEX], memory_p->dma_source_p, DMA_LENGTH) != 0){
+        if (memory_p->raster_log.deferring){
+            memory_p->raster_log.flush(memory_p->raster_log.context_p);
         }
+        memory_p->video_generation++;
     }
+    memcpy(&memory_p->memory[OAM_INDEX], memory_p->dma_source_p, DMA_LENGTH);
+    memory_p->dma_index = DMA_LENGTH;
+    memory_p->sprite_cache.dirty = TRUE;
 
-    // this will change if ROM or RAM banking is done on the above if statement
-    // this changes the MBC1 mode from either 16/8 or 4/32
-    else if ((address >= 0x6000) && (address < 0x8000)){
-        if (mbc_type == MBC1){
-            select_rom_ram_mode(memory_p, data);
-        }
+    if (memory_p->scheduler_p != NULL){
+        memory_p->dma_active = TRUE;
+        schedule_event(memory_p->scheduler_p, EVENT_DMA, memory_p->scheduler_p->cycles + DMA_CYCLES);
     }
 }
 
-static void enable_ram_bank(memory_map *memory_p, word address, byte data, byte mbc_type){
-    
-    if (mbc_type == MBC2){
-        // additional clause that bit 4 of address must be 0 for MBC2
-        if (TEST_BIT(address, 4) == 1){
+void dma_event(memory_map *memory_p, unsigned long long timestamp){
+    if (memory_p->dma_index < DMA_LENGTH){
+        log_video_write(memory_p, &memory_p->memory[OAM_INDEX + memory_p->dma_index], memory_p->dma_source_p[memory_p->dma_index]);
+        memory_p->memory[OAM_INDEX + memory_p->dma_index] = memory_p->dma_source_p[memory_p->dma_index];
+        memory_p->dma_index++;
+        memory_p->sprite_cache.dirty = TRUE;
+        if (memory_p->dma_index < DMA_LENGTH){
+            schedule_event(memory_p->scheduler_p, EVENT_DMA, timestamp + DMA_BYTE_CYCLES);
             return;
         }
-    }
-
-    byte enable_ram_select = data & 0xF;
-    if (enable_ram_select == 0xA){
-        memory_p->enable_ram = TRUE;
-    }
-    else if (enable_ram_select == 0){
-        memory_p->enable_ram = FALSE;
-    }
-}
-
-static void switch_rom_bank_low(memory_map *memory_p, byte data, byte mbc_type){
-    // data (XXXXBBBB) need to grab bits 0-3 for MBC2
-    if (mbc_type == MBC2){
-        memory_p->current_rom_bank = data & 0xF;
+        // transfer done, give the bus back to the CPU
+        memory_p->dma_active = FALSE;
+        map_memory_pages(memory_p);
         return;
     }
-
-    // data (XXXBBBBB) need to grab bits 0-4 for MBC1
-    byte mbc1_bank = data & 31;
-    // need to keep bit 5-7 bits while switching bank
-    memory_p->current_rom_bank &= 224;
-    memory_p->current_rom_bank |= mbc1_bank;
-    // ROM select 0 and 1 will pick first bank
-    if (memory_p->current_rom_bank == 0){
-        memory_p->current_rom_bank++;
-    }
+    memory_p->dma_active = FALSE;
 }
 
-static void switch_rom_bank_high(memory_map *memory_p, byte data){
-    // select ROM bank based on the bit 4 and 5
-    // turn off upper 3 bits of current ROM bank
-    memory_p->current_rom_bank &= 31;
-
-    // turn off the lower 5 bits of the data
-    data &= 224;
-    memory_p->current_rom_bank |= data;
-    if (memory_p->current_rom_bank == 0){
-        memory_p->current_rom_bank++;
+// everything below the I/O registers reads as open bus, writes go through the handler which drops them
+static void lock_dma_bus(memory_map *memory_p){
+    for (int page = 0; page < (IO_PORTS_INDEX / PAGE_SIZE); page++){
+        memory_p->read_pages[page] = (byte *) open_bus_page;
     }
+    memset(memory_p->write_pages, 0, sizeof(memory_p->write_pages));
 }
 
-static void switch_ram_bank(memory_map *memory_p, byte data){
-    memory_p->current_ram_bank = data & 0x03;
-}
-
-static void select_rom_ram_mode(memory_map *memory_p, byte data){
-    memory_p->rom_banking = ((data & 0x1) == 0) ? TRUE : FALSE;
-    if (memory_p->rom_banking){
-        memory_p->current_ram_bank = 0;
+// a write that changes something the deferred lines read, they're drawn before it lands
+static void log_raster_write(memory_map *memory_p, byte *target_p, byte data){
+    if (memory_p->raster_log.deferring && *target_p != data){
+        memory_p->raster_log.flush(memory_p->raster_log.context_p);
     }
 }
 
-// in mode 2 of LCD, dma copies data to the OAM without the main program doing it.
-static void dma_transfer(memory_map *memory_p, byte data){
-    word address = data << 8; // multiply by 2^8
-    for (int i = 0 ; i < 0xA0; i++){
-        write_memory(memory_p, 0xFE00+i, read_memory(memory_p, address +i));
+// VRAM and OAM, a render thread copies them again when the generation moved
+static void log_video_write(memory_map *memory_p, byte *target_p, byte data){
+    if (*target_p != data){
+        log_raster_write(memory_p, target_p, data);
+        memory_p->video_generation++;
     }
 }
 
@@ -3,9 +3,14 @@
 
 #include "environment.h"
 #include "cartridge.h"
+#include "mbc.h"
+#include "tile_cache.h"
+#include "plane_cache.h"
+#include "sprite_cache.h"
+#include "palette.h"
 
 #define MEMORY_SIZE 0x10000 
-#define RAM_BANK_SIZE 0x8000
+#define RAM_BANK_SIZE 0x20000 // up to 16 banks of 8 KB on MBC5
 
 #define INTERRUPT_ENABLE_INDEX 0xFFFF
 #define INTERRUPT_REQUEST_INDEX 0xFF0F
@@ -23,7 +28,7 @@
 #define SCROLL_Y_INDEX 0xFF42
 #define SCROLL_X_INDEX 0xFF43
 #define WINDOW_Y_INDEX 0xFF4A
-#define WINDOW_X_INDEX 0xFF48
+#define WINDOW_X_INDEX 0xFF4B
 
 #define TILE_SIZE 16
 #define VRAM_INDEX 0x8000
@@ -34,19 +39,74 @@
 
 #define OAM_INDEX 0xFE00
 
+// the bus is split in 256 pages of 256 bytes
+#define PAGE_COUNT 0x100
+#define PAGE_SIZE 0x100
+
+// the boot ROM covers 0x0000 - 0x00FF until a non zero write to 0xFF50
+#define BOOT_ROM_SIZE 0x100
+#define BOOT_ROM_DISABLE_INDEX 0xFF50
+
+// OAM DMA modes
+#define DMA_FAST 0 // the 160 bytes are copied at once when 0xFF46 is written
+#define DMA_TIMED 1 // one byte every M-cycle, the CPU can only reach HRAM meanwhile
+
+typedef struct scheduler scheduler;
+typedef struct battery_save battery_save;
+
+/*
+    writes that change what the PPU draws : LCDC, SCY, SCX, WY, WX, the palettes, VRAM and OAM
+    while the PPU defers the visible lines of a frame, the first of them calls flush so the
+    deferred lines are rendered with the values they were due with before the write lands
+*/
+typedef struct raster_log{
+    bool deferring;
+    byte deferred_lines; // lines 0 to deferred_lines - 1 are due but not drawn
+    unsigned long fast_frames; // rendered in one pass at V-BLANK
+    unsigned long slow_frames; // fell back to line by line after a write
+    void (*flush)(void *context_p);
+    void *context_p;
+} raster_log;
+
 typedef struct memory_map{
     cartridge *cartridge_p;
     byte memory[MEMORY_SIZE];
-    byte ram_banks[RAM_BANK_SIZE];
-    byte current_rom_bank;
+    byte *ram_banks; // RAM_BANK_SIZE bytes, or the mapped .sav file of battery backed cartridges
+    word current_rom0_bank; // bank seen in 0x0000 - 0x3FFF, only MBC1 mode 1 maps another one than 0
+    word current_rom_bank; // bank seen in 0x4000 - 0x7FFF
     byte current_ram_bank; // ram banking not used in MBC2
     byte enable_ram;
-    byte rom_banking;
+    byte rom_banking; // MBC1 mode 0
+    mbc mbc;
+    tile_cache tile_cache; // decoded copy of the VRAM tile data
+    plane_cache plane_cache; // tile maps drawn from the tile cache
+    sprite_cache sprite_cache; // sprites of every line, parsed from OAM
+    palette_tables palettes;
+    raster_log raster_log;
+    unsigned long video_generation; // bumped by every write that changes VRAM or OAM
+    byte dma_active; // cleared by the scheduler when the OAM DMA would be done
+    byte dma_mode;
+    byte *dma_source_p; // source page resolved when the transfer starts
+    word dma_index; // next byte copied by a timed transfer
+    scheduler *scheduler_p;
+    battery_save *save_p;
+    byte *boot_rom_p; // BOOT_ROM_SIZE bytes owned by the caller, NULL once the boot ROM is unmapped
+    /*
+        host pointer of every page, NULL pages go through the I/O, MBC and restricted area handlers
+        the pointers are only valid for this memory map, call map_memory_pages after copying one
+    */
+    byte *read_pages[PAGE_COUNT];
+    byte *write_pages[PAGE_COUNT];
 } memory_map;
 
 memory_map *initialize_memory(cartridge *cartride_p);
+void free_memory(memory_map *memory_p);
 byte read_memory(memory_map *memory_p, word address);
 void write_memory(memory_map *memory_p, word address, byte byte);
+void map_memory_pages(memory_map *memory_p);
+void map_memory_banks(memory_map *memory_p);
+void map_boot_rom(memory_map *memory_p, byte *boot_rom_p);
+void dma_event(memory_map *memory_p, unsigned long long timestamp);
 void print_vram_memory(memory_map *memory_p);
 void print_tile_map_0(memory_map *memory_p);
 void test_nintendo_logo(memory_map *memory_p);
@@ -0,0 +1,38 @@
+#include "palette.h"
+
+// RGBA of the 4 shades, lightest first
+const byte color_schemes[COLOR_SCHEME_COUNT][4][4] = {
+    { { 0xFF, 0xFF, 0xFF, 0xFF }, { 0xCC, 0xCC, 0xCC, 0xFF }, { 0x77, 0x77, 0x77, 0xFF }, { 0x00, 0x00, 0x00, 0xFF } },
+    { { 0x9B, 0xBC, 0x0F, 0xFF }, { 0x8B, 0xAC, 0x0F, 0xFF }, { 0x30, 0x62, 0x30, 0xFF }, { 0x0F, 0x38, 0x0F, 0xFF } },
+    { { 0xC4, 0xCF, 0xA1, 0xFF }, { 0x8B, 0x95, 0x6D, 0xFF }, { 0x4D, 0x53, 0x3C, 0xFF }, { 0x1F, 0x1F, 0x1F, 0xFF } }
+};
+
+// color number n takes the shade in bits 2n + 1 and 2n of the register
+void write_palette(palette_tables *palettes_p, int palette, byte data){
+
+    const byte (*scheme)[4] = color_schemes[palettes_p->color_scheme];
+    palettes_p->registers[palette] = data;
+
+    for (int color = 0; color < 4; color++){
+        byte shade = (data >> (color * 2)) & 0x3;
+        palettes_p->shades[palette][color] = shade;
+        memcpy(&palettes_p->rgba[palette][color], scheme[shade], 4);
+        palettes_p->channels[palette][color] = scheme[shade][0];
+        palettes_p->channels[palette][4 + color] = scheme[shade][1];
+        palettes_p->channels[palette][8 + color] = scheme[shade][2];
+    }
+}
+
+// registers_p points to BGP, for registers that were set without going through write_memory
+void refresh_palettes(palette_tables *palettes_p, byte *registers_p){
+    for (int palette = 0; palette < PALETTE_COUNT; palette++){
+        write_palette(palettes_p, palette, registers_p[palette]);
+    }
+}
+
+void set_color_scheme(palette_tables *palettes_p, byte color_scheme){
+    palettes_p->color_scheme = (color_scheme < COLOR_SCHEME_COUNT) ? color_scheme : COLOR_SCHEME_GRAY;
+    for (int palette = 0; palette < PALETTE_COUNT; palette++){
+        write_palette(palettes_p, palette, palettes_p->registers[palette]);
+    }
+}
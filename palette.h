@@ -0,0 +1,35 @@
+#ifndef __PALETTE_H__
+#define __PALETTE_H__
+
+#include "environment.h"
+
+// BGP, OBP0 and OBP1 in register order
+#define PALETTE_BACKGROUND 0
+#define PALETTE_SPRITE_1 1
+#define PALETTE_SPRITE_2 2
+#define PALETTE_COUNT 3
+
+// colors the 4 shades are displayed with
+#define COLOR_SCHEME_GRAY 0
+#define COLOR_SCHEME_GREEN 1 // original DMG screen
+#define COLOR_SCHEME_POCKET 2
+#define COLOR_SCHEME_COUNT 3
+
+/*
+    palette registers resolved to output colors, rebuilt when BGP / OBP0 / OBP1 are written
+    so a pixel only takes one indexed load from its color number
+*/
+typedef struct palette_tables{
+    byte color_scheme;
+    byte registers[PALETTE_COUNT];
+    byte shades[PALETTE_COUNT][4]; // 0 lightest - 3 darkest
+    uint32_t rgba[PALETTE_COUNT][4]; // R, G, B, A bytes in memory order
+    byte channels[PALETTE_COUNT][16]; // red of colors 0-3, then green, then blue, for byte shuffles
+} palette_tables;
+
+extern const byte color_schemes[COLOR_SCHEME_COUNT][4][4];
+
+void write_palette(palette_tables *palettes_p, int palette, byte data);
+void refresh_palettes(palette_tables *palettes_p, byte *registers_p);
+void set_color_scheme(palette_tables *palettes_p, byte color_scheme);
+#endif
@@ -0,0 +1,71 @@
+#include "plane_cache.h"
+
+#define TILE_MAP_INDEX 0x9800
+
+static void push_dirty_cell(plane_cache *cache_p, int cell);
+static void draw_cell(plane_cache *cache_p, tile_cache *tiles_p, int cell, byte map_byte);
+
+// address is a tile map address in 0x9800 - 0x9FFF
+void mark_cell_dirty(plane_cache *cache_p, word address){
+    push_dirty_cell(cache_p, address - TILE_MAP_INDEX);
+}
+
+// the tile maps were changed without going through write_memory
+void invalidate_plane_cache(plane_cache *cache_p){
+    for (int cell = 0; cell < PLANE_COUNT * PLANE_CELLS; cell++){
+        push_dirty_cell(cache_p, cell);
+    }
+}
+
+/*
+    tile_map_p points to 0x9800 in memory, the tile cache must be up to date
+    the whole maps are only compared when tiles were decoded since the last update
+*/
+void update_plane_cache(plane_cache *cache_p, tile_cache *tiles_p, byte *tile_map_p, bool unsigned_tiles){
+
+    if (unsigned_tiles != cache_p->unsigned_tiles){
+        cache_p->unsigned_tiles = unsigned_tiles;
+        invalidate_plane_cache(cache_p);
+    }
+
+    if (tiles_p->decoded_tiles != cache_p->seen_tiles){
+        for (int cell = 0; cell < PLANE_COUNT * PLANE_CELLS; cell++){
+            byte map_byte = tile_map_p[cell];
+            word tile = unsigned_tiles ? map_byte : 256 + (signed_byte) map_byte;
+            if (map_byte != cache_p->cell_tiles[cell] || tiles_p->generations[tile] != cache_p->cell_generations[cell]){
+                push_dirty_cell(cache_p, cell);
+            }
+        }
+        cache_p->seen_tiles = tiles_p->decoded_tiles;
+    }
+
+    while (cache_p->dirty_count > 0){
+        int cell = cache_p->dirty_cells[--cache_p->dirty_count];
+        cache_p->dirty[cell] = FALSE;
+        draw_cell(cache_p, tiles_p, cell, tile_map_p[cell]);
+    }
+}
+
+static void push_dirty_cell(plane_cache *cache_p, int cell){
+    if (!cache_p->dirty[cell]){
+        cache_p->dirty[cell] = TRUE;
+        cache_p->dirty_cells[cache_p->dirty_count++] = cell;
+    }
+}
+
+static void draw_cell(plane_cache *cache_p, tile_cache *tiles_p, int cell, byte map_byte){
+
+    // 0x8800 addressing uses signed tile numbers, tile 0 is at 0x9000
+    word tile = cache_p->unsigned_tiles ? map_byte : 256 + (signed_byte) map_byte;
+    int plane = cell / PLANE_CELLS;
+    int x = (cell % 32) * 8;
+    int y = ((cell % PLANE_CELLS) / 32) * 8;
+
+    for (int row = 0; row < 8; row++){
+        memcpy(&cache_p->pixels[plane][y + row][x], tiles_p->pixels[tile][row], 8);
+    }
+    cache_p->cell_tiles[cell] = map_byte;
+    cache_p->cell_generations[cell] = tiles_p->generations[tile];
+    cache_p->frame_cells++;
+    cache_p->drawn_cells++;
+}
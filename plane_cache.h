@@ -0,0 +1,32 @@
+#ifndef __PLANE_CACHE_H__
+#define __PLANE_CACHE_H__
+
+#include "environment.h"
+#include "tile_cache.h"
+
+#define PLANE_SIZE 256
+#define PLANE_COUNT 2 // tile maps at 0x9800 and 0x9C00
+#define PLANE_CELLS (32 * 32)
+
+/*
+    both tile maps drawn as 256x256 color numbers, a background or window line is a wrapped copy of a plane row.
+    a cell is drawn again when its map byte is written, when the tile it shows is decoded again
+    or when LCDC switches the tile data addressing. cells are indexed by their offset from 0x9800.
+*/
+typedef struct plane_cache{
+    byte pixels[PLANE_COUNT][PLANE_SIZE][PLANE_SIZE];
+    byte cell_tiles[PLANE_COUNT * PLANE_CELLS]; // map byte each cell was drawn from
+    unsigned long cell_generations[PLANE_COUNT * PLANE_CELLS]; // generation of the tile each cell was drawn from
+    byte dirty[PLANE_COUNT * PLANE_CELLS];
+    word dirty_cells[PLANE_COUNT * PLANE_CELLS];
+    int dirty_count;
+    bool unsigned_tiles; // 0x8000 addressing, the tile data the cells were drawn with
+    unsigned long seen_tiles; // decoded_tiles of the tile cache at the last update
+    unsigned long frame_cells; // cells drawn since the start of the frame
+    unsigned long drawn_cells;
+} plane_cache;
+
+void mark_cell_dirty(plane_cache *cache_p, word address);
+void invalidate_plane_cache(plane_cache *cache_p);
+void update_plane_cache(plane_cache *cache_p, tile_cache *tiles_p, byte *tile_map_p, bool unsigned_tiles);
+#endif
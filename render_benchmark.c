@@ -0,0 +1,93 @@
+/*
+    scanline renderer benchmark, the per pixel loop against render_background
+
+    build it once per instruction set to compare the vector paths :
+        gcc -O2 render_benchmark.c renderer.c render_thread.c gameboy.c cpu.c block_cache.c jit.c trace.c scheduler.c memory.c mbc.c save.c tile_cache.c plane_cache.c sprite_cache.c palette.c framebuffer.c cartridge.c rom_registry.c -lpthread -o render_benchmark            (sse2 on x86-64)
+        gcc -O2 -mssse3 render_benchmark.c renderer.c render_thread.c gameboy.c cpu.c block_cache.c jit.c trace.c scheduler.c memory.c mbc.c save.c tile_cache.c plane_cache.c sprite_cache.c palette.c framebuffer.c cartridge.c rom_registry.c -lpthread -o render_benchmark    (ssse3)
+        gcc -O2 -mavx2 render_benchmark.c renderer.c render_thread.c gameboy.c cpu.c block_cache.c jit.c trace.c scheduler.c memory.c mbc.c save.c tile_cache.c plane_cache.c sprite_cache.c palette.c framebuffer.c cartridge.c rom_registry.c -lpthread -o render_benchmark     (avx2)
+*/
+#include <time.h>
+#include "environment.h"
+#include "gameboy.h"
+#include "renderer.h"
+
+#define BENCHMARK_LINES 2000000
+#define BENCHMARK_RUNS 5
+
+typedef void (*background_renderer)(gb_context *gb_p, byte lcdc);
+
+static double get_time(void);
+static double measure(gb_context *gb_p, background_renderer renderer);
+static void draw_sprite_line(gb_context *gb_p, byte lcdc);
+
+int main(void){
+    gb_context *gb_p = initialize_gb_context(initialize_empty_cartridge(GAMEBOY, 2));
+    memory_map *memory_p = gb_p->memory_p;
+
+    // random tiles and maps, scrolled so every line starts in the middle of a tile
+    srand(1);
+    for (int address = VRAM_INDEX; address < 0xA000; address++){
+        memory_p->memory[address] = rand();
+    }
+    invalidate_tile_cache(&memory_p->tile_cache);
+    update_tile_cache(&memory_p->tile_cache, &memory_p->memory[VRAM_INDEX]);
+    memory_p->memory[SCROLL_X_INDEX] = 3;
+    memory_p->memory[SCROLL_Y_INDEX] = 5;
+    write_memory(memory_p, BACKGROUND_PALETTE, 0xE4);
+
+    double per_pixel = measure(gb_p, render_background_per_pixel);
+    double vector = measure(gb_p, render_background);
+
+    printf("renderer : %s\n", RENDERER_NAME);
+    printf("per pixel lines per second : %.0f\n", per_pixel);
+    printf("%s lines per second : %.0f (%.2fx)\n", RENDERER_NAME, vector, vector / per_pixel);
+
+    // the other framebuffer formats, only the palette resolution changes
+    const char *format_names[] = { "RGB24", "indexed", "RGBA32" };
+    for (byte format = FRAMEBUFFER_INDEXED; format <= FRAMEBUFFER_RGBA32; format++){
+        set_framebuffer_format(&gb_p->framebuffer, format);
+        double lines = measure(gb_p, render_background);
+        printf("%s %s lines per second : %.0f (%.2fx)\n", RENDERER_NAME, format_names[format], lines, lines / per_pixel);
+    }
+
+    // whole scanlines with 40 random 8x16 sprites spread over the screen, 4 or 5 of them on every line
+    for (int address = OAM_INDEX; address < OAM_INDEX + 0xA0; address++){
+        write_memory(memory_p, address, rand());
+    }
+    for (int sprite = 0; sprite < 40; sprite++){
+        write_memory(memory_p, OAM_INDEX + (sprite * 4), 16 + ((sprite * 144) / 40));
+    }
+    double sprite_lines = measure(gb_p, draw_sprite_line);
+    printf("%s RGBA32 lines per second with sprites : %.0f\n", RENDERER_NAME, sprite_lines);
+
+    free_gb_context(gb_p);
+    return 0;
+}
+
+static double measure(gb_context *gb_p, background_renderer renderer){
+    double best = 0;
+
+    for (int run = 0; run < BENCHMARK_RUNS; run++){
+        double start = get_time();
+        for (int line = 0; line < BENCHMARK_LINES; line++){
+            gb_p->memory_p->memory[LY_INDEX] = line % SCREEN_HEIGHT;
+            renderer(gb_p, 0x91);
+        }
+        double lines_per_second = BENCHMARK_LINES / (get_time() - start);
+        if (lines_per_second > best){
+            best = lines_per_second;
+        }
+    }
+    return best;
+}
+
+static void draw_sprite_line(gb_context *gb_p, byte lcdc){
+    gb_p->memory_p->memory[LCDC_INDEX] = lcdc | 0x06;
+    draw_scanline(gb_p);
+}
+
+static double get_time(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + (now.tv_nsec / 1000000000.0);
+}
@@ -0,0 +1,168 @@
+#include <sched.h>
+#include <time.h>
+#include "render_thread.h"
+#include "renderer.h"
+
+#define IDLE_POLLS 256 // empty polls before the render thread starts sleeping
+#define IDLE_SLEEP_NS 20000
+
+static void *run_render_thread(void *thread_arg_p);
+static void draw_snapshot(render_thread *thread_p, scanline_snapshot *snapshot_p);
+static void apply_video_copy(memory_map *memory_p, byte *copy_p);
+static void wait_for_room(render_thread *thread_p, unsigned long *consumed_p, unsigned long produced, unsigned long size);
+
+/*
+    the render thread starts from the current VRAM and OAM and draws into the framebuffer of the context
+    the framebuffer format has to be set before, returns NULL when the thread can't be started
+*/
+render_thread *initialize_render_thread(gb_context *gb_p){
+
+    render_thread *thread_p = calloc(sizeof(render_thread), 1);
+    thread_p->shadow.cartridge_p = gb_p->cartridge_p;
+    thread_p->shadow.memory_p = initialize_memory(gb_p->cartridge_p);
+    thread_p->shadow.framebuffer = gb_p->framebuffer;
+    thread_p->running = TRUE;
+
+    if (pthread_create(&thread_p->thread, NULL, run_render_thread, thread_p) != 0){
+        printf("WARNING : Couldn't start the render thread, the lines are drawn on the emulation thread \n");
+        free_memory(thread_p->shadow.memory_p);
+        free(thread_p);
+        return NULL;
+    }
+    return thread_p;
+}
+
+void free_render_thread(render_thread *thread_p){
+
+    if (thread_p == NULL){
+        return;
+    }
+    wait_render_thread(thread_p);
+    __atomic_store_n(&thread_p->running, FALSE, __ATOMIC_RELEASE);
+    pthread_join(thread_p->thread, NULL);
+    free_memory(thread_p->shadow.memory_p);
+    free(thread_p);
+}
+
+// called by the PPU when the pixel transfer of LY ends
+void push_scanline(render_thread *thread_p, memory_map *memory_p){
+
+    // VRAM or OAM were written since the last copy
+    if (thread_p->made_copies == 0 || memory_p->video_generation != thread_p->copied_generation){
+        wait_for_room(thread_p, &thread_p->applied_copies, thread_p->made_copies, VIDEO_COPIES);
+        byte *copy_p = thread_p->copies[thread_p->made_copies % VIDEO_COPIES];
+        memcpy(copy_p, &memory_p->memory[VRAM_INDEX], 0x2000);
+        memcpy(&copy_p[0x2000], &memory_p->memory[OAM_INDEX], 0xA0);
+        thread_p->copied_generation = memory_p->video_generation;
+        thread_p->made_copies++;
+    }
+
+    wait_for_room(thread_p, &thread_p->tail, thread_p->head, SCANLINE_QUEUE_SIZE);
+    scanline_snapshot *snapshot_p = &thread_p->lines[thread_p->head & (SCANLINE_QUEUE_SIZE - 1)];
+    snapshot_p->line = memory_p->memory[LY_INDEX];
+    snapshot_p->lcdc = memory_p->memory[LCDC_INDEX];
+    snapshot_p->scroll_y = memory_p->memory[SCROLL_Y_INDEX];
+    snapshot_p->scroll_x = memory_p->memory[SCROLL_X_INDEX];
+    snapshot_p->window_y = memory_p->memory[WINDOW_Y_INDEX];
+    snapshot_p->window_x = memory_p->memory[WINDOW_X_INDEX];
+    memcpy(snapshot_p->palettes, &memory_p->memory[BACKGROUND_PALETTE], 3);
+    snapshot_p->color_scheme = memory_p->palettes.color_scheme;
+    snapshot_p->video_generation = thread_p->made_copies - 1;
+
+    // the copy and the snapshot are visible to the render thread before the new head
+    __atomic_store_n(&thread_p->head, thread_p->head + 1, __ATOMIC_RELEASE);
+}
+
+// returns once every pushed line is in the framebuffer
+void wait_render_thread(render_thread *thread_p){
+    while (__atomic_load_n(&thread_p->tail, __ATOMIC_ACQUIRE) != thread_p->head){
+        sched_yield();
+    }
+}
+
+static void *run_render_thread(void *thread_arg_p){
+
+    render_thread *thread_p = thread_arg_p;
+    struct timespec idle_sleep = { 0, IDLE_SLEEP_NS };
+    int idle_polls = 0;
+
+    while (TRUE){
+        unsigned long head = __atomic_load_n(&thread_p->head, __ATOMIC_ACQUIRE);
+        if (thread_p->tail == head){
+            // free_render_thread drains the queue before it stops the thread
+            if (!__atomic_load_n(&thread_p->running, __ATOMIC_ACQUIRE)){
+                break;
+            }
+            if (++idle_polls > IDLE_POLLS){
+                nanosleep(&idle_sleep, NULL);
+            }
+            continue;
+        }
+        idle_polls = 0;
+        for (unsigned long tail = thread_p->tail; tail != head; tail++){
+            draw_snapshot(thread_p, &thread_p->lines[tail & (SCANLINE_QUEUE_SIZE - 1)]);
+            __atomic_store_n(&thread_p->tail, tail + 1, __ATOMIC_RELEASE);
+        }
+    }
+    return NULL;
+}
+
+static void draw_snapshot(render_thread *thread_p, scanline_snapshot *snapshot_p){
+
+    memory_map *memory_p = thread_p->shadow.memory_p;
+
+    // the older copies were made before this one, only the newest matters
+    if (snapshot_p->video_generation >= thread_p->applied_copies){
+        apply_video_copy(memory_p, thread_p->copies[snapshot_p->video_generation % VIDEO_COPIES]);
+        __atomic_store_n(&thread_p->applied_copies, snapshot_p->video_generation + 1, __ATOMIC_RELEASE);
+    }
+
+    memory_p->memory[LY_INDEX] = snapshot_p->line;
+    memory_p->memory[LCDC_INDEX] = snapshot_p->lcdc;
+    memory_p->memory[SCROLL_Y_INDEX] = snapshot_p->scroll_y;
+    memory_p->memory[SCROLL_X_INDEX] = snapshot_p->scroll_x;
+    memory_p->memory[WINDOW_Y_INDEX] = snapshot_p->window_y;
+    memory_p->memory[WINDOW_X_INDEX] = snapshot_p->window_x;
+    for (int palette = 0; palette < 3; palette++){
+        if (memory_p->palettes.registers[palette] != snapshot_p->palettes[palette]){
+            write_palette(&memory_p->palettes, palette, snapshot_p->palettes[palette]);
+        }
+    }
+    if (memory_p->palettes.color_scheme != snapshot_p->color_scheme){
+        set_color_scheme(&memory_p->palettes, snapshot_p->color_scheme);
+    }
+    draw_scanline(&thread_p->shadow);
+}
+
+// only the tiles, tile map cells and sprites that differ from the copy are drawn again
+static void apply_video_copy(memory_map *memory_p, byte *copy_p){
+
+    byte *vram_p = &memory_p->memory[VRAM_INDEX];
+    for (int tile = 0; tile < TILE_COUNT; tile++){
+        if (memcmp(&vram_p[tile * TILE_SIZE], &copy_p[tile * TILE_SIZE], TILE_SIZE) != 0){
+            memcpy(&vram_p[tile * TILE_SIZE], &copy_p[tile * TILE_SIZE], TILE_SIZE);
+            mark_tile_dirty(&memory_p->tile_cache, VRAM_INDEX + (tile * TILE_SIZE));
+        }
+    }
+    for (word address = 0x9800; address < 0xA000; address++){
+        if (memory_p->memory[address] != copy_p[address - VRAM_INDEX]){
+            memory_p->memory[address] = copy_p[address - VRAM_INDEX];
+            mark_cell_dirty(&memory_p->plane_cache, address);
+        }
+    }
+    if (memcmp(&memory_p->memory[OAM_INDEX], &copy_p[0x2000], 0xA0) != 0){
+        memcpy(&memory_p->memory[OAM_INDEX], &copy_p[0x2000], 0xA0);
+        memory_p->sprite_cache.dirty = TRUE;
+    }
+}
+
+// the emulation thread only waits when the render thread is a whole ring behind
+static void wait_for_room(render_thread *thread_p, unsigned long *consumed_p, unsigned long produced, unsigned long size){
+    if (produced - __atomic_load_n(consumed_p, __ATOMIC_ACQUIRE) < size){
+        return;
+    }
+    thread_p->full_waits++;
+    while (produced - __atomic_load_n(consumed_p, __ATOMIC_ACQUIRE) >= size){
+        sched_yield();
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef __RENDER_THREAD_H__
+#define __RENDER_THREAD_H__
+
+#include <pthread.h>
+#include "environment.h"
+#include "gameboy.h"
+
+#define SCANLINE_QUEUE_SIZE 256 // power of 2, more than a frame of lines
+#define VIDEO_COPIES 8 // VRAM / OAM copies in flight between the threads
+#define VIDEO_COPY_SIZE (0x2000 + 0xA0)
+
+// everything a line is drawn from, VRAM and OAM are the copy of video_generation
+typedef struct scanline_snapshot{
+    byte line;
+    byte lcdc;
+    byte scroll_y;
+    byte scroll_x;
+    byte window_y;
+    byte window_x;
+    byte palettes[3];
+    byte color_scheme;
+    unsigned long video_generation;
+} scanline_snapshot;
+
+/*
+    the PPU of the emulation thread only pushes a snapshot when a line is due, the render thread
+    draws it into the framebuffer from its own copy of the memory map and caches.
+    VRAM and OAM are copied when a line is pushed after they were written, so the copies are
+    only as many as the frames or lines that changed them. both rings have a single producer
+    and a single consumer, the indices are the only thing the threads share.
+*/
+typedef struct render_thread{
+    pthread_t thread;
+    gb_context shadow; // memory map and caches of the render thread, the framebuffer pixels are shared
+    scanline_snapshot lines[SCANLINE_QUEUE_SIZE];
+    unsigned long head; // written by the emulation thread
+    unsigned long tail; // written by the render thread
+    byte copies[VIDEO_COPIES][VIDEO_COPY_SIZE];
+    unsigned long made_copies; // written by the emulation thread
+    unsigned long applied_copies; // written by the render thread
+    unsigned long copied_generation; // video_generation of the last copy
+    bool running;
+    // instrumentation
+    unsigned long full_waits; // the emulation thread waited for room in a ring
+} render_thread;
+
+render_thread *initialize_render_thread(gb_context *gb_p);
+void free_render_thread(render_thread *thread_p);
+void push_scanline(render_thread *thread_p, memory_map *memory_p);
+void wait_render_thread(render_thread *thread_p);
+#endif
@@ -0,0 +1,662 @@
+#include "renderer.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// the vector loads can read past the 160 pixels of the line
+#define LINE_PADDING 16
+// sprites are composed in a line starting 8 pixels left of the screen, where X = 0 hides them
+#define SPRITE_LINE_OFFSET 8
+#define SPRITE_PALETTE_SHIFT 2 // composed sprite pixels are (palette << 2) | color number
+
+static void copy_plane_span(byte *color_p, byte *row_p, int count, byte x_position);
+static void write_scanline(framebuffer *framebuffer_p, int line, byte *color_p, palette_tables *palettes_p, int palette);
+static void write_rgb_line(byte *rgb_p, byte *color_p, palette_tables *palettes_p, int palette);
+static void write_indexed_line(byte *index_p, byte *color_p, palette_tables *palettes_p, int palette);
+static void write_rgba_line(byte *rgba_p, byte *color_p, palette_tables *palettes_p, int palette);
+static void write_shade(framebuffer *framebuffer_p, int line, int pixel, byte color_scheme, byte shade);
+static void draw_line(gb_context *gb_p, byte lcdc, byte ly);
+static bool fetch_background_line(gb_context *gb_p, byte lcdc, byte ly, byte *color_p);
+static void render_sprites(gb_context *gb_p, byte lcdc, byte ly, byte *background_p);
+static void write_sprite_pixels(gb_context *gb_p, byte ly, byte *sprite_p, byte *behind_p, byte *background_p);
+static byte get_color(memory_map *memory_p, byte column_number, word address);
+static int bit_get_value(byte data, int position);
+
+#if defined(__SSSE3__)
+/*
+    16 bytes of RGB output hold 5 and a third pixels, the blocks repeat every 48 bytes
+    rgb_masks picks the pixel of each output byte, channel_offsets its channel in palette_tables.channels
+*/
+static const byte rgb_masks[3][16] = {
+    { 0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5 },
+    { 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5, 5 },
+    { 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5, 5, 5 }
+};
+static const byte channel_offsets[3][16] = {
+    { 0, 4, 8, 0, 4, 8, 0, 4, 8, 0, 4, 8, 0, 4, 8, 0 },
+    { 4, 8, 0, 4, 8, 0, 4, 8, 0, 4, 8, 0, 4, 8, 0, 4 },
+    { 8, 0, 4, 8, 0, 4, 8, 0, 4, 8, 0, 4, 8, 0, 4, 8 }
+};
+#endif
+#if defined(__SSSE3__) && !defined(__AVX2__)
+// 16 colors are expanded to RGBA 4 pixels at a time, each color picks the 4 bytes of its entry
+static const byte rgba_masks[4][16] = {
+    { 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3 },
+    { 4, 4, 4, 4, 5, 5, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7 },
+    { 8, 8, 8, 8, 9, 9, 9, 9, 10, 10, 10, 10, 11, 11, 11, 11 },
+    { 12, 12, 12, 12, 13, 13, 13, 13, 14, 14, 14, 14, 15, 15, 15, 15 }
+};
+static const byte rgba_offsets[16] = { 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3 };
+#endif
+#if defined(__SSE2__) && !defined(__SSSE3__)
+/*
+    without byte shuffles the 2 bits of the color numbers pick one of the 4 entries in 2 steps,
+    entries holds entry 0, entry 0 ^ entry 1, entry 2 and entry 2 ^ entry 3 spread over the bytes
+*/
+static inline void load_entries(__m128i *entries, byte *values){
+    entries[0] = _mm_set1_epi8(values[0]);
+    entries[1] = _mm_set1_epi8(values[0] ^ values[1]);
+    entries[2] = _mm_set1_epi8(values[2]);
+    entries[3] = _mm_set1_epi8(values[2] ^ values[3]);
+}
+
+// masks[0] / masks[1] are the bytes whose color has bit 0 / bit 1 set
+static inline void load_color_masks(__m128i *masks, byte *color_p){
+    __m128i colors = _mm_loadu_si128((__m128i *) color_p);
+    __m128i one = _mm_set1_epi8(1);
+    __m128i two = _mm_set1_epi8(2);
+    masks[0] = _mm_cmpeq_epi8(_mm_and_si128(colors, one), one);
+    masks[1] = _mm_cmpeq_epi8(_mm_and_si128(colors, two), two);
+}
+
+static inline __m128i select_entries(__m128i *masks, __m128i *entries){
+    __m128i low = _mm_xor_si128(entries[0], _mm_and_si128(entries[1], masks[0]));
+    __m128i high = _mm_xor_si128(entries[2], _mm_and_si128(entries[3], masks[0]));
+    return _mm_xor_si128(low, _mm_and_si128(_mm_xor_si128(low, high), masks[1]));
+}
+
+static inline void load_rgba_channels(uint32_t *rgba, __m128i channels[4][4]){
+    for (int channel = 0; channel < 4; channel++){
+        byte values[4];
+        for (int color = 0; color < 4; color++){
+            values[color] = ((byte *) &rgba[color])[channel];
+        }
+        load_entries(channels[channel], values);
+    }
+}
+
+// the R, G, B and A planes of 16 pixels are selected like shades, then interleaved into 4 x 4 RGBA pixels
+static inline void select_rgba_pixels(byte *color_p, __m128i channels[4][4], __m128i *pixels){
+    __m128i masks[2], planes[4];
+    load_color_masks(masks, color_p);
+    for (int channel = 0; channel < 4; channel++){
+        planes[channel] = select_entries(masks, channels[channel]);
+    }
+    __m128i red_green_low = _mm_unpacklo_epi8(planes[0], planes[1]);
+    __m128i red_green_high = _mm_unpackhi_epi8(planes[0], planes[1]);
+    __m128i blue_alpha_low = _mm_unpacklo_epi8(planes[2], planes[3]);
+    __m128i blue_alpha_high = _mm_unpackhi_epi8(planes[2], planes[3]);
+    pixels[0] = _mm_unpacklo_epi16(red_green_low, blue_alpha_low);
+    pixels[1] = _mm_unpackhi_epi16(red_green_low, blue_alpha_low);
+    pixels[2] = _mm_unpacklo_epi16(red_green_high, blue_alpha_high);
+    pixels[3] = _mm_unpackhi_epi16(red_green_high, blue_alpha_high);
+}
+#endif
+
+void draw_scanline(gb_context *gb_p){
+    memory_map *memory_p = gb_p->memory_p;
+
+    // decode the tiles written since the last scanline
+    update_tile_cache(&memory_p->tile_cache, &memory_p->memory[VRAM_INDEX]);
+    draw_line(gb_p, read_memory(memory_p, LCDC_INDEX), read_memory(memory_p, LY_INDEX));
+}
+
+/*
+    lines first to last - 1 in one pass, with the registers, VRAM and OAM as they are now
+    the PPU calls it for the lines it deferred while none of them changed, the caches
+    are brought up to date once and every line after that only copies and resolves colors
+*/
+void render_lines(gb_context *gb_p, int first, int last){
+    memory_map *memory_p = gb_p->memory_p;
+    byte lcdc = read_memory(memory_p, LCDC_INDEX);
+
+    update_tile_cache(&memory_p->tile_cache, &memory_p->memory[VRAM_INDEX]);
+    update_plane_cache(&memory_p->plane_cache, &memory_p->tile_cache, &memory_p->memory[0x9800], TEST_BIT(lcdc, 4) ? TRUE : FALSE);
+    update_sprite_lines(&memory_p->sprite_cache, &memory_p->memory[OAM_INDEX], TEST_BIT(lcdc, 2));
+
+    for (int line = first; line < last; line++){
+        draw_line(gb_p, lcdc, line);
+    }
+}
+
+static void draw_line(gb_context *gb_p, byte lcdc, byte ly){
+    byte colors[SCREEN_WIDTH + LINE_PADDING] = {0};
+
+    // background
+    if (TEST_BIT(lcdc, 0) && fetch_background_line(gb_p, lcdc, ly, colors)){
+        write_scanline(&gb_p->framebuffer, ly, colors, &gb_p->memory_p->palettes, PALETTE_BACKGROUND);
+    }
+
+    // sprite, the background colors decide where the sprites behind it show
+    if (TEST_BIT(lcdc, 1)){
+        render_sprites(gb_p, lcdc, ly, colors);
+    }
+}
+
+/*
+    original renderer, every pixel looks its tile up again
+    kept as the reference render_background is checked against
+*/
+void render_background_per_pixel(gb_context *gb_p, byte lcdc){
+    memory_map *memory_p = gb_p->memory_p;
+    word tile_data = 0;
+    word background_memory = 0;
+    bool unsig = TRUE;
+
+    // where to draw the visial area and the window
+    byte scroll_y = read_memory(memory_p, SCROLL_Y_INDEX);
+    byte scroll_x = read_memory(memory_p, SCROLL_X_INDEX);
+    byte window_y = read_memory(memory_p, WINDOW_Y_INDEX);
+    byte window_x = read_memory(memory_p, WINDOW_X_INDEX) - 7;
+    
+    // testing scroll Y
+    //scroll_y = 0;
+    //printf("SCROLL Y : %u\n", scroll_y);
+
+    bool windowed = FALSE;
+
+    // verify if window is enabled in LCD
+    if (TEST_BIT(lcdc, 5)){
+        // check is current scanline is within the window Y
+        if (window_y <= read_memory(memory_p, LY_INDEX)){
+            windowed = TRUE;
+        }
+    }
+
+    /* background tile data set selection
+            bit 4 of LCD
+                0 -> 0x8800 - 0x97FF (UNSIGNED)
+                1 -> 0x8000 - 0x8FFF (SIGNED)
+     */ 
+
+    if (TEST_BIT(lcdc, 4)){
+        tile_data = 0x8000;
+    } else {
+        tile_data = 0x8800;
+        unsig = FALSE;
+    }
+
+    if (windowed == FALSE){
+        /* background tile map selection
+            bit 3 of LCD 
+                0 -> 0x9800 - 0x9BFF
+                1 -> 0x9C00 - 0x9FFF
+         */
+        if (TEST_BIT(lcdc, 3)){
+            background_memory = 0x9C00;
+        } else {
+            background_memory = 0x9800;
+        }
+    } 
+    else {
+        /* window tile map selection
+            bit 6 of LCD
+                0 -> 0x9800 - 0x9BFF
+                1 -> 0x9C00 - 0x9FFF
+         */
+        if (TEST_BIT(lcdc, 6)){
+            background_memory = 0x9C00;
+        } else {
+            background_memory = 0x9800;
+        }
+    }
+
+    byte y_position = 0;
+    
+    // y position used to calculate which 32 vertical tiles the current scanline is drawing
+    if (windowed == FALSE){
+        y_position = scroll_y + read_memory(memory_p, LY_INDEX);
+    } 
+    else {
+        y_position = read_memory(memory_p, LY_INDEX) - window_y;
+    }
+
+    // which 8 vertical pixel are currently tile is the scanline on 
+    word tile_row = (((byte) (y_position / 8)) * 32);
+
+    // printf(" Y POSITION %u : ", y_position);
+    // printf("bg_tile_row : %u \n", tile_row);
+
+    // draw the 160 horizontal pixels for the scanline
+    for (int pixel = 0; pixel < 160; pixel++){
+        byte x_position = pixel + scroll_x;
+
+        // translate the current x position to window space if necessary
+        if (windowed){
+            if (pixel >= window_x){
+                x_position = pixel - window_x;
+            }
+        }
+
+        // which of the 32 horizontal tile does this x_position fall within
+        word tile_column = (x_position / 8);
+        signed_word tile_number;
+
+        // get tile identity number based on signed or unsigned.
+        // 32x32 tiles in BG. each tile can be picked based on horizontal and vertical tile
+        word tile_address = background_memory + tile_row + tile_column;
+        if (unsig){
+            tile_number = (byte) read_memory(memory_p, tile_address);
+        } 
+        else {
+            tile_number = (signed_byte) read_memory(memory_p, tile_address);
+        }
+
+        // find the tile data related to tile identity number
+        word tile_location = tile_data;
+
+        if (unsig){
+            tile_location += (tile_number * TILE_SIZE);
+        } else {
+            tile_location += ((tile_number + 128) * TILE_SIZE);
+        }
+
+        // color id of the pixel, already decoded from the 2 bytes of its line in the tile cache
+        word tile = (tile_location - VRAM_INDEX) / TILE_SIZE;
+        int color_number = memory_p->tile_cache.pixels[tile][y_position % 8][x_position % 8];
+
+        // have to color for the bit; get the actual color from palette 0xFF47
+        
+        // get color 
+        byte col = get_color(memory_p, color_number, BACKGROUND_PALETTE);
+
+        
+        // read current line
+        int final_y = read_memory(memory_p, LY_INDEX);
+
+        // safety check that in bound 
+        if ((final_y < 0 ) || (final_y > 143) || (pixel < 0) || (pixel > 159)){
+            printf("FAILED SAFETY CHECK");
+            continue;
+        }
+        // setup the pixel from the color scheme
+        write_shade(&gb_p->framebuffer, final_y, pixel, memory_p->palettes.color_scheme, col);
+
+        // print value 
+        // printf("bg_tile_column : %u ", tile_column);
+        // printf("tile_map_address : 0x%04X ", tile_address);
+        // printf("tile_map_number : %d ", tile_number);
+        // printf("tile_data_location : 0x%04X ", tile_location);
+        // printf("flipped %d ", color_bit);
+        // printf("pixel color number %d ", color_number);
+        // printf("pixel palette color %u ", col);
+        // printf("\n");
+    }
+}
+
+
+/*
+    same output as render_background_per_pixel from the pre-drawn tile map planes
+    the color numbers of the line are copied from a plane row, then write_scanline
+    resolves them to the framebuffer format for the whole line
+*/
+void render_background(gb_context *gb_p, byte lcdc){
+    byte colors[SCREEN_WIDTH + LINE_PADDING] = {0};
+
+    byte ly = read_memory(gb_p->memory_p, LY_INDEX);
+
+    if (fetch_background_line(gb_p, lcdc, ly, colors)){
+        write_scanline(&gb_p->framebuffer, ly, colors, &gb_p->memory_p->palettes, PALETTE_BACKGROUND);
+    }
+}
+
+// color numbers of the background and window on line ly, FALSE when it isn't visible
+static bool fetch_background_line(gb_context *gb_p, byte lcdc, byte ly, byte *color_p){
+    memory_map *memory_p = gb_p->memory_p;
+    byte scroll_y = read_memory(memory_p, SCROLL_Y_INDEX);
+    byte scroll_x = read_memory(memory_p, SCROLL_X_INDEX);
+    byte window_y = read_memory(memory_p, WINDOW_Y_INDEX);
+    byte window_x = read_memory(memory_p, WINDOW_X_INDEX) - 7;
+
+    if (ly >= SCREEN_HEIGHT){
+        return FALSE;
+    }
+
+    // the window map is used for the whole line once LY reached the window
+    bool windowed = TEST_BIT(lcdc, 5) && (window_y <= ly);
+    bool unsig = TEST_BIT(lcdc, 4) ? TRUE : FALSE;
+    int plane = TEST_BIT(lcdc, windowed ? 6 : 3) ? 1 : 0;
+    byte y_position = windowed ? (byte) (ly - window_y) : (byte) (scroll_y + ly);
+
+    // draw the cells changed since the last line
+    update_plane_cache(&memory_p->plane_cache, &memory_p->tile_cache, &memory_p->memory[0x9800], unsig);
+    byte *row_p = memory_p->plane_cache.pixels[plane][y_position];
+
+    // pixels left of the window keep scrolling, the window starts at its own x 0
+    int window_start = (windowed && window_x < SCREEN_WIDTH) ? window_x : SCREEN_WIDTH;
+    copy_plane_span(color_p, row_p, window_start, scroll_x);
+    copy_plane_span(&color_p[window_start], row_p, SCREEN_WIDTH - window_start, 0);
+    return TRUE;
+}
+
+// count color numbers starting at x_position of the plane row, the x position wraps at 256 like the map
+static void copy_plane_span(byte *color_p, byte *row_p, int count, byte x_position){
+
+    int first = (PLANE_SIZE - x_position < count) ? PLANE_SIZE - x_position : count;
+    memcpy(color_p, &row_p[x_position], first);
+    memcpy(&color_p[first], row_p, count - first);
+}
+
+static void write_scanline(framebuffer *framebuffer_p, int line, byte *color_p, palette_tables *palettes_p, int palette){
+
+    byte *line_p = FRAMEBUFFER_LINE(framebuffer_p, line);
+    switch(framebuffer_p->format){
+        case FRAMEBUFFER_RGB24: write_rgb_line(line_p, color_p, palettes_p, palette); break;
+        case FRAMEBUFFER_INDEXED: write_indexed_line(line_p, color_p, palettes_p, palette); break;
+        case FRAMEBUFFER_RGBA32: write_rgba_line(line_p, color_p, palettes_p, palette); break;
+    }
+}
+
+/*
+    160 color numbers to RGB, the color of every output byte is picked from the palette
+    channels by two byte shuffles. SSE2 selects the RGBA pixels and drops their alpha bytes,
+    without vectors each pixel copies its entry of the RGBA table
+*/
+static void write_rgb_line(byte *rgb_p, byte *color_p, palette_tables *palettes_p, int palette){
+
+#if defined(__AVX2__)
+    __m256i channels = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *) palettes_p->channels[palette]));
+    // each 32 bytes store takes 2 lanes of 16 bytes, loaded from the first pixel they hold
+    for (int block = 0; block < (SCREEN_WIDTH * 3) / 16; block += 2){
+        __m128i low = _mm_loadu_si128((__m128i *) &color_p[(block * 16) / 3]);
+        __m128i high = _mm_loadu_si128((__m128i *) &color_p[((block + 1) * 16) / 3]);
+        __m256i colors = _mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1);
+        __m256i mask = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((__m128i *) rgb_masks[block % 3])), _mm_loadu_si128((__m128i *) rgb_masks[(block + 1) % 3]), 1);
+        __m256i offsets = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((__m128i *) channel_offsets[block % 3])), _mm_loadu_si128((__m128i *) channel_offsets[(block + 1) % 3]), 1);
+        __m256i indexes = _mm256_add_epi8(_mm256_shuffle_epi8(colors, mask), offsets);
+        _mm256_storeu_si256((__m256i *) &rgb_p[block * 16], _mm256_shuffle_epi8(channels, indexes));
+    }
+#elif defined(__SSSE3__)
+    __m128i channels = _mm_loadu_si128((__m128i *) palettes_p->channels[palette]);
+    for (int block = 0; block < (SCREEN_WIDTH * 3) / 16; block++){
+        __m128i colors = _mm_loadu_si128((__m128i *) &color_p[(block * 16) / 3]);
+        __m128i mask = _mm_loadu_si128((__m128i *) rgb_masks[block % 3]);
+        __m128i indexes = _mm_add_epi8(_mm_shuffle_epi8(colors, mask), _mm_loadu_si128((__m128i *) channel_offsets[block % 3]));
+        _mm_storeu_si128((__m128i *) &rgb_p[block * 16], _mm_shuffle_epi8(channels, indexes));
+    }
+#elif defined(__SSE2__)
+    __m128i channels[4][4], pixels[4];
+    load_rgba_channels(palettes_p->rgba[palette], channels);
+    __m128i rgb_mask = _mm_set1_epi32(0x00FFFFFF);
+    __m128i low_pixel = _mm_set_epi32(0, -1, 0, -1);
+    for (int pixel = 0; pixel < SCREEN_WIDTH; pixel += 16){
+        select_rgba_pixels(&color_p[pixel], channels, pixels);
+        for (int quarter = 0; quarter < 4; quarter++){
+            // the alpha bytes are dropped, each 64 bits lane holds 6 bytes and the lanes are joined in 12
+            __m128i rgb = _mm_and_si128(pixels[quarter], rgb_mask);
+            rgb = _mm_or_si128(_mm_and_si128(rgb, low_pixel), _mm_srli_epi64(_mm_andnot_si128(low_pixel, rgb), 8));
+            rgb = _mm_or_si128(_mm_move_epi64(rgb), _mm_slli_si128(_mm_srli_si128(rgb, 8), 6));
+            byte *out_p = &rgb_p[(pixel + quarter * 4) * 3];
+            uint32_t last = _mm_cvtsi128_si32(_mm_srli_si128(rgb, 8));
+            _mm_storel_epi64((__m128i *) out_p, rgb);
+            memcpy(&out_p[8], &last, 4);
+        }
+    }
+#else
+    uint32_t *rgba = palettes_p->rgba[palette];
+    for (int pixel = 0; pixel < SCREEN_WIDTH; pixel++){
+        memcpy(&rgb_p[pixel * 3], &rgba[color_p[pixel]], 3);
+    }
+#endif
+}
+
+// the 4 shades fit in one register, a byte shuffle (or the SSE2 select) resolves 16 or 32 pixels at once
+static void write_indexed_line(byte *index_p, byte *color_p, palette_tables *palettes_p, int palette){
+
+#if defined(__AVX2__)
+    uint32_t shade_bytes;
+    memcpy(&shade_bytes, palettes_p->shades[palette], 4);
+    __m256i shades = _mm256_set1_epi32(shade_bytes);
+    for (int pixel = 0; pixel < SCREEN_WIDTH; pixel += 32){
+        __m256i colors = _mm256_loadu_si256((__m256i *) &color_p[pixel]);
+        _mm256_storeu_si256((__m256i *) &index_p[pixel], _mm256_shuffle_epi8(shades, colors));
+    }
+#elif defined(__SSSE3__)
+    uint32_t shade_bytes;
+    memcpy(&shade_bytes, palettes_p->shades[palette], 4);
+    __m128i shades = _mm_set1_epi32(shade_bytes);
+    for (int pixel = 0; pixel < SCREEN_WIDTH; pixel += 16){
+        __m128i colors = _mm_loadu_si128((__m128i *) &color_p[pixel]);
+        _mm_storeu_si128((__m128i *) &index_p[pixel], _mm_shuffle_epi8(shades, colors));
+    }
+#elif defined(__SSE2__)
+    __m128i entries[4], masks[2];
+    load_entries(entries, palettes_p->shades[palette]);
+    for (int pixel = 0; pixel < SCREEN_WIDTH; pixel += 16){
+        load_color_masks(masks, &color_p[pixel]);
+        _mm_storeu_si128((__m128i *) &index_p[pixel], select_entries(masks, entries));
+    }
+#else
+    for (int pixel = 0; pixel < SCREEN_WIDTH; pixel++){
+        index_p[pixel] = palettes_p->shades[palette][color_p[pixel]];
+    }
+#endif
+}
+
+// every pixel is a whole entry of the RGBA table
+static void write_rgba_line(byte *rgba_p, byte *color_p, palette_tables *palettes_p, int palette){
+
+#if defined(__AVX2__)
+    __m256i table = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *) palettes_p->rgba[palette]));
+    for (int pixel = 0; pixel < SCREEN_WIDTH; pixel += 8){
+        __m256i colors = _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i *) &color_p[pixel]));
+        _mm256_storeu_si256((__m256i *) &rgba_p[pixel * 4], _mm256_permutevar8x32_epi32(table, colors));
+    }
+#elif defined(__SSSE3__)
+    __m128i table = _mm_loadu_si128((__m128i *) palettes_p->rgba[palette]);
+    __m128i offsets = _mm_loadu_si128((__m128i *) rgba_offsets);
+    for (int pixel = 0; pixel < SCREEN_WIDTH; pixel += 16){
+        __m128i colors = _mm_loadu_si128((__m128i *) &color_p[pixel]);
+        for (int quarter = 0; quarter < 4; quarter++){
+            // color * 4 + byte, the colors are below 4 so the 16 bits shift never carries
+            __m128i spread = _mm_shuffle_epi8(colors, _mm_loadu_si128((__m128i *) rgba_masks[quarter]));
+            __m128i indexes = _mm_add_epi8(_mm_slli_epi16(spread, 2), offsets);
+            _mm_storeu_si128((__m128i *) &rgba_p[(pixel + quarter * 4) * 4], _mm_shuffle_epi8(table, indexes));
+        }
+    }
+#elif defined(__SSE2__)
+    __m128i channels[4][4], pixels[4];
+    load_rgba_channels(palettes_p->rgba[palette], channels);
+    for (int pixel = 0; pixel < SCREEN_WIDTH; pixel += 16){
+        select_rgba_pixels(&color_p[pixel], channels, pixels);
+        for (int quarter = 0; quarter < 4; quarter++){
+            _mm_storeu_si128((__m128i *) &rgba_p[(pixel + quarter * 4) * 4], pixels[quarter]);
+        }
+    }
+#else
+    uint32_t *pixel_p = (uint32_t *) rgba_p;
+    for (int pixel = 0; pixel < SCREEN_WIDTH; pixel++){
+        pixel_p[pixel] = palettes_p->rgba[palette][color_p[pixel]];
+    }
+#endif
+}
+
+// single pixels drawn outside of write_scanline, shade is 0 - 3 after the palette
+static void write_shade(framebuffer *framebuffer_p, int line, int pixel, byte color_scheme, byte shade){
+
+    byte *pixel_p = FRAMEBUFFER_LINE(framebuffer_p, line) + (pixel * framebuffer_p->bytes_per_pixel);
+    if (framebuffer_p->format == FRAMEBUFFER_INDEXED){
+        *pixel_p = shade;
+    } else {
+        memcpy(pixel_p, color_schemes[color_scheme][shade], framebuffer_p->bytes_per_pixel);
+    }
+}
+
+static byte get_color(memory_map *memory_p, byte column_number, word address){
+    byte result = 0;
+    byte palette = read_memory(memory_p, address);
+    int hi = 0;
+    int lo = 0;
+
+    // which bit of the color palette does the color id map to
+    switch(column_number){
+        case 0: hi = 1; lo = 0; break;
+        case 1: hi = 3; lo = 2; break;
+        case 2: hi = 5; lo = 4; break;
+        case 3: hi = 7; lo = 6; break;
+    }
+
+    // use the palette to get the color
+    int color = 0;
+    color = bit_get_value(palette, hi) << 1;
+    color |= bit_get_value(palette, lo);
+
+    //convert the game color to emulator color
+    switch(color){
+        case 0: result = 0; break; // WHITE
+        case 1: result = 1; break; // LIGHT_GRAY
+        case 2: result = 2; break; // DARK_GRAY 
+        case 3: result = 3; break; // BLACK 
+    }
+
+    return result;
+}
+
+static int bit_get_value(byte data, int position){
+    byte mask = 1 << position ;
+    int bit = (data & mask) ? 1 : 0;
+	return bit;
+}
+
+/* all sprites located in 0x8000-0x8FFF
+all sprites identifiers are unsigned value so easy to find
+40 tiles located in 0x8000-0x8FFF
+scan through them all and check their attribites to find where they rendered
+sprite attribute found in attribute table in 0xFE00-0xFE9F
+Each sprite has 4 bytes associated to it 
+
+0: Sprite Y Position: Position of the sprite on the Y axis of the viewing display minus 16
+1: Sprite X Position: Position of the sprite on the X axis of the viewing display minus 8
+2: Pattern number: This is the sprite identifier used for looking up the sprite data in memory region 0x8000-0x8FFF
+3: Attributes:
+    Bit7: Sprite to Background Priority
+        - 0 then sprite rendered above the background and the window.
+        - 1 hide behind the background
+    Bit6: Y flip
+      - sprite becomes upside down
+    Bit5: X flip
+      - change direction of character
+    Bit4: Palette number
+      - Sprite can either be in palette 0xFF48 or 0xFF49
+    Bit3: Not used in standard gameboy
+    Bit2-0: Not used in standard gameboy
+
+A sprite can be 8x8 pixel or 8x16 pixels
+
+*/
+
+/*
+    the sprites of the line are composed from the highest priority down, a pixel keeps the first
+    opaque sprite pixel it gets. the BG priority mask is applied once on the whole line.
+*/
+static void render_sprites(gb_context *gb_p, byte lcdc, byte ly, byte *background_p){
+    memory_map *memory_p = gb_p->memory_p;
+    sprite_cache *sprites_p = &memory_p->sprite_cache;
+    bool tall = TEST_BIT(lcdc, 2);
+
+    if (ly >= SCREEN_HEIGHT){
+        return;
+    }
+    update_sprite_lines(sprites_p, &memory_p->memory[OAM_INDEX], tall);
+    if (sprites_p->line_counts[ly] == 0){
+        return;
+    }
+
+    byte sprite_line[SPRITE_LINE_OFFSET + SCREEN_WIDTH + LINE_PADDING] = {0};
+    byte behind_line[SPRITE_LINE_OFFSET + SCREEN_WIDTH + LINE_PADDING] = {0};
+
+    for (int i = 0; i < sprites_p->line_counts[ly]; i++){
+        byte *entry_p = &memory_p->memory[OAM_INDEX + (sprites_p->line_sprites[ly][i] * 4)];
+        byte x_position = entry_p[1];
+        byte attributes = entry_p[3];
+
+        // still one of the 10 sprites of the line when it's off screen
+        if (x_position == 0 || x_position >= SCREEN_WIDTH + SPRITE_LINE_OFFSET){
+            continue;
+        }
+
+        int line = ly - (entry_p[0] - 16);
+        if (TEST_BIT(attributes, 6)){
+            line = (tall ? 15 : 7) - line;
+        }
+        // 8x16 sprites ignore bit 0 of the tile number and continue in the next tile
+        byte tile = tall ? (entry_p[2] & 0xFE) + (line / 8) : entry_p[2];
+        byte *row_p = get_sprite_row(sprites_p, &memory_p->tile_cache, tile, line % 8, TEST_BIT(attributes, 5));
+
+        byte palette = TEST_BIT(attributes, 4) ? PALETTE_SPRITE_2 : PALETTE_SPRITE_1;
+        byte behind = TEST_BIT(attributes, 7) ? 0xFF : 0;
+        byte *target_p = &sprite_line[x_position];
+        byte *target_behind_p = &behind_line[x_position];
+
+        // color 0 is transparent, higher priority sprites were composed first
+        for (int pixel = 0; pixel < 8; pixel++){
+            bool draw = (row_p[pixel] != 0) && (target_p[pixel] == 0);
+            target_p[pixel] = draw ? (palette << SPRITE_PALETTE_SHIFT) | row_p[pixel] : target_p[pixel];
+            target_behind_p[pixel] = draw ? behind : target_behind_p[pixel];
+        }
+    }
+    write_sprite_pixels(gb_p, ly, &sprite_line[SPRITE_LINE_OFFSET], &behind_line[SPRITE_LINE_OFFSET], background_p);
+}
+
+/*
+    a sprite pixel shows unless it's behind the background and the background color isn't 0
+    the mask is built 16 or 32 pixels at a time, only the pixels it keeps are written
+*/
+static void write_sprite_pixels(gb_context *gb_p, byte ly, byte *sprite_p, byte *behind_p, byte *background_p){
+    palette_tables *palettes_p = &gb_p->memory_p->palettes;
+
+#if defined(__AVX2__)
+    __m256i zero = _mm256_setzero_si256();
+    for (int block = 0; block < SCREEN_WIDTH; block += 32){
+        __m256i sprite = _mm256_loadu_si256((__m256i *) &sprite_p[block]);
+        __m256i behind = _mm256_loadu_si256((__m256i *) &behind_p[block]);
+        __m256i background = _mm256_loadu_si256((__m256i *) &background_p[block]);
+        __m256i hidden = _mm256_or_si256(_mm256_cmpeq_epi8(sprite, zero), _mm256_andnot_si256(_mm256_cmpeq_epi8(background, zero), behind));
+        unsigned int visible = ~(unsigned int) _mm256_movemask_epi8(hidden);
+        while (visible != 0){
+            int pixel = block + __builtin_ctz(visible);
+            visible &= visible - 1;
+            byte palette = sprite_p[pixel] >> SPRITE_PALETTE_SHIFT;
+            write_shade(&gb_p->framebuffer, ly, pixel, palettes_p->color_scheme, palettes_p->shades[palette][sprite_p[pixel] & 0x3]);
+        }
+    }
+#elif defined(__SSE2__)
+    __m128i zero = _mm_setzero_si128();
+    for (int block = 0; block < SCREEN_WIDTH; block += 16){
+        __m128i sprite = _mm_loadu_si128((__m128i *) &sprite_p[block]);
+        __m128i behind = _mm_loadu_si128((__m128i *) &behind_p[block]);
+        __m128i background = _mm_loadu_si128((__m128i *) &background_p[block]);
+        __m128i hidden = _mm_or_si128(_mm_cmpeq_epi8(sprite, zero), _mm_andnot_si128(_mm_cmpeq_epi8(background, zero), behind));
+        unsigned int visible = ~_mm_movemask_epi8(hidden) & 0xFFFF;
+        while (visible != 0){
+            int pixel = block + __builtin_ctz(visible);
+            visible &= visible - 1;
+            byte palette = sprite_p[pixel] >> SPRITE_PALETTE_SHIFT;
+            write_shade(&gb_p->framebuffer, ly, pixel, palettes_p->color_scheme, palettes_p->shades[palette][sprite_p[pixel] & 0x3]);
+        }
+    }
+#else
+    for (int pixel = 0; pixel < SCREEN_WIDTH; pixel++){
+        if (sprite_p[pixel] == 0 || (behind_p[pixel] && background_p[pixel] != 0)){
+            continue;
+        }
+        byte palette = sprite_p[pixel] >> SPRITE_PALETTE_SHIFT;
+        write_shade(&gb_p->framebuffer, ly, pixel, palettes_p->color_scheme, palettes_p->shades[palette][sprite_p[pixel] & 0x3]);
+    }
+#endif
+}
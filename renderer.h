@@ -0,0 +1,22 @@
+#ifndef __RENDERER_H__
+#define __RENDERER_H__
+
+#include "environment.h"
+#include "gameboy.h"
+
+// widest path the compiler was allowed to use, SSE2 on any x86-64, -mssse3 / -mavx2 select the faster ones
+#if defined(__AVX2__)
+#define RENDERER_NAME "avx2"
+#elif defined(__SSSE3__)
+#define RENDERER_NAME "ssse3"
+#elif defined(__SSE2__)
+#define RENDERER_NAME "sse2"
+#else
+#define RENDERER_NAME "scalar"
+#endif
+
+void draw_scanline(gb_context *gb_p);
+void render_lines(gb_context *gb_p, int first, int last);
+void render_background(gb_context *gb_p, byte lcdc);
+void render_background_per_pixel(gb_context *gb_p, byte lcdc);
+#endif
@@ -0,0 +1,183 @@
+#include <pthread.h>
+#include "rom_registry.h"
+
+#define FNV_OFFSET_BASIS 0xCBF29CE484222325ULL
+#define FNV_PRIME 0x100000001B3ULL
+
+typedef struct rom_image {
+    cartridge *cartridge_p;
+    unsigned long long hash;
+    char **file_names; // every name the image was acquired with
+    int file_name_count;
+    int references;
+    struct rom_image *next_p;
+} rom_image;
+
+static rom_image *find_by_file_name(char *file_name);
+static rom_image *find_by_content(unsigned long long hash, cartridge *cartridge_p);
+static void add_file_name(rom_image *image_p, char *file_name);
+static rom_image *find_by_cartridge(cartridge *cartridge_p);
+static unsigned long long hash_rom(cartridge *cartridge_p);
+
+static rom_image *registry_p = NULL;
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+    returns the registered image of the file or of another file with the same content
+    the file is only read when its name was never seen before, outside of the lock
+*/
+cartridge *acquire_cartridge(char *file_name){
+
+    pthread_mutex_lock(&registry_lock);
+    rom_image *image_p = find_by_file_name(file_name);
+    if (image_p != NULL){
+        image_p->references++;
+        pthread_mutex_unlock(&registry_lock);
+        return image_p->cartridge_p;
+    }
+    pthread_mutex_unlock(&registry_lock);
+
+    cartridge *cartridge_p = initialize_cartridge(file_name);
+    unsigned long long hash = hash_rom(cartridge_p);
+
+    // same game under another name or registered by another thread meanwhile, keep the image that is already shared
+    pthread_mutex_lock(&registry_lock);
+    image_p = find_by_file_name(file_name);
+    if (image_p == NULL){
+        image_p = find_by_content(hash, cartridge_p);
+        if (image_p != NULL){
+            add_file_name(image_p, file_name);
+        }
+    }
+    if (image_p != NULL){
+        image_p->references++;
+        pthread_mutex_unlock(&registry_lock);
+        free_cartridge(cartridge_p);
+        return image_p->cartridge_p;
+    }
+
+    image_p = calloc(sizeof(rom_image), 1);
+    image_p->cartridge_p = cartridge_p;
+    image_p->hash = hash;
+    add_file_name(image_p, file_name);
+    image_p->references = 1;
+    image_p->next_p = registry_p;
+    registry_p = image_p;
+
+    pthread_mutex_unlock(&registry_lock);
+    return cartridge_p;
+}
+
+// another instance of a game that is already loaded, no file access
+cartridge *retain_cartridge(cartridge *cartridge_p){
+
+    pthread_mutex_lock(&registry_lock);
+    rom_image *image_p = find_by_cartridge(cartridge_p);
+    if (image_p != NULL){
+        image_p->references++;
+    }
+    pthread_mutex_unlock(&registry_lock);
+
+    if (image_p == NULL){
+        printf("ERROR : cartridge is not registered\n");
+        exit(1);
+    }
+    return cartridge_p;
+}
+
+// cartridges that were never registered are owned by their only user and freed right away
+void release_cartridge(cartridge *cartridge_p){
+
+    if (cartridge_p == NULL){
+        return;
+    }
+
+    pthread_mutex_lock(&registry_lock);
+
+    rom_image **link_p = &registry_p;
+    while (*link_p != NULL && (*link_p)->cartridge_p != cartridge_p){
+        link_p = &(*link_p)->next_p;
+    }
+
+    rom_image *image_p = *link_p;
+    if (image_p == NULL){
+        pthread_mutex_unlock(&registry_lock);
+        free_cartridge(cartridge_p);
+        return;
+    }
+
+    image_p->references--;
+    if (image_p->references > 0){
+        pthread_mutex_unlock(&registry_lock);
+        return;
+    }
+
+    *link_p = image_p->next_p;
+    pthread_mutex_unlock(&registry_lock);
+
+    free_cartridge(image_p->cartridge_p);
+    for (int i = 0; i < image_p->file_name_count; i++){
+        free(image_p->file_names[i]);
+    }
+    free(image_p->file_names);
+    free(image_p);
+}
+
+int get_registered_cartridges(){
+
+    int count = 0;
+    pthread_mutex_lock(&registry_lock);
+    for (rom_image *image_p = registry_p; image_p != NULL; image_p = image_p->next_p){
+        count++;
+    }
+    pthread_mutex_unlock(&registry_lock);
+    return count;
+}
+
+static rom_image *find_by_file_name(char *file_name){
+    for (rom_image *image_p = registry_p; image_p != NULL; image_p = image_p->next_p){
+        for (int i = 0; i < image_p->file_name_count; i++){
+            if (strcmp(image_p->file_names[i], file_name) == 0){
+                return image_p;
+            }
+        }
+    }
+    return NULL;
+}
+
+// the hash only narrows the candidates down, two images are the same game when every byte matches
+static rom_image *find_by_content(unsigned long long hash, cartridge *cartridge_p){
+    for (rom_image *image_p = registry_p; image_p != NULL; image_p = image_p->next_p){
+        cartridge *candidate_p = image_p->cartridge_p;
+        if (image_p->hash == hash && candidate_p->rom_size == cartridge_p->rom_size &&
+            memcmp(candidate_p->cartridge_memory, cartridge_p->cartridge_memory, cartridge_p->rom_size) == 0){
+            return image_p;
+        }
+    }
+    return NULL;
+}
+
+static void add_file_name(rom_image *image_p, char *file_name){
+    image_p->file_names = realloc(image_p->file_names, sizeof(char *) * (image_p->file_name_count + 1));
+    image_p->file_names[image_p->file_name_count++] = strdup(file_name);
+}
+
+static rom_image *find_by_cartridge(cartridge *cartridge_p){
+    for (rom_image *image_p = registry_p; image_p != NULL; image_p = image_p->next_p){
+        if (image_p->cartridge_p == cartridge_p){
+            return image_p;
+        }
+    }
+    return NULL;
+}
+
+// FNV-1a over the whole image
+static unsigned long long hash_rom(cartridge *cartridge_p){
+
+    unsigned long long hash = FNV_OFFSET_BASIS;
+    for (unsigned long i = 0; i < cartridge_p->rom_size; i++){
+        hash ^= cartridge_p->cartridge_memory[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
@@ -0,0 +1,19 @@
+#ifndef __ROM_REGISTRY_H__
+#define __ROM_REGISTRY_H__
+
+#include "environment.h"
+#include "cartridge.h"
+
+/*
+    process wide registry of ROM images shared by every instance of the same game
+    images are matched by their content, a hash picks the candidates and the bytes are compared.
+    every file name an image was acquired with is remembered so the next instance of an
+    already loaded game doesn't touch the file at all.
+    shared cartridges are read-only and reference counted, release them instead of freeing them.
+*/
+cartridge *acquire_cartridge(char *file_name);
+cartridge *retain_cartridge(cartridge *cartridge_p);
+void release_cartridge(cartridge *cartridge_p);
+int get_registered_cartridges();
+
+#endif
@@ -0,0 +1,139 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "save.h"
+#include "scheduler.h"
+
+#define EXTERNAL_RAM_INDEX 0xA000
+#define EXTERNAL_RAM_SIZE 0x2000
+#define MBC2_RAM_SIZE 0x200
+
+static unsigned long get_save_size(cartridge *cartridge_p);
+static void sync_dirty_pages(memory_map *memory_p, int flags);
+
+/*
+    map the .sav file in place of ram_banks, it's created or grown to the RAM size of the cartridge
+    returns FALSE and keeps the RAM in memory when the cartridge has no RAM or the file can't be mapped
+*/
+bool attach_battery_save(memory_map *memory_p, char *file_name){
+
+    unsigned long size = get_save_size(memory_p->cartridge_p);
+    struct stat file_stat;
+    if (size == 0 || memory_p->save_p != NULL){
+        return FALSE;
+    }
+
+    int save_file = open(file_name, O_RDWR | O_CREAT, 0644);
+    if (save_file < 0 || fstat(save_file, &file_stat) < 0){
+        printf("WARNING : Couldn't open %s, the game won't be saved \n", file_name);
+        return FALSE;
+    }
+    if (file_stat.st_size < size && ftruncate(save_file, size) < 0){
+        printf("WARNING : Couldn't resize %s, the game won't be saved \n", file_name);
+        close(save_file);
+        return FALSE;
+    }
+
+    void *ram_p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, save_file, 0);
+    if (ram_p == MAP_FAILED){
+        printf("WARNING : Couldn't map %s, the game won't be saved \n", file_name);
+        close(save_file);
+        return FALSE;
+    }
+
+    battery_save *save_p = calloc(sizeof(battery_save), 1);
+    save_p->file = save_file;
+    save_p->size = size;
+
+    free(memory_p->ram_banks);
+    memory_p->ram_banks = ram_p;
+    memory_p->save_p = save_p;
+    map_memory_pages(memory_p);
+    return TRUE;
+}
+
+// offset in ram_banks, the flush is scheduled when the first page gets dirty
+void mark_save_dirty(memory_map *memory_p, unsigned long offset){
+
+    battery_save *save_p = memory_p->save_p;
+    if (save_p->dirty[offset / PAGE_SIZE]){
+        return;
+    }
+    save_p->dirty[offset / PAGE_SIZE] = TRUE;
+    if (save_p->dirty_pages++ == 0 && memory_p->scheduler_p != NULL){
+        schedule_event(memory_p->scheduler_p, EVENT_SAVE, memory_p->scheduler_p->cycles + SAVE_FLUSH_CYCLES);
+    }
+}
+
+/*
+    every run of dirty pages is handed to the kernel in a single msync,
+    the RAM pages are unmapped again so the next write marks them dirty
+*/
+void flush_battery_save(memory_map *memory_p){
+
+    battery_save *save_p = memory_p->save_p;
+    if (save_p == NULL || save_p->dirty_pages == 0){
+        return;
+    }
+    sync_dirty_pages(memory_p, MS_ASYNC);
+    save_p->flushes++;
+
+    for (int page = EXTERNAL_RAM_INDEX / PAGE_SIZE; page < (EXTERNAL_RAM_INDEX + EXTERNAL_RAM_SIZE) / PAGE_SIZE; page++){
+        memory_p->write_pages[page] = NULL;
+    }
+    if (memory_p->scheduler_p != NULL){
+        cancel_event(memory_p->scheduler_p, EVENT_SAVE);
+    }
+}
+
+// waits for the last dirty pages, only called when the game is closed
+void detach_battery_save(memory_map *memory_p){
+
+    battery_save *save_p = memory_p->save_p;
+    if (save_p == NULL){
+        return;
+    }
+    sync_dirty_pages(memory_p, MS_SYNC);
+    munmap(memory_p->ram_banks, save_p->size);
+    close(save_p->file);
+    free(save_p);
+    memory_p->ram_banks = NULL;
+    memory_p->save_p = NULL;
+}
+
+static unsigned long get_save_size(cartridge *cartridge_p){
+
+    if (!cartridge_p->battery){
+        return 0;
+    }
+    // MBC2 has 512 x 4 bits of RAM built in, the header says there's none
+    if (cartridge_p->cartridge_type == MBC2){
+        return MBC2_RAM_SIZE;
+    }
+    return cartridge_p->ram_banks * EXTERNAL_RAM_SIZE;
+}
+
+static void sync_dirty_pages(memory_map *memory_p, int flags){
+
+    battery_save *save_p = memory_p->save_p;
+    long host_page_size = sysconf(_SC_PAGESIZE);
+    int pages = (save_p->size + PAGE_SIZE - 1) / PAGE_SIZE;
+
+    for (int page = 0; page < pages; page++){
+        if (!save_p->dirty[page]){
+            continue;
+        }
+        int last = page;
+        while (last < pages && save_p->dirty[last]){
+            save_p->dirty[last] = FALSE;
+            last++;
+        }
+        // msync wants the start aligned on a host page
+        unsigned long start = (page * PAGE_SIZE) & ~(host_page_size - 1);
+        unsigned long end = (last * PAGE_SIZE < save_p->size) ? last * PAGE_SIZE : save_p->size;
+        msync(memory_p->ram_banks + start, end - start, flags);
+        page = last;
+    }
+    save_p->dirty_pages = 0;
+}
@@ -0,0 +1,28 @@
+#ifndef __SAVE_H__
+#define __SAVE_H__
+
+#include "environment.h"
+#include "memory.h"
+
+#define SAVE_FLUSH_CYCLES 4194304 // dirty pages are flushed about once per emulated second
+#define SAVE_PAGES (RAM_BANK_SIZE / PAGE_SIZE)
+
+/*
+    battery backed external RAM, the .sav file is mapped shared and becomes ram_banks.
+    the first write to a RAM page after a flush goes through the write handler to mark it dirty,
+    then the page is written directly until the next flush. flushing only asks the kernel to
+    start writing the dirty pages back, the emulation thread never waits on the disk.
+*/
+typedef struct battery_save{
+    int file;
+    unsigned long size;
+    byte dirty[SAVE_PAGES];
+    int dirty_pages;
+    unsigned long flushes;
+} battery_save;
+
+bool attach_battery_save(memory_map *memory_p, char *file_name);
+void mark_save_dirty(memory_map *memory_p, unsigned long offset);
+void flush_battery_save(memory_map *memory_p);
+void detach_battery_save(memory_map *memory_p);
+#endif
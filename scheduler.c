@@ -0,0 +1,72 @@
+#include "scheduler.h"
+
+static void update_next_event(scheduler *scheduler_p);
+
+scheduler *initialize_scheduler(){
+
+    scheduler *scheduler_p = calloc(sizeof(scheduler), 1);
+    for (int event = 0; event < EVENT_COUNT; event++){
+        scheduler_p->events[event] = EVENT_NEVER;
+    }
+    scheduler_p->next_event = EVENT_NEVER;
+    return scheduler_p;
+}
+
+// replaces the pending event of the slot if there was one
+void schedule_event(scheduler *scheduler_p, int event, unsigned long long timestamp){
+    unsigned long long previous = scheduler_p->events[event];
+    scheduler_p->events[event] = timestamp;
+
+    // the earliest event moved later, another slot might be next now
+    if (previous == scheduler_p->next_event && timestamp > previous){
+        update_next_event(scheduler_p);
+    }
+    else if (timestamp < scheduler_p->next_event){
+        scheduler_p->next_event = timestamp;
+    }
+}
+
+void cancel_event(scheduler *scheduler_p, int event){
+    scheduler_p->events[event] = EVENT_NEVER;
+    update_next_event(scheduler_p);
+}
+
+/*
+    remove the earliest event that is due at the current cycle and return its slot
+    timestamp_p gets the cycle it was scheduled for so periodic events don't drift
+    returns NO_EVENT once nothing is due anymore
+*/
+int pop_due_event(scheduler *scheduler_p, unsigned long long *timestamp_p){
+
+    if (scheduler_p->next_event > scheduler_p->cycles){
+        return NO_EVENT;
+    }
+
+    int due = NO_EVENT;
+    for (int event = 0; event < EVENT_COUNT; event++){
+        if (scheduler_p->events[event] <= scheduler_p->cycles && (due == NO_EVENT || scheduler_p->events[event] < scheduler_p->events[due])){
+            due = event;
+        }
+    }
+
+    if (due == NO_EVENT){
+        update_next_event(scheduler_p);
+        return NO_EVENT;
+    }
+
+    *timestamp_p = scheduler_p->events[due];
+    scheduler_p->events[due] = EVENT_NEVER;
+    scheduler_p->events_run++;
+    update_next_event(scheduler_p);
+    return due;
+}
+
+static void update_next_event(scheduler *scheduler_p){
+
+    scheduler_p->next_event = EVENT_NEVER;
+    for (int event = 0; event < EVENT_COUNT; event++){
+        if (scheduler_p->events[event] < scheduler_p->next_event){
+            scheduler_p->next_event = scheduler_p->events[event];
+        }
+    }
+}
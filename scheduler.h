@@ -0,0 +1,34 @@
+#ifndef __SCHEDULER_H__
+#define __SCHEDULER_H__
+
+#include "environment.h"
+
+// event slots, each subsystem has at most one pending event
+#define EVENT_PPU 0
+#define EVENT_DIVIDER 1
+#define EVENT_TIMER 2
+#define EVENT_DMA 3
+#define EVENT_SAVE 4
+#define EVENT_COUNT 5
+
+#define EVENT_NEVER 0xFFFFFFFFFFFFFFFFULL
+#define NO_EVENT -1
+
+/*
+    master clock and the timestamp of the next thing every subsystem has to do
+    the CPU runs until cycles reaches next_event, then the due events are popped
+    in timestamp order and their handlers schedule the following one.
+*/
+typedef struct scheduler {
+    unsigned long long cycles;
+    unsigned long long next_event;
+    unsigned long long events[EVENT_COUNT];
+    unsigned long events_run;
+} scheduler;
+
+scheduler *initialize_scheduler();
+void schedule_event(scheduler *scheduler_p, int event, unsigned long long timestamp);
+void cancel_event(scheduler *scheduler_p, int event);
+int pop_due_event(scheduler *scheduler_p, unsigned long long *timestamp_p);
+
+#endif
@@ -0,0 +1,61 @@
+#include "sprite_cache.h"
+
+static void sort_line(sprite_cache *cache_p, byte *oam_p, int line);
+
+// oam_p points to 0xFE00 in memory, Y and X are stored with a 16 and 8 pixels offset
+void update_sprite_lines(sprite_cache *cache_p, byte *oam_p, bool tall){
+
+    if (!cache_p->dirty && tall == cache_p->tall){
+        return;
+    }
+    int height = tall ? 16 : 8;
+    memset(cache_p->line_counts, 0, sizeof(cache_p->line_counts));
+
+    // OAM order, a line ignores the sprites after its 10th
+    for (int sprite = 0; sprite < SPRITE_COUNT; sprite++){
+        int top = oam_p[sprite * 4] - 16;
+        for (int line = (top < 0) ? 0 : top; (line < top + height) && (line < SPRITE_LINES); line++){
+            if (cache_p->line_counts[line] < SPRITES_PER_LINE){
+                cache_p->line_sprites[line][cache_p->line_counts[line]++] = sprite;
+            }
+        }
+    }
+    for (int line = 0; line < SPRITE_LINES; line++){
+        sort_line(cache_p, oam_p, line);
+    }
+    cache_p->dirty = FALSE;
+    cache_p->tall = tall;
+    cache_p->builds++;
+}
+
+// 8 color numbers of a sprite tile row, Y flips only change which row is asked for
+byte *get_sprite_row(sprite_cache *cache_p, tile_cache *tiles_p, byte tile, byte row, bool x_flip){
+
+    if (!x_flip){
+        return tiles_p->pixels[tile][row];
+    }
+    if (cache_p->flipped_generations[tile] != tiles_p->generations[tile]){
+        for (int flipped_row = 0; flipped_row < 8; flipped_row++){
+            for (int pixel = 0; pixel < 8; pixel++){
+                cache_p->flipped[tile][flipped_row][pixel] = tiles_p->pixels[tile][flipped_row][7 - pixel];
+            }
+        }
+        cache_p->flipped_generations[tile] = tiles_p->generations[tile];
+    }
+    return cache_p->flipped[tile][row];
+}
+
+// insertion sort on X, stable so OAM order breaks the ties
+static void sort_line(sprite_cache *cache_p, byte *oam_p, int line){
+
+    byte *sprites_p = cache_p->line_sprites[line];
+    for (int i = 1; i < cache_p->line_counts[line]; i++){
+        byte sprite = sprites_p[i];
+        int j = i;
+        while (j > 0 && oam_p[(sprites_p[j - 1] * 4) + 1] > oam_p[(sprite * 4) + 1]){
+            sprites_p[j] = sprites_p[j - 1];
+            j--;
+        }
+        sprites_p[j] = sprite;
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef __SPRITE_CACHE_H__
+#define __SPRITE_CACHE_H__
+
+#include "environment.h"
+#include "tile_cache.h"
+
+#define SPRITE_COUNT 40
+#define SPRITES_PER_LINE 10
+#define SPRITE_LINES 144 // visible lines
+#define SPRITE_TILES 256 // sprites only use the tiles at 0x8000 - 0x8FFF
+
+/*
+    OAM parsed into the sprites of every line, rebuilt the first time a line is drawn after OAM
+    or the sprite size changed. a line keeps the first 10 sprites of OAM that cover it,
+    sorted by drawing priority : lower X first, OAM order on ties.
+    rows of the sprite tiles are taken from the tile cache, the X flipped rows are kept here
+    and flipped again when the tile cache decoded the tile since.
+*/
+typedef struct sprite_cache{
+    byte line_sprites[SPRITE_LINES][SPRITES_PER_LINE]; // OAM index of the sprites, highest priority first
+    byte line_counts[SPRITE_LINES];
+    bool dirty;
+    bool tall; // the lists were built for 8x16 sprites
+    unsigned long builds;
+    byte flipped[SPRITE_TILES][8][8];
+    unsigned long flipped_generations[SPRITE_TILES];
+} sprite_cache;
+
+void update_sprite_lines(sprite_cache *cache_p, byte *oam_p, bool tall);
+byte *get_sprite_row(sprite_cache *cache_p, tile_cache *tiles_p, byte tile, byte row, bool x_flip);
+#endif
@@ -0,0 +1,50 @@
+#include "tile_cache.h"
+
+#define TILE_DATA_INDEX 0x8000
+
+static void decode_tile(tile_cache *cache_p, int tile, byte *tile_p);
+
+// address is a VRAM address in 0x8000 - 0x97FF
+void mark_tile_dirty(tile_cache *cache_p, word address){
+    int tile = (address - TILE_DATA_INDEX) / 16;
+    if (!cache_p->dirty[tile]){
+        cache_p->dirty[tile] = TRUE;
+        cache_p->dirty_count++;
+    }
+}
+
+// VRAM was changed without going through write_memory
+void invalidate_tile_cache(tile_cache *cache_p){
+    memset(cache_p->dirty, TRUE, sizeof(cache_p->dirty));
+    cache_p->dirty_count = TILE_COUNT;
+}
+
+// tile_data_p points to 0x8000 in memory
+void update_tile_cache(tile_cache *cache_p, byte *tile_data_p){
+
+    if (cache_p->dirty_count == 0){
+        return;
+    }
+    for (int tile = 0; tile < TILE_COUNT; tile++){
+        if (cache_p->dirty[tile]){
+            decode_tile(cache_p, tile, &tile_data_p[tile * 16]);
+            cache_p->dirty[tile] = FALSE;
+        }
+    }
+    cache_p->dirty_count = 0;
+}
+
+// each row is 2 bytes, bit 7 is the leftmost pixel, the second byte holds the high bit of the color
+static void decode_tile(tile_cache *cache_p, int tile, byte *tile_p){
+
+    for (int row = 0; row < 8; row++){
+        byte low = tile_p[row * 2];
+        byte high = tile_p[(row * 2) + 1];
+        for (int pixel = 0; pixel < 8; pixel++){
+            int bit = 7 - pixel;
+            cache_p->pixels[tile][row][pixel] = (((high >> bit) & 1) << 1) | ((low >> bit) & 1);
+        }
+    }
+    cache_p->decoded_tiles++;
+    cache_p->generations[tile] = cache_p->decoded_tiles;
+}
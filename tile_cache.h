@@ -0,0 +1,25 @@
+#ifndef __TILE_CACHE_H__
+#define __TILE_CACHE_H__
+
+#include "environment.h"
+
+#define TILE_COUNT 384 // 0x8000 - 0x97FF
+#define TILE_DATA_SIZE (TILE_COUNT * 16)
+
+/*
+    every VRAM tile decoded to 8x8 color numbers (0-3) before palette lookup
+    VRAM writes to the tile data only flag the tile, it's decoded again
+    by update_tile_cache the next time a scanline is drawn.
+*/
+typedef struct tile_cache{
+    byte pixels[TILE_COUNT][8][8];
+    byte dirty[TILE_COUNT];
+    int dirty_count;
+    unsigned long decoded_tiles;
+    unsigned long generations[TILE_COUNT]; // value of decoded_tiles when each tile was last decoded
+} tile_cache;
+
+void mark_tile_dirty(tile_cache *cache_p, word address);
+void invalidate_tile_cache(tile_cache *cache_p);
+void update_tile_cache(tile_cache *cache_p, byte *tile_data_p);
+#endif
@@ -0,0 +1,81 @@
+#include "trace.h"
+
+#ifdef TRACE
+
+typedef struct trace_event_info {
+    const char *name;
+    const char *format;
+} trace_event_info;
+
+static const trace_event_info trace_event_table[TRACE_EVENT_COUNT] = {
+    [TRACE_EXECUTE_OPCODE] = { "OPCODE", "0x%02X at PC 0x%04X" },
+    [TRACE_EXECUTE_EXTENDED] = { "EXTENDED OPCODE", "0x%02X" },
+    [TRACE_LOAD] = { "LOAD", "0x%02X" },
+    [TRACE_DEC] = { "DEC", "result 0x%02X" },
+    [TRACE_JP] = { "JP", "0x%04X conditional %u" },
+    [TRACE_JR] = { "JR", "new PC 0x%04X conditional %u" },
+    [TRACE_POP] = { "POPPED", "0x%04X" },
+    [TRACE_WRITE_MEMORY] = { "WRITE", "0x%04X data 0x%02X" },
+};
+
+byte trace_level = TRACE_LEVEL_DEBUG;
+byte trace_categories = TRACE_ALL;
+
+static trace_record trace_buffer[TRACE_BUFFER_SIZE];
+static unsigned long trace_head;
+
+void trace_configure(byte level, byte categories){
+    trace_level = level;
+    trace_categories = categories;
+}
+
+/*
+    claim a slot with a single atomic increment, fill it and publish it through its sequence
+    a writer never waits, when the buffer wraps the oldest records are overwritten
+*/
+void trace_write(trace_event event, unsigned short first, unsigned int second){
+
+    unsigned long index = __atomic_fetch_add(&trace_head, 1, __ATOMIC_RELAXED);
+    trace_record *record_p = &trace_buffer[index & (TRACE_BUFFER_SIZE - 1)];
+
+    record_p->event = event;
+    record_p->first = first;
+    record_p->second = second;
+    __atomic_store_n(&record_p->sequence, index + 1, __ATOMIC_RELEASE);
+}
+
+// number of records written since the last reset, including the overwritten ones
+unsigned long trace_count(){
+    return __atomic_load_n(&trace_head, __ATOMIC_ACQUIRE);
+}
+
+void trace_dump(FILE *file_p){
+
+    unsigned long head = trace_count();
+    unsigned long start = head > TRACE_BUFFER_SIZE ? head - TRACE_BUFFER_SIZE : 0;
+
+    if (start > 0){
+        fprintf(file_p, "TRACE : %lu older records were overwritten\n", start);
+    }
+
+    for (unsigned long index = start; index < head; index++){
+        trace_record *record_p = &trace_buffer[index & (TRACE_BUFFER_SIZE - 1)];
+
+        // still being written or already replaced by a newer record
+        if (__atomic_load_n(&record_p->sequence, __ATOMIC_ACQUIRE) != index + 1){
+            continue;
+        }
+
+        const trace_event_info *info_p = &trace_event_table[record_p->event];
+        fprintf(file_p, "%lu %s : ", index, info_p->name);
+        fprintf(file_p, info_p->format, record_p->first, record_p->second);
+        fprintf(file_p, "\n");
+    }
+}
+
+void trace_reset(){
+    memset(trace_buffer, 0, sizeof(trace_buffer));
+    __atomic_store_n(&trace_head, 0, __ATOMIC_RELEASE);
+}
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include "environment.h"
+
+/*
+    trace / log subsystem, compiled out entirely unless built with -DTRACE
+    hot paths only store a small binary record in a lock-free ring buffer,
+    the records are decoded to text by trace_dump once the run is over.
+    add -DTRACE_MAX_LEVEL=n to also compile out the levels above n.
+*/
+
+// levels
+#define TRACE_LEVEL_ERROR 0
+#define TRACE_LEVEL_WARN 1
+#define TRACE_LEVEL_INFO 2
+#define TRACE_LEVEL_DEBUG 3
+
+// categories
+#define TRACE_CPU 0x01
+#define TRACE_MEMORY 0x02
+#define TRACE_JUMP 0x04
+#define TRACE_STACK 0x08
+#define TRACE_ALL 0xFF
+
+#ifndef TRACE_MAX_LEVEL
+#define TRACE_MAX_LEVEL TRACE_LEVEL_DEBUG
+#endif
+
+// must be a power of 2, older records are overwritten once the buffer is full
+#define TRACE_BUFFER_SIZE (1 << 20)
+
+typedef enum trace_event {
+    TRACE_EXECUTE_OPCODE,       // opcode, PC
+    TRACE_EXECUTE_EXTENDED,     // CB opcode
+    TRACE_LOAD,                 // data
+    TRACE_DEC,                  // result
+    TRACE_JP,                   // address, conditional
+    TRACE_JR,                   // new PC, conditional
+    TRACE_POP,                  // value
+    TRACE_WRITE_MEMORY,         // address, data
+    TRACE_EVENT_COUNT
+} trace_event;
+
+typedef struct trace_record {
+    unsigned long sequence;     // index + 1 once the record is complete
+    unsigned short event;
+    unsigned short first;
+    unsigned int second;
+} trace_record;
+
+#ifdef TRACE
+
+extern byte trace_level;
+extern byte trace_categories;
+
+#define TRACE_LOG(level, category, event, first, second) \
+    do { \
+        if ((level) <= TRACE_MAX_LEVEL && (level) <= trace_level && ((category) & trace_categories)){ \
+            trace_write((event), (first), (second)); \
+        } \
+    } while (0)
+
+void trace_configure(byte level, byte categories);
+void trace_write(trace_event event, unsigned short first, unsigned int second);
+unsigned long trace_count();
+void trace_dump(FILE *file_p);
+void trace_reset();
+
+#else
+
+#define TRACE_LOG(level, category, event, first, second) ((void) 0)
+
+#endif
+
+#endif
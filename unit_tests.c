@@ -1,8 +1,18 @@
+#include <unistd.h>
+#include <sys/stat.h>
 #include "minunit.h"
 #include "cartridge.h"
 #include "memory.h"
 #include "environment.h"
 #include "cpu.h"
+#include "gameboy.h"
+#include "rom_registry.h"
+#include "block_cache.h"
+#include "jit.h"
+#include "trace.h"
+#include "save.h"
+#include "renderer.h"
+#include "render_thread.h"
 
 #define ZERO_FLAG 7
 #define SUBTRACT_FLAG 6
@@ -20,14 +30,14 @@ void test_setup(void){
     cartridge_p = initialize_cartridge(file_name); 
     memory_p = initialize_memory(cartridge_p);
     cpu_p = initialize_cpu(memory_p);
-    initialize_emulator_state(cpu_p, memory_p);
+    initialize_game_state(cpu_p, memory_p);
 }
 
 void test_teardown(void){
-    free(cartridge_p);
+    free_cartridge(cartridge_p);
     cartridge_p = NULL;
 
-    free(memory_p);
+    free_memory(memory_p);
     memory_p = NULL;
     
     free(cpu_p);
@@ -43,6 +53,10 @@ MU_TEST(test_initialize_cartridge_tetris){
     mu_check(cartridge_p->ram_banks == 0);
     mu_check(cartridge_p->gameboy_type == 0);
 
+    // 32 KB image shared through the page cache
+    mu_check(cartridge_p->rom_size == 0x8000);
+    mu_check(cartridge_p->mapped == TRUE);
+
 }
 
 MU_TEST(test_initialize_emulate_state){
@@ -105,6 +119,130 @@ MU_TEST(test_read_memory_rom_no_switch){
     mu_check(read_memory(memory_p, 0x4000) == memory_p->memory[0x4000]);
 }
 
+MU_TEST(test_memory_pages_bank_switch){
+
+    cartridge *mbc1_cartridge_p = initialize_empty_cartridge(MBC1, 8);
+    for (int bank = 0; bank < 8; bank++){
+        mbc1_cartridge_p->cartridge_memory[bank * 0x4000] = bank;
+    }
+    memory_map *mbc1_memory_p = initialize_memory(mbc1_cartridge_p);
+
+    mu_check(read_memory(mbc1_memory_p, 0x4000) == 1);
+    write_memory(mbc1_memory_p, 0x2000, 3);
+    mu_check(read_memory(mbc1_memory_p, 0x4000) == 3);
+
+    // external RAM ignores writes until it's enabled
+    write_memory(mbc1_memory_p, 0xA000, 0x42);
+    mu_check(read_memory(mbc1_memory_p, 0xA000) == 0x00);
+    write_memory(mbc1_memory_p, 0x0000, 0x0A);
+    write_memory(mbc1_memory_p, 0xA000, 0x42);
+    mu_check(read_memory(mbc1_memory_p, 0xA000) == 0x42);
+
+    // echo RAM reads WRAM
+    write_memory(mbc1_memory_p, 0xC010, 0x24);
+    mu_check(read_memory(mbc1_memory_p, 0xE010) == 0x24);
+
+    free_memory(mbc1_memory_p);
+    free_cartridge(mbc1_cartridge_p);
+}
+
+MU_TEST(test_mbc_banks){
+
+    cartridge *mbc_cartridges_p[3] = {
+        initialize_empty_cartridge(MBC1, 128), initialize_empty_cartridge(MBC3, 128), initialize_empty_cartridge(MBC5, 512)
+    };
+    memory_map *mbc_memory_p[3];
+    for (int i = 0; i < 3; i++){
+        for (int bank = 0; bank < mbc_cartridges_p[i]->rom_banks; bank++){
+            mbc_cartridges_p[i]->cartridge_memory[bank * 0x4000] = bank;
+            mbc_cartridges_p[i]->cartridge_memory[bank * 0x4000 + 1] = bank >> 8;
+        }
+        mbc_cartridges_p[i]->ram_banks = 4;
+        mbc_memory_p[i] = initialize_memory(mbc_cartridges_p[i]);
+    }
+
+    // MBC1 : BANK1 0 selects 1, BANK2 adds bits 5-6, mode 1 also switches the fixed window and RAM
+    memory_map *mbc1_p = mbc_memory_p[0];
+    write_memory(mbc1_p, 0x2000, 0x00);
+    write_memory(mbc1_p, 0x4000, 0x02);
+    mu_check(read_memory(mbc1_p, 0x4000) == 0x41);
+    mu_check(read_memory(mbc1_p, 0x0000) == 0x00);
+    write_memory(mbc1_p, 0x6000, 0x01);
+    mu_check(read_memory(mbc1_p, 0x0000) == 0x40);
+    mu_check(mbc1_p->current_ram_bank == 2);
+
+    // MBC3 : 7 bits ROM bank, RTC registers read through the RAM window once latched
+    memory_map *mbc3_p = mbc_memory_p[1];
+    write_memory(mbc3_p, 0x2000, 0x7F);
+    mu_check(read_memory(mbc3_p, 0x4000) == 0x7F);
+    write_memory(mbc3_p, 0x0000, 0x0A);
+    write_memory(mbc3_p, 0x4000, 0x02);
+    write_memory(mbc3_p, 0xA000, 0x42);
+    mu_check(mbc3_p->ram_banks[2 * 0x2000] == 0x42);
+    mbc3_p->mbc.rtc_time -= 3661;
+    write_memory(mbc3_p, 0x6000, 0x00);
+    write_memory(mbc3_p, 0x6000, 0x01);
+    write_memory(mbc3_p, 0x4000, 0x08 + RTC_SECONDS);
+    mu_check(read_memory(mbc3_p, 0xA000) >= 1);
+    write_memory(mbc3_p, 0x4000, 0x08 + RTC_HOURS);
+    mu_check(read_memory(mbc3_p, 0xBFFF) == 1);
+    write_memory(mbc3_p, 0xA000, 0x05);
+    mu_check(read_memory(mbc3_p, 0xA000) == 0x05);
+
+    // MBC5 : 9 bits ROM bank, bank 0 can be mapped in the switchable window
+    memory_map *mbc5_p = mbc_memory_p[2];
+    write_memory(mbc5_p, 0x2000, 0x2C);
+    write_memory(mbc5_p, 0x3000, 0x01);
+    mu_check(read_memory(mbc5_p, 0x4000) == 0x2C && read_memory(mbc5_p, 0x4001) == 0x01);
+    mu_check(mbc5_p->current_rom_bank == 0x12C);
+    write_memory(mbc5_p, 0x2000, 0x00);
+    write_memory(mbc5_p, 0x3000, 0x00);
+    mu_check(mbc5_p->current_rom_bank == 0);
+
+    for (int i = 0; i < 3; i++){
+        free_memory(mbc_memory_p[i]);
+        free_cartridge(mbc_cartridges_p[i]);
+    }
+}
+
+MU_TEST(test_battery_save){
+
+    char *save_name = "unit_tests.sav";
+    unlink(save_name);
+    cartridge *save_cartridge_p = initialize_empty_cartridge(MBC1, 4);
+    save_cartridge_p->ram_banks = 1;
+    save_cartridge_p->battery = TRUE;
+
+    gb_context *gb_p = initialize_gb_context(save_cartridge_p);
+    mu_check(attach_battery_save(gb_p->memory_p, save_name));
+    battery_save *save_p = gb_p->memory_p->save_p;
+
+    // the first write of a page marks it dirty and maps it, the next ones are direct
+    write_memory(gb_p->memory_p, 0x0000, 0x0A);
+    write_memory(gb_p->memory_p, 0xA000, 0x42);
+    write_memory(gb_p->memory_p, 0xA001, 0x43);
+    write_memory(gb_p->memory_p, 0xB000, 0x44);
+    mu_check(save_p->dirty_pages == 2);
+    mu_check(gb_p->memory_p->write_pages[0xA0] != NULL && gb_p->memory_p->write_pages[0xA1] == NULL);
+
+    // flushed by the timer, then when RAM is disabled
+    advance_cycles(gb_p, SAVE_FLUSH_CYCLES);
+    mu_check(save_p->flushes == 1 && save_p->dirty_pages == 0);
+    mu_check(gb_p->memory_p->write_pages[0xA0] == NULL);
+    write_memory(gb_p->memory_p, 0xA002, 0x45);
+    write_memory(gb_p->memory_p, 0x0000, 0x00);
+    mu_check(save_p->flushes == 2);
+    free_gb_context(gb_p);
+
+    byte saved[3];
+    FILE *save_file_p = fopen(save_name, "rb");
+    mu_check(save_file_p != NULL);
+    fread(saved, 1, sizeof(saved), save_file_p);
+    fclose(save_file_p);
+    unlink(save_name);
+    mu_check(saved[0] == 0x42 && saved[1] == 0x43 && saved[2] == 0x45);
+}
+
 MU_TEST(test_read_memory_external_ram_no_switch){
     mu_check(read_memory(memory_p, 0xA000) == memory_p->memory[0xA000]);
 }
@@ -393,6 +531,880 @@ MU_TEST(test_write_SP){
     
 }
 
+MU_TEST(test_alu_flags){
+
+    // ADD A, B : 0x3A + 0xC6
+    cpu_p->AF.hi = 0x3A;
+    cpu_p->BC.hi = 0xC6;
+    execute_opcode(cpu_p, 0x80);
+    mu_check(cpu_p->AF.hi == 0x00);
+    mu_check(cpu_p->AF.lo == 0xB0);
+
+    // SBC A, H : 0x3B - 0x2A - carry
+    cpu_p->AF.hi = 0x3B;
+    cpu_p->HL.hi = 0x2A;
+    execute_opcode(cpu_p, 0x9C);
+    mu_check(cpu_p->AF.hi == 0x10);
+    mu_check(cpu_p->AF.lo == 0x40);
+
+    // CP E : 0x10 - 0x11 borrows from both nibbles
+    cpu_p->DE.lo = 0x11;
+    execute_opcode(cpu_p, 0xBB);
+    mu_check(cpu_p->AF.hi == 0x10);
+    mu_check(cpu_p->AF.lo == 0x70);
+
+    // INC A keeps the carry of CP
+    execute_opcode(cpu_p, 0x3C);
+    mu_check(cpu_p->AF.hi == 0x11);
+    mu_check(cpu_p->AF.lo == 0x10);
+
+    // DEC A twice, the second one borrows from the low nibble
+    execute_opcode(cpu_p, 0x3D);
+    execute_opcode(cpu_p, 0x3D);
+    mu_check(cpu_p->AF.hi == 0x0F);
+    mu_check(cpu_p->AF.lo == 0x70);
+}
+
+MU_TEST(test_execute_cached_block){
+
+    // LD A, 0x12 / INC A / LD B, A / JP 0x0150
+    byte program[] = { 0x3E, 0x12, 0x3C, 0x47, 0xC3, 0x50, 0x01 };
+    memcpy(&cpu_p->memory_p->memory[0x150], program, sizeof(program));
+    cpu_p->block_cache_p = initialize_block_cache();
+    cpu_p->PC = 0x150;
+
+    mu_check(execute_next_block(cpu_p) == 28);
+    mu_check(cpu_p->AF.hi == 0x13);
+    mu_check(cpu_p->BC.hi == 0x13);
+    mu_check(cpu_p->PC == 0x150);
+    mu_check(cpu_p->block_cache_p->misses == 1);
+
+    execute_next_block(cpu_p);
+    mu_check(cpu_p->AF.hi == 0x13);
+    mu_check(cpu_p->block_cache_p->hits == 1);
+
+    free(cpu_p->block_cache_p);
+}
+
+MU_TEST(test_boot_rom){
+
+    // LD A, 0x01 / LDH (0x50), A, the cartridge shows through after the write
+    byte boot_rom[BOOT_ROM_SIZE] = { 0x3E, 0x01, 0xE0, 0x50 };
+    memory_p->memory[0x0000] = 0x04; // INC B
+    map_boot_rom(memory_p, boot_rom);
+    mu_check(read_memory(memory_p, 0x0000) == 0x3E);
+    mu_check(read_memory(memory_p, 0x0100) == memory_p->memory[0x0100]);
+
+    cpu_p->block_cache_p = initialize_block_cache();
+    cpu_p->PC = 0x0000;
+    execute_next_block(cpu_p);
+    mu_check(cpu_p->PC == 0x0004);
+    mu_check(memory_p->boot_rom_p == NULL);
+    mu_check(read_memory(memory_p, 0x0000) == 0x04);
+
+    // the block decoded from the boot ROM isn't matched again
+    byte b = cpu_p->BC.hi;
+    cpu_p->PC = 0x0000;
+    execute_next_block(cpu_p);
+    mu_check(cpu_p->block_cache_p->misses == 2);
+    mu_check(cpu_p->BC.hi == (byte) (b + 1));
+
+    free(cpu_p->block_cache_p);
+    cpu_p->block_cache_p = NULL;
+}
+
+MU_TEST(test_block_cache_rom0_bank){
+
+    /*
+        bank 0x00 : LD A, 0x01 / LD (0x6000), A / INC B / JP 0x0150
+        bank 0x20 : LD A, 0x00 / LD (0x6000), A / DEC B / JP 0x0150
+        with BANK2 = 1 the MBC1 mode write swaps the bank seen in 0x0000 - 0x3FFF under the block
+    */
+    byte programs[2][9] = {
+        { 0x3E, 0x01, 0xEA, 0x00, 0x60, 0x04, 0xC3, 0x50, 0x01 },
+        { 0x3E, 0x00, 0xEA, 0x00, 0x60, 0x05, 0xC3, 0x50, 0x01 }
+    };
+    cartridge *mbc1_cartridge_p = initialize_empty_cartridge(MBC1, 128);
+    memcpy(&mbc1_cartridge_p->cartridge_memory[0x150], programs[0], 9);
+    memcpy(&mbc1_cartridge_p->cartridge_memory[0x20 * 0x4000 + 0x150], programs[1], 9);
+    memory_map *mbc1_memory_p = initialize_memory(mbc1_cartridge_p);
+    write_memory(mbc1_memory_p, 0x4000, 0x01);
+
+    cpu *mbc1_cpu_p = initialize_cpu(mbc1_memory_p);
+    mbc1_cpu_p->block_cache_p = initialize_block_cache();
+    mbc1_cpu_p->jit_p = initialize_jit_compiler();
+    mbc1_cpu_p->PC = 0x150;
+    mbc1_cpu_p->BC.hi = 0;
+
+    // past JIT_HOT_THRESHOLD the compiled blocks have to leave at the same writes
+    for (int i = 0; i < 2 * JIT_HOT_THRESHOLD; i++){
+        execute_next_block(mbc1_cpu_p);
+        mu_check(mbc1_memory_p->current_rom0_bank == 0x20 && mbc1_cpu_p->PC == 0x155 && mbc1_cpu_p->BC.hi == 0x00);
+        execute_next_block(mbc1_cpu_p);
+        mu_check(mbc1_cpu_p->PC == 0x150 && mbc1_cpu_p->BC.hi == 0xFF);
+        execute_next_block(mbc1_cpu_p);
+        mu_check(mbc1_memory_p->current_rom0_bank == 0x00 && mbc1_cpu_p->PC == 0x155 && mbc1_cpu_p->BC.hi == 0xFF);
+        execute_next_block(mbc1_cpu_p);
+        mu_check(mbc1_cpu_p->PC == 0x150 && mbc1_cpu_p->BC.hi == 0x00);
+    }
+
+    mu_check(mbc1_cpu_p->jit_p == NULL || mbc1_cpu_p->jit_p->compiled_blocks == 4);
+    free_jit_compiler(mbc1_cpu_p->jit_p);
+    free(mbc1_cpu_p->block_cache_p);
+    free(mbc1_cpu_p);
+    free_memory(mbc1_memory_p);
+    free_cartridge(mbc1_cartridge_p);
+}
+
+#ifdef TRACE
+MU_TEST(test_trace_categories){
+
+    // LD B, 0x42 / LD (HL), B with HL = 0xC000
+    cpu_p->HL.hi = 0xC0;
+    cpu_p->HL.lo = 0x00;
+    memory_p->memory[0xC100] = 0x06;
+    memory_p->memory[0xC101] = 0x42;
+    memory_p->memory[0xC102] = 0x70;
+
+    trace_reset();
+    trace_configure(TRACE_LEVEL_DEBUG, TRACE_MEMORY);
+    cpu_p->PC = 0xC100;
+    execute_next_block(cpu_p);
+    execute_next_block(cpu_p);
+    mu_check(trace_count() == 1);
+
+    trace_reset();
+    trace_configure(TRACE_LEVEL_INFO, TRACE_ALL);
+    cpu_p->PC = 0xC100;
+    execute_next_block(cpu_p);
+    mu_check(trace_count() == 0);
+
+    trace_configure(TRACE_LEVEL_DEBUG, TRACE_ALL);
+    trace_reset();
+}
+#endif
+
+MU_TEST(test_jit_matches_interpreter){
+
+    /*
+        LD B, 0x20 / LD HL, 0xC000 / LD A, 5
+        loop : LD (HLI), A / INC A / XOR 0x5A / LD C, A / ADD A, C / DEC B / JR NZ, loop
+        DEC HL / LD A, (HL) / AND 0x0F / LD HL, 0xE005 / LD E, (HL) / PUSH BC / JP 0x0150
+        E005 is echo RAM, it reads the WRAM byte written by the loop
+    */
+    byte program[] = {
+        0x06, 0x20, 0x21, 0x00, 0xC0, 0x3E, 0x05,
+        0x22, 0x3C, 0xEE, 0x5A, 0x4F, 0x81, 0x05, 0x20, 0xF7,
+        0x2B, 0x7E, 0xE6, 0x0F, 0x21, 0x05, 0xE0, 0x5E, 0xC5, 0xC3, 0x50, 0x01
+    };
+    memcpy(&cpu_p->memory_p->memory[0x150], program, sizeof(program));
+    cpu_p->PC = 0x150;
+    cpu_p->block_cache_p = initialize_block_cache();
+
+    memory_map *jit_memory_p = initialize_memory(cartridge_p);
+    cpu *jit_cpu_p = initialize_cpu(jit_memory_p);
+    byte *jit_ram_banks = jit_memory_p->ram_banks;
+    memcpy(jit_memory_p, cpu_p->memory_p, sizeof(memory_map));
+    jit_memory_p->ram_banks = jit_ram_banks;
+    memcpy(jit_memory_p->ram_banks, cpu_p->memory_p->ram_banks, RAM_BANK_SIZE);
+    map_memory_pages(jit_memory_p);
+    *jit_cpu_p = *cpu_p;
+    jit_cpu_p->memory_p = jit_memory_p;
+    jit_cpu_p->block_cache_p = initialize_block_cache();
+    jit_cpu_p->jit_p = initialize_jit_compiler();
+
+    // hosts without the recompiler keep running the interpreter
+    if (jit_cpu_p->jit_p != NULL){
+        mu_check(run_opcodes(jit_cpu_p, 60000) == run_opcodes(cpu_p, 60000));
+        mu_check(jit_cpu_p->jit_p->compiled_blocks > 0);
+        mu_check(memcmp(&jit_cpu_p->AF, &cpu_p->AF, sizeof(cpu_register) * 5) == 0);
+        mu_check(jit_cpu_p->PC == cpu_p->PC);
+        mu_check(memcmp(jit_memory_p->memory, cpu_p->memory_p->memory, MEMORY_SIZE) == 0);
+    }
+
+    free_jit_compiler(jit_cpu_p->jit_p);
+    free(jit_cpu_p->block_cache_p);
+    free(cpu_p->block_cache_p);
+    free(jit_cpu_p);
+    free_memory(jit_memory_p);
+}
+
+MU_TEST(test_jit_timed_dma){
+
+    // LD HL, 0xC000 / LD A, 0xC1 / LDH (0x46), A / INC B / LD (HL), B / JP 0x0150
+    byte program[] = { 0x21, 0x00, 0xC0, 0x3E, 0xC1, 0xE0, 0x46, 0x04, 0x70, 0xC3, 0x50, 0x01 };
+    gb_context *gb_p = initialize_gb_context(initialize_cartridge(file_name));
+    initialize_game_state(gb_p->cpu_p, gb_p->memory_p);
+    memcpy(&gb_p->memory_p->memory[0x150], program, sizeof(program));
+    gb_p->memory_p->dma_mode = DMA_TIMED;
+    gb_p->cpu_p->block_cache_p = initialize_block_cache();
+    gb_p->cpu_p->jit_p = initialize_jit_compiler();
+
+    // the WRAM write after the DMA started is dropped by the compiled block as well
+    int written = 0;
+    for (int i = 0; i < 2 * JIT_HOT_THRESHOLD; i++){
+        gb_p->memory_p->memory[0xC000] = 0;
+        gb_p->cpu_p->PC = 0x150;
+        execute_next_block(gb_p->cpu_p);
+        written += gb_p->memory_p->memory[0xC000] != 0;
+        advance_cycles(gb_p, 700);
+        mu_check(!gb_p->memory_p->dma_active);
+    }
+    mu_check(written == 0);
+    mu_check(gb_p->cpu_p->jit_p == NULL || gb_p->cpu_p->jit_p->compiled_blocks == 1);
+
+    free_gb_context(gb_p);
+}
+
+MU_TEST(test_independent_contexts){
+
+    gb_context *first_p = initialize_gb_context(initialize_cartridge(file_name));
+    gb_context *second_p = initialize_gb_context(initialize_cartridge(file_name));
+
+    // INC B / JR -3
+    byte program[] = { 0x04, 0x18, 0xFD };
+    gb_context *contexts[] = { first_p, second_p };
+    for (int i = 0; i < 2; i++){
+        initialize_game_state(contexts[i]->cpu_p, contexts[i]->memory_p);
+        memcpy(&contexts[i]->memory_p->memory[0xC000], program, sizeof(program));
+        contexts[i]->cpu_p->PC = 0xC000;
+    }
+
+    emulate_frame(first_p);
+
+    mu_check(first_p->cpu_p->BC.hi != 0x00);
+    mu_check(first_p->memory_p->memory[LY_INDEX] != 0);
+    mu_check(FRAMEBUFFER_LINE(&first_p->framebuffer, 0)[0] == 255);
+
+    mu_check(second_p->cpu_p->BC.hi == 0x00);
+    mu_check(second_p->cpu_p->PC == 0xC000);
+    mu_check(second_p->memory_p->memory[LY_INDEX] == 0);
+    mu_check(second_p->scheduler_p->cycles == 0);
+    mu_check(FRAMEBUFFER_LINE(&second_p->framebuffer, 0)[0] == 0);
+
+    free_gb_context(first_p);
+    free_gb_context(second_p);
+}
+
+MU_TEST(test_rom_registry){
+
+    int registered = get_registered_cartridges();
+    gb_context *first_p = initialize_gb_context(acquire_cartridge(file_name));
+    gb_context *second_p = initialize_gb_context(acquire_cartridge(file_name));
+    gb_context *third_p = initialize_gb_context(retain_cartridge(first_p->cartridge_p));
+
+    // one image with its header parsed once for every instance
+    mu_check(get_registered_cartridges() == registered + 1);
+    mu_check(first_p->cartridge_p == second_p->cartridge_p);
+    mu_check(third_p->cartridge_p == first_p->cartridge_p);
+    mu_assert_string_eq((char *) third_p->cartridge_p->game_title, "TETRIS");
+
+    // the same bytes under another name share the image, the name is kept for the next acquire
+    cartridge *alias_p = acquire_cartridge("./Tetris.gb");
+    mu_check(alias_p == first_p->cartridge_p);
+    mu_check(acquire_cartridge("./Tetris.gb") == alias_p);
+    mu_check(get_registered_cartridges() == registered + 1);
+    release_cartridge(alias_p);
+    release_cartridge(alias_p);
+
+    free_gb_context(first_p);
+    free_gb_context(second_p);
+    mu_check(get_registered_cartridges() == registered + 1);
+    mu_check(read_memory(third_p->memory_p, 0x4000) == third_p->cartridge_p->cartridge_memory[0x4000]);
+
+    free_gb_context(third_p);
+    mu_check(get_registered_cartridges() == registered);
+}
+
+MU_TEST(test_scheduler_events){
+
+    gb_context *gb_p = initialize_gb_context(initialize_cartridge(file_name));
+    initialize_game_state(gb_p->cpu_p, gb_p->memory_p);
+    gb_p->memory_p->memory[INTERRUPT_REQUEST_INDEX] = 0;
+    byte divider = gb_p->memory_p->memory[0xFF04];
+
+    // LY 144 starts V-BLANK and requests its interrupt
+    advance_cycles(gb_p, 456 * 144);
+    mu_check(gb_p->memory_p->memory[LY_INDEX] == 144);
+    mu_check((gb_p->memory_p->memory[LCDC_STATUS_INDEX] & 0x3) == LCD_MODE_VBLANK);
+    mu_check(TEST_BIT(gb_p->memory_p->memory[INTERRUPT_REQUEST_INDEX], INTERRUPT_VBLANK));
+
+    // back to line 0 in OAM search after the 10 V-BLANK lines
+    advance_cycles(gb_p, 456 * 10);
+    mu_check(gb_p->memory_p->memory[LY_INDEX] == 0);
+    mu_check((gb_p->memory_p->memory[LCDC_STATUS_INDEX] & 0x3) == LCD_MODE_OAM);
+    mu_check(gb_p->memory_p->memory[0xFF04] == (byte) (divider + (456 * 154) / 256));
+
+    // events come out in timestamp order
+    scheduler *scheduler_p = initialize_scheduler();
+    unsigned long long timestamp;
+    schedule_event(scheduler_p, EVENT_TIMER, 30);
+    schedule_event(scheduler_p, EVENT_PPU, 10);
+    schedule_event(scheduler_p, EVENT_DMA, 20);
+    scheduler_p->cycles = 25;
+    mu_check(pop_due_event(scheduler_p, &timestamp) == EVENT_PPU && timestamp == 10);
+    mu_check(pop_due_event(scheduler_p, &timestamp) == EVENT_DMA && timestamp == 20);
+    mu_check(pop_due_event(scheduler_p, &timestamp) == NO_EVENT);
+    mu_check(scheduler_p->next_event == 30);
+
+    // moving the earliest event later makes the next one the earliest
+    schedule_event(scheduler_p, EVENT_DMA, 40);
+    schedule_event(scheduler_p, EVENT_TIMER, 50);
+    mu_check(scheduler_p->next_event == 40);
+    schedule_event(scheduler_p, EVENT_DMA, 60);
+    mu_check(scheduler_p->next_event == 50);
+    scheduler_p->cycles = 45;
+    mu_check(pop_due_event(scheduler_p, &timestamp) == NO_EVENT);
+    scheduler_p->cycles = 55;
+    mu_check(pop_due_event(scheduler_p, &timestamp) == EVENT_TIMER && timestamp == 50);
+    mu_check(scheduler_p->next_event == 60);
+
+    free(scheduler_p);
+    free_gb_context(gb_p);
+}
+
+MU_TEST(test_halt_skips_to_interrupt){
+
+    gb_context *gb_p = initialize_gb_context(initialize_cartridge(file_name));
+    initialize_game_state(gb_p->cpu_p, gb_p->memory_p);
+
+    // loop : HALT / INC B / JR loop, woken up by V-BLANK
+    byte program[] = { 0x76, 0x04, 0x18, 0xFC };
+    memcpy(&gb_p->memory_p->memory[0xC000], program, sizeof(program));
+    gb_p->cpu_p->PC = 0xC000;
+    gb_p->memory_p->memory[INTERRUPT_ENABLE_INDEX] = 0x01;
+    gb_p->memory_p->memory[INTERRUPT_REQUEST_INDEX] = 0x00;
+
+    emulate_frame(gb_p);
+
+    // the whole visible frame is skipped, the CPU only runs again once V-BLANK is requested
+    mu_check(gb_p->frame_halted_cycles >= 456 * 143);
+    mu_check(gb_p->halted_cycles == gb_p->frame_halted_cycles);
+    mu_check(gb_p->cpu_p->BC.hi != 0x00);
+    mu_check(gb_p->memory_p->memory[LY_INDEX] >= 144);
+
+    free_gb_context(gb_p);
+}
+
+MU_TEST(test_idle_loop_skip){
+
+    // wait : LDH A, (0x44) / CP 0x90 / JR NZ, wait then INC B / HALT
+    byte program[] = { 0xF0, 0x44, 0xFE, 0x90, 0x20, 0xFA, 0x04, 0x76 };
+    gb_context *contexts[2];
+
+    for (int i = 0; i < 2; i++){
+        contexts[i] = initialize_gb_context(initialize_cartridge(file_name));
+        initialize_game_state(contexts[i]->cpu_p, contexts[i]->memory_p);
+        memcpy(&contexts[i]->memory_p->memory[0x150], program, sizeof(program));
+        contexts[i]->cpu_p->PC = 0x150;
+        contexts[i]->cpu_p->block_cache_p = initialize_block_cache();
+    }
+    contexts[1]->idle_detection = FALSE;
+
+    emulate_frame(contexts[0]);
+    emulate_frame(contexts[1]);
+
+    mu_check(contexts[0]->idle_loops_skipped > 0);
+    mu_check(contexts[0]->idle_skipped_cycles > 456 * 100);
+    mu_check(contexts[1]->idle_skipped_cycles == 0);
+
+    // skipping whole iterations up to each event leaves the same state behind
+    mu_check(contexts[0]->cpu_p->BC.hi == 0x01);
+    mu_check(contexts[0]->cpu_p->PC == contexts[1]->cpu_p->PC);
+    mu_check(contexts[0]->scheduler_p->cycles == contexts[1]->scheduler_p->cycles);
+    mu_check(memcmp(contexts[0]->memory_p->memory, contexts[1]->memory_p->memory, MEMORY_SIZE) == 0);
+
+    free_gb_context(contexts[0]);
+    free_gb_context(contexts[1]);
+}
+
+MU_TEST(test_oam_dma){
+
+    gb_context *gb_p = initialize_gb_context(initialize_cartridge(file_name));
+    initialize_game_state(gb_p->cpu_p, gb_p->memory_p);
+    for (int i = 0; i < 0xA0; i++){
+        gb_p->memory_p->memory[0xC100 + i] = i;
+    }
+
+    // fast mode copies the whole page at once
+    write_memory(gb_p->memory_p, 0xFF46, 0xC1);
+    mu_check(memcmp(&gb_p->memory_p->memory[OAM_INDEX], &gb_p->memory_p->memory[0xC100], 0xA0) == 0);
+    mu_check(gb_p->memory_p->dma_active);
+    advance_cycles(gb_p, 640);
+    mu_check(!gb_p->memory_p->dma_active);
+
+    // timed mode copies a byte every M-cycle and only leaves HRAM to the CPU
+    memset(&gb_p->memory_p->memory[OAM_INDEX], 0, 0xA0);
+    gb_p->memory_p->dma_mode = DMA_TIMED;
+    write_memory(gb_p->memory_p, 0xFF46, 0xC1);
+    advance_cycles(gb_p, 40);
+    mu_check(gb_p->memory_p->memory[OAM_INDEX + 9] == 9);
+    mu_check(gb_p->memory_p->memory[OAM_INDEX + 10] == 0);
+    mu_check(read_memory(gb_p->memory_p, 0xC100) == 0xFF);
+    write_memory(gb_p->memory_p, 0xC000, 0x42);
+    write_memory(gb_p->memory_p, 0xFF80, 0x42);
+    mu_check(gb_p->memory_p->memory[0xC000] != 0x42);
+    mu_check(read_memory(gb_p->memory_p, 0xFF80) == 0x42);
+
+    // the CPU only fetches open bus from ROM, no block is decoded from it
+    gb_p->cpu_p->block_cache_p = initialize_block_cache();
+    gb_p->cpu_p->PC = 0x0150;
+    execute_next_block(gb_p->cpu_p);
+    mu_check(gb_p->cpu_p->PC == 0x0038);
+    mu_check(gb_p->cpu_p->block_cache_p->misses == 0);
+    mu_check(gb_p->cpu_p->block_cache_p->hits == 0);
+
+    advance_cycles(gb_p, 600);
+    mu_check(!gb_p->memory_p->dma_active);
+    mu_check(memcmp(&gb_p->memory_p->memory[OAM_INDEX], &gb_p->memory_p->memory[0xC100], 0xA0) == 0);
+    mu_check(read_memory(gb_p->memory_p, 0xC100) == 0x00);
+    gb_p->cpu_p->PC = 0x0150;
+    execute_next_block(gb_p->cpu_p);
+    mu_check(gb_p->cpu_p->block_cache_p->misses == 1);
+    mu_check(gb_p->cpu_p->block_cache_p->blocks[0x0150 & (BLOCK_CACHE_SIZE - 1)].instructions[0].opcode == gb_p->memory_p->memory[0x0150]);
+
+    free_gb_context(gb_p);
+}
+
+MU_TEST(test_tile_cache){
+
+    gb_context *gb_p = initialize_gb_context(initialize_cartridge(file_name));
+    initialize_game_state(gb_p->cpu_p, gb_p->memory_p);
+    tile_cache *cache_p = &gb_p->memory_p->tile_cache;
+    update_tile_cache(cache_p, &gb_p->memory_p->memory[VRAM_INDEX]);
+    unsigned long decoded = cache_p->decoded_tiles;
+
+    // tile 1, row 0 : colors 3 2 1 0 0 1 2 3
+    write_memory(gb_p->memory_p, 0x8010, 0xA5);
+    write_memory(gb_p->memory_p, 0x8011, 0xC3);
+    mu_check(cache_p->dirty[1] && cache_p->dirty_count == 1);
+    update_tile_cache(cache_p, &gb_p->memory_p->memory[VRAM_INDEX]);
+    mu_check(cache_p->decoded_tiles == decoded + 1);
+    byte expected[8] = { 3, 2, 1, 0, 0, 1, 2, 3 };
+    mu_check(memcmp(cache_p->pixels[1][0], expected, 8) == 0);
+
+    // the background of line 0 is drawn from the cached tile, the frame is rendered when V-BLANK starts
+    gb_p->frames_p = initialize_frame_exchange(&gb_p->framebuffer);
+    memset(&gb_p->memory_p->memory[0x9800], 0x01, 32);
+    write_memory(gb_p->memory_p, BACKGROUND_PALETTE, 0xE4);
+    advance_cycles(gb_p, 145 * 456);
+    byte *line_p = FRAMEBUFFER_LINE(take_frame(gb_p->frames_p), 0);
+    mu_check(line_p[0 * 3] == 0x00);
+    mu_check(line_p[1 * 3] == 0x77);
+    mu_check(line_p[2 * 3] == 0xCC);
+    mu_check(line_p[3 * 3] == 0xFF);
+    mu_check(line_p[8 * 3] == 0x00);
+
+    free_gb_context(gb_p);
+}
+
+MU_TEST(test_render_background_matches_per_pixel){
+
+    gb_context *gb_p = initialize_gb_context(initialize_cartridge(file_name));
+    memory_map *gb_memory_p = gb_p->memory_p;
+    byte reference[SCREEN_WIDTH][3];
+    int mismatches = 0;
+
+    srand(1);
+    for (int address = VRAM_INDEX; address < 0xA000; address++){
+        gb_memory_p->memory[address] = rand();
+    }
+    invalidate_tile_cache(&gb_memory_p->tile_cache);
+    update_tile_cache(&gb_memory_p->tile_cache, &gb_memory_p->memory[VRAM_INDEX]);
+
+    // every map / tile data / window combination with random scrolling, window position and palette
+    for (int config = 0; config < 64; config++){
+        byte lcdc = 0x81 | ((config & 0xF) << 3);
+        gb_memory_p->memory[SCROLL_X_INDEX] = rand();
+        gb_memory_p->memory[SCROLL_Y_INDEX] = rand();
+        gb_memory_p->memory[WINDOW_X_INDEX] = (config & 0x10) ? rand() % 167 : rand();
+        gb_memory_p->memory[WINDOW_Y_INDEX] = rand() % 144;
+        write_memory(gb_memory_p, BACKGROUND_PALETTE, rand());
+
+        for (int line = 0; line < SCREEN_HEIGHT; line++){
+            gb_memory_p->memory[LY_INDEX] = line;
+            render_background_per_pixel(gb_p, lcdc);
+            memcpy(reference, FRAMEBUFFER_LINE(&gb_p->framebuffer, line), sizeof(reference));
+            memset(FRAMEBUFFER_LINE(&gb_p->framebuffer, line), 0x55, sizeof(reference));
+            render_background(gb_p, lcdc);
+            mismatches += memcmp(reference, FRAMEBUFFER_LINE(&gb_p->framebuffer, line), sizeof(reference)) != 0;
+        }
+    }
+    mu_check(mismatches == 0);
+
+    free_gb_context(gb_p);
+}
+
+MU_TEST(test_palette_tables){
+
+    gb_context *gb_p = initialize_gb_context(initialize_cartridge(file_name));
+    memory_map *gb_memory_p = gb_p->memory_p;
+    palette_tables *palettes_p = &gb_memory_p->palettes;
+    byte reference[SCREEN_WIDTH][3];
+    int mismatches = 0;
+
+    // BGP 0x1B reverses the shades, the table is rebuilt by the write
+    write_memory(gb_memory_p, BACKGROUND_PALETTE, 0x1B);
+    mu_check(palettes_p->registers[PALETTE_BACKGROUND] == 0x1B);
+    mu_check(palettes_p->shades[PALETTE_BACKGROUND][0] == 3 && palettes_p->shades[PALETTE_BACKGROUND][3] == 0);
+    byte *black = (byte *) &palettes_p->rgba[PALETTE_BACKGROUND][0];
+    mu_check(black[0] == 0x00 && black[1] == 0x00 && black[2] == 0x00 && black[3] == 0xFF);
+    mu_check(palettes_p->channels[PALETTE_BACKGROUND][4 + 3] == 0xFF);
+
+    // OBP0 doesn't touch the background table
+    write_memory(gb_memory_p, 0xFF48, 0xE4);
+    mu_check(palettes_p->shades[PALETTE_SPRITE_1][1] == 1);
+    mu_check(palettes_p->shades[PALETTE_BACKGROUND][1] == 2);
+
+    // a new color scheme rebuilds every table from the current registers
+    set_color_scheme(palettes_p, COLOR_SCHEME_GREEN);
+    mu_check(memcmp(&palettes_p->rgba[PALETTE_BACKGROUND][0], color_schemes[COLOR_SCHEME_GREEN][3], 4) == 0);
+    mu_check(memcmp(&palettes_p->rgba[PALETTE_SPRITE_1][0], color_schemes[COLOR_SCHEME_GREEN][0], 4) == 0);
+
+    srand(2);
+    for (int address = VRAM_INDEX; address < 0xA000; address++){
+        gb_memory_p->memory[address] = rand();
+    }
+    invalidate_tile_cache(&gb_memory_p->tile_cache);
+    update_tile_cache(&gb_memory_p->tile_cache, &gb_memory_p->memory[VRAM_INDEX]);
+    for (int line = 0; line < SCREEN_HEIGHT; line++){
+        gb_memory_p->memory[LY_INDEX] = line;
+        render_background_per_pixel(gb_p, 0x91);
+        memcpy(reference, FRAMEBUFFER_LINE(&gb_p->framebuffer, line), sizeof(reference));
+        render_background(gb_p, 0x91);
+        mismatches += memcmp(reference, FRAMEBUFFER_LINE(&gb_p->framebuffer, line), sizeof(reference)) != 0;
+    }
+    mu_check(mismatches == 0);
+
+    free_gb_context(gb_p);
+}
+
+MU_TEST(test_framebuffer_formats){
+
+    gb_context *gb_p = initialize_gb_context(initialize_cartridge(file_name));
+    memory_map *gb_memory_p = gb_p->memory_p;
+    framebuffer *framebuffer_p = &gb_p->framebuffer;
+    byte reference[SCREEN_WIDTH * 4];
+    int mismatches = 0;
+
+    mu_check(framebuffer_p->format == FRAMEBUFFER_RGB24 && framebuffer_p->pitch == SCREEN_WIDTH * 3);
+    mu_check(((uintptr_t) framebuffer_p->pixels % FRAMEBUFFER_ALIGNMENT) == 0);
+
+    srand(3);
+    for (int address = VRAM_INDEX; address < 0xA000; address++){
+        gb_memory_p->memory[address] = rand();
+    }
+    invalidate_tile_cache(&gb_memory_p->tile_cache);
+    update_tile_cache(&gb_memory_p->tile_cache, &gb_memory_p->memory[VRAM_INDEX]);
+    write_memory(gb_memory_p, BACKGROUND_PALETTE, 0x1B);
+    gb_memory_p->memory[SCROLL_X_INDEX] = 0;
+    gb_memory_p->memory[SCROLL_Y_INDEX] = 0;
+
+    // the line renderer matches the per pixel one in every format
+    for (byte format = FRAMEBUFFER_INDEXED; format <= FRAMEBUFFER_RGBA32; format++){
+        set_framebuffer_format(framebuffer_p, format);
+        for (int line = 0; line < SCREEN_HEIGHT; line++){
+            gb_memory_p->memory[LY_INDEX] = line;
+            render_background_per_pixel(gb_p, 0x91);
+            memcpy(reference, FRAMEBUFFER_LINE(framebuffer_p, line), framebuffer_p->pitch);
+            memset(FRAMEBUFFER_LINE(framebuffer_p, line), 0x55, framebuffer_p->pitch);
+            render_background(gb_p, 0x91);
+            mismatches += memcmp(reference, FRAMEBUFFER_LINE(framebuffer_p, line), framebuffer_p->pitch) != 0;
+        }
+    }
+    mu_check(mismatches == 0);
+
+    // the RGBA pixels are whole entries of the palette table, indexed pixels are shades
+    byte color = gb_memory_p->tile_cache.pixels[gb_memory_p->memory[0x9800]][0][0];
+    mu_check(memcmp(FRAMEBUFFER_LINE(framebuffer_p, 0), &gb_memory_p->palettes.rgba[PALETTE_BACKGROUND][color], 4) == 0);
+    mu_check(FRAMEBUFFER_LINE(framebuffer_p, 0)[3] == 0xFF);
+    set_framebuffer_format(framebuffer_p, FRAMEBUFFER_INDEXED);
+    gb_memory_p->memory[LY_INDEX] = 0;
+    render_background(gb_p, 0x91);
+    mu_check(FRAMEBUFFER_LINE(framebuffer_p, 0)[0] == 3 - color);
+
+    free_gb_context(gb_p);
+}
+
+MU_TEST(test_framebuffer_dump){
+
+    gb_context *gb_p = initialize_gb_context(initialize_cartridge(file_name));
+    framebuffer *framebuffer_p = &gb_p->framebuffer;
+    char *dump_file = "/tmp/matchagb_frame.pgm";
+    struct stat dump_stat;
+
+    set_framebuffer_format(framebuffer_p, FRAMEBUFFER_INDEXED);
+    clear_framebuffer(framebuffer_p);
+    uint64_t white = hash_framebuffer(framebuffer_p);
+    FRAMEBUFFER_LINE(framebuffer_p, 143)[159] = 3;
+    mu_check(hash_framebuffer(framebuffer_p) != white);
+
+    // PGM header and one byte per pixel
+    mu_check(dump_framebuffer(framebuffer_p, dump_file));
+    mu_check(stat(dump_file, &dump_stat) == 0);
+    mu_check(dump_stat.st_size == strlen("P5\n160 144\n255\n") + (SCREEN_WIDTH * SCREEN_HEIGHT));
+    unlink(dump_file);
+
+    free_gb_context(gb_p);
+}
+
+MU_TEST(test_plane_cache){
+
+    gb_context *gb_p = initialize_gb_context(initialize_cartridge(file_name));
+    memory_map *gb_memory_p = gb_p->memory_p;
+    plane_cache *planes_p = &gb_memory_p->plane_cache;
+    byte reference[SCREEN_WIDTH][3];
+
+    srand(4);
+    for (int address = VRAM_INDEX; address < 0xA000; address++){
+        gb_memory_p->memory[address] = rand();
+    }
+    invalidate_tile_cache(&gb_memory_p->tile_cache);
+    update_tile_cache(&gb_memory_p->tile_cache, &gb_memory_p->memory[VRAM_INDEX]);
+    gb_memory_p->memory[SCROLL_X_INDEX] = 250;
+    gb_memory_p->memory[SCROLL_Y_INDEX] = 0;
+    gb_memory_p->memory[LY_INDEX] = 0;
+
+    // both maps are drawn once, then nothing until something changes
+    render_background(gb_p, 0x91);
+    unsigned long drawn = planes_p->drawn_cells;
+    mu_check(drawn >= PLANE_COUNT * PLANE_CELLS);
+    render_background(gb_p, 0x91);
+    mu_check(planes_p->drawn_cells == drawn);
+
+    // a map write draws its cell, the line wraps around the plane at SCX 250
+    write_memory(gb_memory_p, 0x9800, gb_memory_p->memory[0x9800] + 1);
+    render_background(gb_p, 0x91);
+    mu_check(planes_p->drawn_cells == drawn + 1);
+    memcpy(reference, FRAMEBUFFER_LINE(&gb_p->framebuffer, 0), sizeof(reference));
+    render_background_per_pixel(gb_p, 0x91);
+    mu_check(memcmp(reference, FRAMEBUFFER_LINE(&gb_p->framebuffer, 0), sizeof(reference)) == 0);
+
+    // a tile data write draws every cell showing the tile
+    byte tile = gb_memory_p->memory[0x9801];
+    int cells = 0;
+    for (int cell = 0; cell < PLANE_COUNT * PLANE_CELLS; cell++){
+        cells += gb_memory_p->memory[0x9800 + cell] == tile;
+    }
+    write_memory(gb_memory_p, VRAM_INDEX + (tile * TILE_SIZE), gb_memory_p->memory[VRAM_INDEX + (tile * TILE_SIZE)] ^ 0xFF);
+    update_tile_cache(&gb_memory_p->tile_cache, &gb_memory_p->memory[VRAM_INDEX]);
+    drawn = planes_p->drawn_cells;
+    render_background(gb_p, 0x91);
+    mu_check(planes_p->drawn_cells == drawn + cells);
+    memcpy(reference, FRAMEBUFFER_LINE(&gb_p->framebuffer, 0), sizeof(reference));
+    render_background_per_pixel(gb_p, 0x91);
+    mu_check(memcmp(reference, FRAMEBUFFER_LINE(&gb_p->framebuffer, 0), sizeof(reference)) == 0);
+
+    free_gb_context(gb_p);
+}
+
+static void set_sprite(memory_map *memory_p, int sprite, byte y, byte x, byte tile, byte attributes){
+    write_memory(memory_p, OAM_INDEX + (sprite * 4), y);
+    write_memory(memory_p, OAM_INDEX + (sprite * 4) + 1, x);
+    write_memory(memory_p, OAM_INDEX + (sprite * 4) + 2, tile);
+    write_memory(memory_p, OAM_INDEX + (sprite * 4) + 3, attributes);
+}
+
+MU_TEST(test_sprite_lines){
+
+    gb_context *gb_p = initialize_gb_context(initialize_cartridge(file_name));
+    memory_map *gb_memory_p = gb_p->memory_p;
+    byte *line_p = FRAMEBUFFER_LINE(&gb_p->framebuffer, 0);
+
+    // tile 1 is all color 3, tile 2 has color 1 on its leftmost pixel only
+    for (int address = 0x8010; address < 0x8020; address++){
+        write_memory(gb_memory_p, address, 0xFF);
+    }
+    for (int row = 0; row < 8; row++){
+        write_memory(gb_memory_p, 0x8020 + (row * 2), 0x80);
+    }
+    for (int address = 0x9800; address < 0xA000; address++){
+        write_memory(gb_memory_p, address, 0);
+    }
+    memset(&gb_memory_p->memory[OAM_INDEX], 0, 0xA0);
+    gb_memory_p->sprite_cache.dirty = TRUE;
+    write_memory(gb_memory_p, BACKGROUND_PALETTE, 0xE4);
+    write_memory(gb_memory_p, SPRITE_PALETTE_1, 0xE4);
+    write_memory(gb_memory_p, SPRITE_PALETTE_2, 0x1B);
+    gb_memory_p->memory[LCDC_INDEX] = 0x93;
+    gb_memory_p->memory[SCROLL_X_INDEX] = 0;
+    gb_memory_p->memory[SCROLL_Y_INDEX] = 0;
+    gb_memory_p->memory[LY_INDEX] = 0;
+    set_framebuffer_format(&gb_p->framebuffer, FRAMEBUFFER_INDEXED);
+
+    // only the first 10 sprites of a line are drawn
+    for (int sprite = 0; sprite < 12; sprite++){
+        set_sprite(gb_memory_p, sprite, 16, 8 + (sprite * 8), 1, 0);
+    }
+    draw_scanline(gb_p);
+    mu_check(gb_memory_p->sprite_cache.line_counts[0] == 10);
+    mu_check(line_p[79] == 3 && line_p[80] == 0);
+
+    // lower X wins over OAM order, sprite 1 covers the first pixels of sprite 0
+    memset(&gb_memory_p->memory[OAM_INDEX], 0, 0xA0);
+    set_sprite(gb_memory_p, 0, 16, 12, 1, 0x10);
+    set_sprite(gb_memory_p, 1, 16, 8, 1, 0);
+    draw_scanline(gb_p);
+    mu_check(gb_memory_p->sprite_cache.line_sprites[0][0] == 1);
+    mu_check(line_p[4] == 3 && line_p[7] == 3);
+    mu_check(line_p[8] == 0 && line_p[11] == 0);
+
+    // X flip moves the opaque pixel of tile 2 to the right, color 0 shows the background
+    set_sprite(gb_memory_p, 0, 16, 8, 2, 0x20);
+    set_sprite(gb_memory_p, 1, 0, 0, 0, 0);
+    draw_scanline(gb_p);
+    mu_check(line_p[0] == 0 && line_p[7] == 1);
+
+    // behind the background, the sprite only shows over background color 0
+    write_memory(gb_memory_p, 0x9800, 1);
+    set_sprite(gb_memory_p, 0, 16, 8, 1, 0x80);
+    set_sprite(gb_memory_p, 1, 16, 16, 1, 0x80);
+    draw_scanline(gb_p);
+    mu_check(line_p[0] == 3 && line_p[8] == 3);
+    write_memory(gb_memory_p, BACKGROUND_PALETTE, 0x00);
+    draw_scanline(gb_p);
+    mu_check(line_p[0] == 0 && line_p[8] == 3);
+
+    free_gb_context(gb_p);
+}
+
+static void set_frame_scene(gb_context *gb_p){
+    memory_map *gb_memory_p = gb_p->memory_p;
+
+    for (int address = 0x8000; address < 0x9800; address++){
+        write_memory(gb_memory_p, address, (address * 7) ^ (address >> 3));
+    }
+    for (int address = 0x9800; address < 0xA000; address++){
+        write_memory(gb_memory_p, address, address & 0x7F);
+    }
+    memset(&gb_memory_p->memory[OAM_INDEX], 0, 0xA0);
+    set_sprite(gb_memory_p, 0, 40, 30, 5, 0);
+    set_sprite(gb_memory_p, 1, 100, 90, 9, 0xB0);
+    write_memory(gb_memory_p, BACKGROUND_PALETTE, 0xE4);
+    write_memory(gb_memory_p, SPRITE_PALETTE_1, 0xD2);
+    write_memory(gb_memory_p, WINDOW_Y_INDEX, 80);
+    write_memory(gb_memory_p, WINDOW_X_INDEX, 47);
+    write_memory(gb_memory_p, LCDC_INDEX, 0xF3);
+}
+
+MU_TEST(test_frame_batching){
+
+    gb_context *batched_p = initialize_gb_context(initialize_cartridge(file_name));
+    gb_context *lines_p = initialize_gb_context(initialize_cartridge(file_name));
+    raster_log *log_p = &batched_p->memory_p->raster_log;
+    lines_p->frame_batching = FALSE;
+    set_frame_scene(batched_p);
+    set_frame_scene(lines_p);
+
+    // nothing changes during the frame, the lines are only drawn when V-BLANK starts
+    advance_cycles(batched_p, 100 * 456);
+    mu_check(log_p->deferring && log_p->deferred_lines == 100);
+    advance_cycles(batched_p, 45 * 456);
+    advance_cycles(lines_p, 145 * 456);
+    mu_check(log_p->fast_frames == 1 && log_p->slow_frames == 0);
+    mu_check(memcmp(batched_p->framebuffer.pixels, lines_p->framebuffer.pixels, FRAMEBUFFER_SIZE(&lines_p->framebuffer)) == 0);
+
+    // a scroll in the middle of the next frame draws the lines before it with the old value
+    advance_cycles(batched_p, 9 * 456 + (72 * 456) + 300);
+    advance_cycles(lines_p, 9 * 456 + (72 * 456) + 300);
+    write_memory(batched_p->memory_p, SCROLL_X_INDEX, 3);
+    write_memory(lines_p->memory_p, SCROLL_X_INDEX, 3);
+    mu_check(!log_p->deferring && log_p->slow_frames == 1);
+    advance_cycles(batched_p, 72 * 456);
+    advance_cycles(lines_p, 72 * 456);
+    mu_check(log_p->fast_frames == 1);
+    mu_check(memcmp(batched_p->framebuffer.pixels, lines_p->framebuffer.pixels, FRAMEBUFFER_SIZE(&lines_p->framebuffer)) == 0);
+
+    // writing the value a register already holds isn't a raster effect
+    advance_cycles(batched_p, 10 * 456 + 300);
+    write_memory(batched_p->memory_p, SCROLL_X_INDEX, 3);
+    write_memory(batched_p->memory_p, 0x9800, batched_p->memory_p->memory[0x9800]);
+    mu_check(log_p->deferring);
+
+    free_gb_context(batched_p);
+    free_gb_context(lines_p);
+}
+
+MU_TEST(test_render_thread){
+
+    gb_context *threaded_p = initialize_gb_context(initialize_cartridge(file_name));
+    gb_context *inline_p = initialize_gb_context(initialize_cartridge(file_name));
+    gb_context *contexts[] = { threaded_p, inline_p };
+    set_frame_scene(threaded_p);
+    set_frame_scene(inline_p);
+    threaded_p->render_thread_p = initialize_render_thread(threaded_p);
+    mu_check(threaded_p->render_thread_p != NULL);
+
+    // scroll, tile data, tile map and sprite changes in the middle of the frame
+    for (int i = 0; i < 2; i++){
+        advance_cycles(contexts[i], 40 * 456 + 300);
+        write_memory(contexts[i]->memory_p, SCROLL_X_INDEX, 5);
+        advance_cycles(contexts[i], 30 * 456);
+        write_memory(contexts[i]->memory_p, 0x8050, 0x3C);
+        write_memory(contexts[i]->memory_p, 0x9A40, 0x05);
+        set_sprite(contexts[i]->memory_p, 0, 96, 60, 3, 0x20);
+        advance_cycles(contexts[i], 30 * 456);
+        write_memory(contexts[i]->memory_p, BACKGROUND_PALETTE, 0x1B);
+        advance_cycles(contexts[i], 45 * 456);
+    }
+    wait_render_thread(threaded_p->render_thread_p);
+    mu_check(threaded_p->render_thread_p->made_copies == 2);
+    mu_check(memcmp(threaded_p->framebuffer.pixels, inline_p->framebuffer.pixels, FRAMEBUFFER_SIZE(&inline_p->framebuffer)) == 0);
+
+    free_gb_context(threaded_p);
+    free_gb_context(inline_p);
+}
+
+MU_TEST(test_frame_exchange){
+
+    framebuffer back;
+    initialize_framebuffer(&back, FRAMEBUFFER_INDEXED);
+    byte *first_p = back.pixels;
+    frame_exchange *exchange_p = initialize_frame_exchange(&back);
+
+    // the published buffer goes to the consumer as is, the emulation gets a free one
+    memset(back.pixels, 1, FRAMEBUFFER_SIZE(&back));
+    publish_frame(exchange_p, &back);
+    mu_check(back.pixels != first_p);
+    framebuffer *frame_p = take_frame(exchange_p);
+    mu_check(frame_p->pixels == first_p && frame_p->pixels[0] == 1);
+    mu_check(take_frame(exchange_p) == frame_p && exchange_p->repeated_frames == 1);
+
+    // two frames before the consumer comes back, only the newest is shown
+    memset(back.pixels, 2, FRAMEBUFFER_SIZE(&back));
+    publish_frame(exchange_p, &back);
+    mu_check(back.pixels != frame_p->pixels);
+    memset(back.pixels, 3, FRAMEBUFFER_SIZE(&back));
+    publish_frame(exchange_p, &back);
+    mu_check(back.pixels != frame_p->pixels);
+    frame_p = take_frame(exchange_p);
+    mu_check(frame_p->pixels[0] == 3 && exchange_p->dropped_frames == 1);
+    mu_check(exchange_p->published_frames == 3 && exchange_p->taken_frames == 2);
+    free_frame_exchange(exchange_p);
+
+    // frames published at V-BLANK, drawn by the render thread
+    gb_context *exchanged_p = initialize_gb_context(initialize_cartridge(file_name));
+    gb_context *inline_p = initialize_gb_context(initialize_cartridge(file_name));
+    set_frame_scene(exchanged_p);
+    set_frame_scene(inline_p);
+    exchanged_p->frames_p = initialize_frame_exchange(&exchanged_p->framebuffer);
+    exchanged_p->render_thread_p = initialize_render_thread(exchanged_p);
+    for (int frame = 0; frame < 2; frame++){
+        advance_cycles(exchanged_p, 60 * 456);
+        advance_cycles(inline_p, 60 * 456);
+        write_memory(exchanged_p->memory_p, SCROLL_Y_INDEX, frame + 1);
+        write_memory(inline_p->memory_p, SCROLL_Y_INDEX, frame + 1);
+        advance_cycles(exchanged_p, (frame == 0) ? 85 * 456 : 154 * 456);
+        advance_cycles(inline_p, (frame == 0) ? 85 * 456 : 154 * 456);
+        frame_p = take_frame(exchanged_p->frames_p);
+        mu_check(frame_p->pixels != exchanged_p->framebuffer.pixels);
+        mu_check(memcmp(frame_p->pixels, inline_p->framebuffer.pixels, FRAMEBUFFER_SIZE(frame_p)) == 0);
+    }
+    mu_check(exchanged_p->frames_p->published_frames == 2);
+
+    free_gb_context(exchanged_p);
+    free_gb_context(inline_p);
+}
 
 // MU_TEST(test_write_memory_no_bank_switch){}
 //MU_TEST(test_write_memory_external_ram){}
@@ -408,6 +1420,9 @@ MU_TEST_SUITE(test_suite){
     MU_RUN_TEST(test_read_memory_normal);
     MU_RUN_TEST(test_read_memory_rom_no_switch);
     MU_RUN_TEST(test_read_memory_external_ram_no_switch);
+    MU_RUN_TEST(test_memory_pages_bank_switch);
+    MU_RUN_TEST(test_mbc_banks);
+    MU_RUN_TEST(test_battery_save);
     MU_RUN_TEST(test_write_memory_internal_ram);
     MU_RUN_TEST(test_write_normal);  
     
@@ -429,6 +1444,31 @@ MU_TEST_SUITE(test_suite){
     MU_RUN_TEST(test_load_register_SP);
     MU_RUN_TEST(test_load_ldhl);
     MU_RUN_TEST(test_write_SP);
+    MU_RUN_TEST(test_alu_flags);
+    MU_RUN_TEST(test_execute_cached_block);
+    MU_RUN_TEST(test_boot_rom);
+    MU_RUN_TEST(test_block_cache_rom0_bank);
+    MU_RUN_TEST(test_jit_matches_interpreter);
+    MU_RUN_TEST(test_jit_timed_dma);
+    MU_RUN_TEST(test_independent_contexts);
+    MU_RUN_TEST(test_rom_registry);
+    MU_RUN_TEST(test_scheduler_events);
+    MU_RUN_TEST(test_halt_skips_to_interrupt);
+    MU_RUN_TEST(test_idle_loop_skip);
+    MU_RUN_TEST(test_oam_dma);
+    MU_RUN_TEST(test_tile_cache);
+    MU_RUN_TEST(test_render_background_matches_per_pixel);
+    MU_RUN_TEST(test_plane_cache);
+    MU_RUN_TEST(test_sprite_lines);
+    MU_RUN_TEST(test_frame_batching);
+    MU_RUN_TEST(test_render_thread);
+    MU_RUN_TEST(test_frame_exchange);
+    MU_RUN_TEST(test_palette_tables);
+    MU_RUN_TEST(test_framebuffer_formats);
+    MU_RUN_TEST(test_framebuffer_dump);
+#ifdef TRACE
+    MU_RUN_TEST(test_trace_categories);
+#endif
 }
 
 int main (int argc, char *argv[]){